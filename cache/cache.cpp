@@ -318,6 +318,11 @@ class cache_t {
 		}
 };
 
+static void release_data(void *priv)
+{
+	delete (boost::shared_ptr<raw_data_t> *)priv;
+}
+
 }}
 
 using namespace ioremap::cache;
@@ -365,7 +370,10 @@ int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dn
 				}
 
 				io->size = d->size();
-				err = dnet_send_read_data(st, cmd, io, (char *)d->data().data() + io->offset, -1, io->offset, 0);
+
+				/* cached data is immutable, reply holds a reference instead of copying it */
+				err = dnet_send_read_data_nocopy(st, cmd, io, (char *)d->data().data() + io->offset,
+						release_data, new boost::shared_ptr<raw_data_t>(d));
 				break;
 			case DNET_CMD_DEL:
 				err = -ENOENT;
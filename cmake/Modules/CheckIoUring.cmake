@@ -0,0 +1,44 @@
+# Check whether io_uring headers and syscalls are available
+# Multishot recv, provided buffer rings and linked send requests need linux 6.0 headers
+
+include(CheckCSourceCompiles)
+
+if (UNIX OR MINGW)
+    SET(CMAKE_REQUIRED_DEFINITIONS -Werror-implicit-function-declaration)
+endif()
+
+check_c_source_compiles("#include <sys/types.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+int main()
+{
+    struct io_uring_params p;
+    struct io_uring_sqe sqe;
+    struct __kernel_timespec ts;
+    ts.tv_sec = 1;
+    struct io_uring_buf_reg reg;
+    struct io_uring_buf_ring *br = NULL;
+    struct io_uring_probe *probe = NULL;
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.poll_events = 0;
+    sqe.opcode = IORING_OP_RECV;
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.opcode = IORING_OP_SPLICE;
+    sqe.opcode = IORING_OP_SENDMSG;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    reg.bgid = 0;
+    p.features = IORING_FEAT_NODROP | IORING_FEAT_SINGLE_MMAP;
+    syscall(__NR_io_uring_setup, 1, &p);
+    syscall(__NR_io_uring_enter, 0, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    syscall(__NR_io_uring_register, 0, IORING_REGISTER_PBUF_RING, &reg, 1);
+    syscall(__NR_io_uring_register, 0, IORING_REGISTER_PROBE, probe, IORING_OP_SEND_ZC);
+    return br->tail + IORING_CQE_F_MORE + IORING_CQE_F_BUFFER;
+    return 0;
+}" HAVE_IO_URING_SUPPORT)
+unset(CMAKE_REQUIRED_DEFINITIONS)
+
+if(HAVE_IO_URING_SUPPORT)
+    add_definitions(-DHAVE_IO_URING_SUPPORT=1)
+endif()
+message(STATUS "io_uring support: ${HAVE_IO_URING_SUPPORT}")
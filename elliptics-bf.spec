@@ -1,6 +1,6 @@
 Summary:	Distributed hash table storage
 Name:		elliptics
-Version:	2.19.2.8
+Version:	2.20.0.0
 Release:	1%{?dist}
 
 License:	GPLv2+
@@ -152,6 +152,12 @@ rm -rf %{buildroot}
 
 
 %changelog
+* Sat Oct 17 2026 agent <agent@local> - 2.20.0.0
+- Bump ABI version: struct dnet_config grew beyond reserved space
+- Added net_cpus, io_cpus, nonblocking_io_cpus and check_cpus CPU lists to struct dnet_config
+- Added io_class_weights and io_class_limits per-class IO queue settings to struct dnet_config
+- Added trace_file to struct dnet_config, reserved space is grown back to 12 ints
+
 * Mon Nov 26 2012 Evgeniy Polyakov <zbr@ioremap.net> - 2.19.2.8
 - dnet_remove_object_raw() must return positive number of transactions sent
 
@@ -106,6 +106,16 @@ static int dnet_simple_set(struct dnet_config_backend *b __unused, char *key, ch
 		dnet_cfg_state.io_thread_num = value;
 	else if (!strcmp(key, "nonblocking_io_thread_num"))
 		dnet_cfg_state.nonblocking_io_thread_num = value;
+	else if (!strcmp(key, "io_thread_max"))
+		dnet_cfg_state.io_thread_max = value;
+	else if (!strcmp(key, "nonblocking_io_thread_max"))
+		dnet_cfg_state.nonblocking_io_thread_max = value;
+	else if (!strcmp(key, "io_thread_idle_timeout"))
+		dnet_cfg_state.io_thread_idle_timeout = value;
+	else if (!strcmp(key, "log_ring_kb"))
+		dnet_cfg_state.log_ring_kb = value;
+	else if (!strcmp(key, "trace_sample"))
+		dnet_cfg_state.trace_sample = value;
 	else if (!strcmp(key, "net_thread_num"))
 		dnet_cfg_state.net_thread_num = value;
 	else if (!strcmp(key, "bg_ionice_class"))
@@ -120,6 +130,14 @@ static int dnet_simple_set(struct dnet_config_backend *b __unused, char *key, ch
 		dnet_cfg_state.client_prio = value;
 	else if (!strcmp(key, "oplock_num"))
 		dnet_cfg_state.oplock_num = value;
+	else if (!strcmp(key, "io_pool_mode"))
+		dnet_cfg_state.io_pool_mode = value;
+	else if (!strcmp(key, "net_engine"))
+		dnet_cfg_state.net_engine = value;
+	else if (!strcmp(key, "io_queue_max"))
+		dnet_cfg_state.io_queue_max = value;
+	else if (!strcmp(key, "io_queue_max_mb"))
+		dnet_cfg_state.io_queue_max_mb = value;
 	else
 		return -1;
 
@@ -163,6 +181,35 @@ static int dnet_set_srw(struct dnet_config_backend *b __unused, char *key, char
 	return 0;
 }
 
+static int dnet_set_io_string(struct dnet_config_backend *b __unused, char *key, char *value)
+{
+	char **ptr = NULL;
+
+	if (!strcmp(key, "net_cpus"))
+		ptr = &dnet_cfg_state.net_cpus;
+	else if (!strcmp(key, "io_cpus"))
+		ptr = &dnet_cfg_state.io_cpus;
+	else if (!strcmp(key, "nonblocking_io_cpus"))
+		ptr = &dnet_cfg_state.nonblocking_io_cpus;
+	else if (!strcmp(key, "check_cpus"))
+		ptr = &dnet_cfg_state.check_cpus;
+	else if (!strcmp(key, "io_class_weights"))
+		ptr = &dnet_cfg_state.io_class_weights;
+	else if (!strcmp(key, "io_class_limits"))
+		ptr = &dnet_cfg_state.io_class_limits;
+	else if (!strcmp(key, "trace_file"))
+		ptr = &dnet_cfg_state.trace_file;
+
+	if (ptr) {
+		free(*ptr);
+		*ptr = strdup(value);
+		if (!*ptr)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
 static int dnet_set_malloc_options(struct dnet_config_backend *b __unused, char *key __unused, char *value)
 {
 	int err, thr = atoi(value);
@@ -258,6 +305,10 @@ static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"history", dnet_set_history_env},
 	{"io_thread_num", dnet_simple_set},
 	{"nonblocking_io_thread_num", dnet_simple_set},
+	{"io_thread_max", dnet_simple_set},
+	{"nonblocking_io_thread_max", dnet_simple_set},
+	{"io_thread_idle_timeout", dnet_simple_set},
+	{"log_ring_kb", dnet_simple_set},
 	{"net_thread_num", dnet_simple_set},
 	{"bg_ionice_class", dnet_simple_set},
 	{"bg_ionice_prio", dnet_simple_set},
@@ -266,6 +317,18 @@ static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"server_net_prio", dnet_simple_set},
 	{"client_net_prio", dnet_simple_set},
 	{"oplock_num", dnet_simple_set},
+	{"io_pool_mode", dnet_simple_set},
+	{"net_engine", dnet_simple_set},
+	{"io_queue_max", dnet_simple_set},
+	{"io_queue_max_mb", dnet_simple_set},
+	{"net_cpus", dnet_set_io_string},
+	{"io_cpus", dnet_set_io_string},
+	{"nonblocking_io_cpus", dnet_set_io_string},
+	{"check_cpus", dnet_set_io_string},
+	{"io_class_weights", dnet_set_io_string},
+	{"io_class_limits", dnet_set_io_string},
+	{"trace_sample", dnet_simple_set},
+	{"trace_file", dnet_set_io_string},
 	{"srw_config", dnet_set_srw},
 	{"cache_size", dnet_set_cache_size},
 };
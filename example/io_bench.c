@@ -0,0 +1,436 @@
+/*
+ * 2012+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Small request throughput benchmark.
+ *
+ * Starts server node with in-memory backend and several client nodes (connections) in this process,
+ * client threads read small object in closed loop. Server is restarted for every IO pool mode,
+ * so numbers of shared queue and work-stealing pools are taken on the same setup.
+ *
+ * Send path system calls of both client and server are counted by wrappers below, library calls
+ * resolve to them instead of libc ones, and are reported per request.
+ * Server receive slab counters are reported as hit rate and hits/misses per request.
+ */
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+/* receive slab counters are read directly from the server node */
+#include "../library/elliptics.h"
+
+enum io_bench_syscalls {
+	IO_BENCH_SEND = 0,
+	IO_BENCH_SENDMSG,
+	IO_BENCH_WRITEV,
+	IO_BENCH_SETSOCKOPT,
+	IO_BENCH_EPOLL_CTL,
+	__IO_BENCH_SYSCALL_MAX,
+};
+
+static const char *io_bench_syscall_names[__IO_BENCH_SYSCALL_MAX] = {
+	[IO_BENCH_SEND] = "send",
+	[IO_BENCH_SENDMSG] = "sendmsg",
+	[IO_BENCH_WRITEV] = "writev",
+	[IO_BENCH_SETSOCKOPT] = "setsockopt",
+	[IO_BENCH_EPOLL_CTL] = "epoll_ctl",
+};
+
+static long io_bench_syscalls[__IO_BENCH_SYSCALL_MAX];
+
+ssize_t send(int s, const void *buf, size_t len, int flags)
+{
+	__sync_fetch_and_add(&io_bench_syscalls[IO_BENCH_SEND], 1);
+	return syscall(SYS_sendto, s, buf, len, flags, NULL, 0);
+}
+
+ssize_t sendmsg(int s, const struct msghdr *msg, int flags)
+{
+	__sync_fetch_and_add(&io_bench_syscalls[IO_BENCH_SENDMSG], 1);
+	return syscall(SYS_sendmsg, s, msg, flags);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	__sync_fetch_and_add(&io_bench_syscalls[IO_BENCH_WRITEV], 1);
+	return syscall(SYS_writev, fd, iov, iovcnt);
+}
+
+int setsockopt(int s, int level, int name, const void *val, socklen_t len)
+{
+	__sync_fetch_and_add(&io_bench_syscalls[IO_BENCH_SETSOCKOPT], 1);
+	return syscall(SYS_setsockopt, s, level, name, val, len);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev)
+{
+	__sync_fetch_and_add(&io_bench_syscalls[IO_BENCH_EPOLL_CTL], 1);
+	return syscall(SYS_epoll_ctl, epfd, op, fd, ev);
+}
+
+struct io_bench {
+	int			clients;
+	int			threads;
+	long			requests;
+	uint64_t		size;
+
+	int			io_threads;
+	int			net_threads;
+
+	char			*data;
+
+	char			port[DNET_MAX_PORTLEN];
+	char			history[1024];
+
+	struct dnet_log		log;
+};
+
+struct io_bench_thread {
+	struct io_bench		*b;
+	struct dnet_node	*n;
+	pthread_t		tid;
+	int			key;
+	double			usecs;
+	int			err;
+};
+
+static double io_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void io_bench_log(void *priv __attribute__((unused)), int level __attribute__((unused)), const char *msg)
+{
+	fprintf(stderr, "%s", msg);
+}
+
+/*
+ * Every read returns the same in-memory object, writes are only acknowledged
+ */
+static int io_bench_command_handler(void *state, void *priv, struct dnet_cmd *cmd, void *data)
+{
+	struct io_bench *b = priv;
+	struct dnet_io_attr *io = data;
+
+	switch (cmd->cmd) {
+		case DNET_CMD_READ:
+			dnet_convert_io_attr(io);
+			io->size = b->size;
+			io->offset = 0;
+			return dnet_send_read_data(state, cmd, io, b->data, -1, 0, 0);
+		case DNET_CMD_WRITE:
+			return 0;
+		default:
+			return -ENOTSUP;
+	}
+}
+
+static void io_bench_config(struct io_bench *b, struct dnet_config *cfg)
+{
+	memset(cfg, 0, sizeof(struct dnet_config));
+
+	cfg->sock_type = SOCK_STREAM;
+	cfg->proto = IPPROTO_TCP;
+	cfg->family = AF_INET;
+	snprintf(cfg->addr, sizeof(cfg->addr), "127.0.0.1");
+	cfg->wait_timeout = 60;
+	cfg->check_timeout = 60;
+	cfg->log = &b->log;
+	cfg->io_thread_num = b->io_threads;
+	cfg->nonblocking_io_thread_num = b->io_threads;
+	cfg->net_thread_num = b->net_threads;
+	cfg->flags = DNET_CFG_NO_CSUM | DNET_CFG_NO_META | DNET_CFG_NO_ROUTE_LIST;
+}
+
+static void *io_bench_process(void *data)
+{
+	struct io_bench_thread *t = data;
+	struct io_bench *b = t->b;
+	struct dnet_session *s;
+	struct dnet_io_attr io;
+	struct dnet_id id;
+	int group = 1, err = 0;
+	double start;
+	void *ret;
+	long i;
+
+	s = dnet_session_create(t->n);
+	if (!s) {
+		t->err = -ENOMEM;
+		return NULL;
+	}
+	dnet_session_set_groups(s, &group, 1);
+
+	dnet_transform(t->n, &t->key, sizeof(t->key), &id);
+	id.group_id = group;
+
+	start = io_bench_now();
+	for (i = 0; i < b->requests; ++i) {
+		memset(&io, 0, sizeof(struct dnet_io_attr));
+		memcpy(io.id, id.id, DNET_ID_SIZE);
+		memcpy(io.parent, id.id, DNET_ID_SIZE);
+
+		ret = dnet_read_data_wait(s, &id, &io, 0, &err);
+		if (!ret)
+			break;
+		free(ret);
+	}
+	t->usecs = io_bench_now() - start;
+	t->err = err;
+
+	dnet_session_destroy(s);
+	return NULL;
+}
+
+static int io_bench_run(struct io_bench *b, int mode)
+{
+	struct dnet_backend_callbacks cb;
+	struct dnet_config cfg;
+	struct dnet_node *srv, **clients;
+	struct io_bench_thread *threads;
+	int nt = b->clients * b->threads;
+	int i, err = 0;
+	long syscalls[__IO_BENCH_SYSCALL_MAX];
+	struct dnet_stat_count slab[2][__DNET_CNTR_MAX];
+	double start, total, lat = 0, hit, miss, oversize;
+
+	clients = calloc(b->clients, sizeof(struct dnet_node *));
+	threads = calloc(nt, sizeof(struct io_bench_thread));
+	if (!clients || !threads) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	memset(&cb, 0, sizeof(struct dnet_backend_callbacks));
+	cb.command_handler = io_bench_command_handler;
+	cb.command_private = b;
+
+	io_bench_config(b, &cfg);
+	cfg.flags |= DNET_CFG_JOIN_NETWORK;
+	cfg.group_id = 1;
+	cfg.io_pool_mode = mode;
+	cfg.cb = &cb;
+	snprintf(cfg.port, sizeof(cfg.port), "%s", b->port);
+	snprintf(cfg.history_env, sizeof(cfg.history_env), "%s", b->history);
+
+	srv = dnet_server_node_create(&cfg);
+	if (!srv) {
+		err = -EINVAL;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < b->clients; ++i) {
+		io_bench_config(b, &cfg);
+		snprintf(cfg.port, sizeof(cfg.port), "0");
+
+		clients[i] = dnet_node_create(&cfg);
+		if (!clients[i]) {
+			err = -EINVAL;
+			goto err_out_destroy;
+		}
+
+		snprintf(cfg.port, sizeof(cfg.port), "%s", b->port);
+		err = dnet_add_state(clients[i], &cfg);
+		if (err)
+			goto err_out_destroy;
+	}
+
+	for (i = 0; i < __IO_BENCH_SYSCALL_MAX; ++i)
+		syscalls[i] = io_bench_syscalls[i];
+
+	memset(slab, 0, sizeof(slab));
+	dnet_io_slab_stat(srv, slab[0]);
+
+	start = io_bench_now();
+	for (i = 0; i < nt; ++i) {
+		threads[i].b = b;
+		threads[i].n = clients[i % b->clients];
+		threads[i].key = i;
+
+		err = pthread_create(&threads[i].tid, NULL, io_bench_process, &threads[i]);
+		if (err) {
+			err = -err;
+			nt = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < nt; ++i) {
+		pthread_join(threads[i].tid, NULL);
+		if (threads[i].err && !err)
+			err = threads[i].err;
+		lat += threads[i].usecs;
+	}
+	total = io_bench_now() - start;
+
+	dnet_io_slab_stat(srv, slab[1]);
+
+	if (!err) {
+		printf("%-14s  %3d connections  %3d threads  %8.0f req/s  %7.1f usecs/req\n",
+				mode == DNET_IO_POOL_WORK_STEALING ? "work-stealing" : "shared queue",
+				b->clients, nt, nt * b->requests * 1000000.0 / total, lat / (nt * b->requests));
+
+		printf("%14s  syscalls/req:", "");
+		for (i = 0; i < __IO_BENCH_SYSCALL_MAX; ++i)
+			printf("  %s %.2f", io_bench_syscall_names[i],
+					(double)(io_bench_syscalls[i] - syscalls[i]) / (nt * b->requests));
+		printf("\n");
+
+		hit = slab[1][DNET_CNTR_RECV_SLAB_HIT].count - slab[0][DNET_CNTR_RECV_SLAB_HIT].count;
+		miss = slab[1][DNET_CNTR_RECV_SLAB_MISS].count - slab[0][DNET_CNTR_RECV_SLAB_MISS].count;
+		oversize = slab[1][DNET_CNTR_RECV_SLAB_MISS].err - slab[0][DNET_CNTR_RECV_SLAB_MISS].err;
+
+		printf("%14s  recv slab: hit rate %.2f%%  hits/req %.2f  misses/req %.4f  oversize/req %.4f  "
+				"resident %llu KB, idle %llu KB\n", "",
+				hit + miss + oversize ? hit * 100.0 / (hit + miss + oversize) : 0.0,
+				hit / (nt * b->requests), miss / (nt * b->requests), oversize / (nt * b->requests),
+				(unsigned long long)slab[1][DNET_CNTR_RECV_SLAB_RESIDENT].count / 1024,
+				(unsigned long long)slab[1][DNET_CNTR_RECV_SLAB_RESIDENT].err / 1024);
+	}
+
+err_out_destroy:
+	for (i = 0; i < b->clients; ++i) {
+		if (clients[i])
+			dnet_node_destroy(clients[i]);
+	}
+	dnet_server_node_destroy(srv);
+err_out_free:
+	free(threads);
+	free(clients);
+	return err;
+}
+
+static void io_bench_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -c clients             - number of client connections (default: 4)\n"
+			"  -t threads             - number of reading threads per connection (default: 4)\n"
+			"  -n requests            - number of reads per thread (default: 20000)\n"
+			"  -s size                - object size (default: 100)\n"
+			"  -i threads             - number of server IO threads in every pool (default: 4)\n"
+			"  -N threads             - number of network threads (default: 2)\n"
+			"  -m mode                - IO pool mode to run, can be specified multiple times\n"
+			"                           (default: 0 and 1, see io_pool_mode in ioserv.conf)\n"
+			"  -p port                - server port (default: 1025)\n"
+			"  -l level               - log level (default: data, i.e. errors are not shown)\n"
+			"  -h                     - this help\n"
+			, p);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	int modes[8] = {DNET_IO_POOL_SHARED, DNET_IO_POOL_WORK_STEALING};
+	int ch, i, num = 2, user_num = 0, err = 0;
+	struct io_bench b;
+
+	memset(&b, 0, sizeof(struct io_bench));
+	b.clients = 4;
+	b.threads = 4;
+	b.requests = 20000;
+	b.size = 100;
+	b.io_threads = 4;
+	b.net_threads = 2;
+	b.log.log_level = DNET_LOG_DATA;
+	b.log.log = io_bench_log;
+	snprintf(b.port, sizeof(b.port), "1025");
+
+	while ((ch = getopt(argc, argv, "c:t:n:s:i:N:m:p:l:h")) != -1) {
+		switch (ch) {
+			case 'c':
+				b.clients = atoi(optarg);
+				break;
+			case 't':
+				b.threads = atoi(optarg);
+				break;
+			case 'n':
+				b.requests = atol(optarg);
+				break;
+			case 's':
+				b.size = strtoull(optarg, NULL, 0);
+				break;
+			case 'i':
+				b.io_threads = atoi(optarg);
+				break;
+			case 'N':
+				b.net_threads = atoi(optarg);
+				break;
+			case 'm':
+				if (user_num == sizeof(modes) / sizeof(modes[0]))
+					io_bench_usage(argv[0]);
+				modes[user_num++] = atoi(optarg);
+				num = user_num;
+				break;
+			case 'p':
+				snprintf(b.port, sizeof(b.port), "%s", optarg);
+				break;
+			case 'l':
+				b.log.log_level = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				io_bench_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (b.clients <= 0 || b.threads <= 0 || b.requests <= 0 || b.io_threads <= 0 || b.net_threads <= 0)
+		io_bench_usage(argv[0]);
+
+	b.data = malloc(b.size + 1);
+	if (!b.data) {
+		fprintf(stderr, "Failed to allocate %llu bytes object\n", (unsigned long long)b.size);
+		return -ENOMEM;
+	}
+	memset(b.data, 0x5a, b.size + 1);
+
+	snprintf(b.history, sizeof(b.history), "/tmp/dnet-io-bench-XXXXXX");
+	if (!mkdtemp(b.history)) {
+		err = -errno;
+		fprintf(stderr, "Failed to create history directory: %s [%d]\n", strerror(-err), err);
+		goto err_out_free;
+	}
+
+	for (i = 0; i < num; ++i) {
+		err = io_bench_run(&b, modes[i]);
+		if (err) {
+			fprintf(stderr, "IO pool mode %d: benchmark failed: %s [%d]\n", modes[i], strerror(-err), err);
+			break;
+		}
+	}
+
+	rmdir(b.history);
+err_out_free:
+	free(b.data);
+	return err;
+}
@@ -89,6 +89,12 @@ static void ioserv_reload_handler(int sig __unused, siginfo_t *si __unused, void
 	dnet_set_log(NULL, NULL, dnet_logger_value);
 }
 
+static volatile int ioserv_trace_dump;
+static void ioserv_trace_handler(int sig __unused, siginfo_t *si __unused, void *uc __unused)
+{
+	ioserv_trace_dump = 1;
+}
+
 static void ioserv_sigchild_handler(int sig __unused, siginfo_t *si __unused, void *uc __unused)
 {
 	int status, pid;
@@ -114,6 +120,11 @@ static int ioserv_setup_signals(void)
 	sigemptyset(&sa.sa_mask);
 	sigaction(SIGHUP, &sa, NULL);
 
+	sa.sa_flags = SA_SIGINFO;
+	sa.sa_sigaction = ioserv_trace_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+
 	sa.sa_flags = SA_SIGINFO;
 	sa.sa_sigaction = ioserv_sigchild_handler;
 	sigemptyset(&sa.sa_mask);
@@ -124,6 +135,7 @@ static int ioserv_setup_signals(void)
 	sigaddset(&sa.sa_mask, SIGINT);
 	sigaddset(&sa.sa_mask, SIGHUP);
 	sigaddset(&sa.sa_mask, SIGCHLD);
+	sigaddset(&sa.sa_mask, SIGUSR1);
 	pthread_sigmask(SIG_UNBLOCK, &sa.sa_mask, NULL);
 	sigprocmask(SIG_UNBLOCK, &sa.sa_mask, NULL);
 
@@ -141,9 +153,15 @@ static int ioserv_start(char *conf, int mon)
 	global_n = n;
 	ioserv_setup_signals();
 
-	while (!dnet_need_exit(n))
+	while (!dnet_need_exit(n)) {
 		sleep(1);
 
+		if (ioserv_trace_dump) {
+			ioserv_trace_dump = 0;
+			dnet_trace_dump(n, NULL);
+		}
+	}
+
 	dnet_server_node_destroy(n);
 	return 0;
 }
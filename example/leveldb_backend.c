@@ -168,12 +168,10 @@ static int leveldb_backend_read(struct leveldb_backend *s, void *state, struct d
 		goto err_out_exit;
 
 	io->size = data_size;
-	err = dnet_send_read_data(state, cmd, io, data, -1, io->offset, 0);
-	if (err)
-		goto err_out_free;
 
-err_out_free:
-	free(data);
+	/* leveldb allocated buffer is freed by the send queue */
+	err = dnet_send_read_data_nocopy(state, cmd, io, data, free, data);
+
 err_out_exit:
 	if (err < 0)
 		dnet_backend_log(DNET_LOG_ERROR, "%s: LEVELDB: READ: error: %s\n",
@@ -0,0 +1,475 @@
+/*
+ * 2012+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Route ring microbenchmark.
+ *
+ * Compares route ring snapshot lookup (Eytzinger array of id prefixes) against binary search
+ * over group ids it replaced. Ids belong to nodes of 1000 ids each, like in real rings,
+ * and the old search dereferences owning idc to get the state, just like lookups did.
+ *
+ * Route churn is measured by removing every node from a ring and joining it back. Merge-insert
+ * of pre-sorted ids and ring snapshot rebuild are compared against realloc, bsearch and qsort
+ * of the whole group they replaced. Times are those spent under state_lock, sorting of joining
+ * node's ids is done before the lock and is reported separately.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+/* route rings are not exported through public headers */
+#include "../library/elliptics.h"
+
+#define ROUTE_BENCH_NODE_IDS		1000
+
+struct route_bench {
+	int			num;
+	long			lookups;
+
+	struct dnet_group	group;
+	struct dnet_idc		**idcs;
+	int			idc_num;
+
+	struct dnet_route_ring	*ring;
+
+	struct dnet_id		*keys;
+};
+
+static double route_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+static void route_bench_random_id(unsigned char *id)
+{
+	int i;
+
+	for (i = 0; i < DNET_ID_SIZE; ++i)
+		id[i] = rand();
+}
+
+static int route_bench_compare(const void *k1, const void *k2)
+{
+	const struct dnet_state_id *id1 = k1;
+	const struct dnet_state_id *id2 = k2;
+
+	return dnet_id_cmp_str(id1->raw.id, id2->raw.id);
+}
+
+/*
+ * Binary search over group ids, the way route lookups were done before ring snapshots
+ */
+static int route_bench_old_pos(struct dnet_group *g, struct dnet_id *id)
+{
+	int low, high, i, cmp;
+	struct dnet_state_id *sid;
+
+	for (low = -1, high = g->id_num; high-low > 1; ) {
+		i = low + (high - low)/2;
+		sid = &g->ids[i];
+
+		cmp = dnet_id_cmp_str(sid->raw.id, id->id);
+		if (cmp < 0)
+			low = i;
+		else if (cmp > 0)
+			high = i;
+		else
+			goto out;
+	}
+	i = high - 1;
+
+out:
+	if (i == -1)
+		i = g->id_num - 1;
+
+	return i;
+}
+
+static int route_bench_init(struct route_bench *b, int num, long lookups)
+{
+	struct dnet_state_id *sid;
+	long i;
+
+	memset(b, 0, sizeof(struct route_bench));
+
+	b->num = num;
+	b->lookups = lookups;
+	b->idc_num = (num + ROUTE_BENCH_NODE_IDS - 1) / ROUTE_BENCH_NODE_IDS;
+
+	b->group.group_id = 1;
+	b->group.id_num = num;
+	b->group.ids = malloc(num * sizeof(struct dnet_state_id));
+	b->idcs = calloc(b->idc_num, sizeof(struct dnet_idc *));
+	b->keys = malloc(lookups * sizeof(struct dnet_id));
+	if (!b->group.ids || !b->idcs || !b->keys)
+		return -ENOMEM;
+
+	for (i = 0; i < b->idc_num; ++i) {
+		b->idcs[i] = calloc(1, sizeof(struct dnet_idc));
+		if (!b->idcs[i])
+			return -ENOMEM;
+
+		/* state is never dereferenced, idc itself is a unique non-NULL pointer */
+		b->idcs[i]->st = (struct dnet_net_state *)b->idcs[i];
+		b->idcs[i]->group = &b->group;
+	}
+
+	for (i = 0; i < num; ++i) {
+		sid = &b->group.ids[i];
+
+		route_bench_random_id(sid->raw.id);
+		sid->idc = b->idcs[i / ROUTE_BENCH_NODE_IDS];
+	}
+	qsort(b->group.ids, num, sizeof(struct dnet_state_id), route_bench_compare);
+
+	for (i = 0; i < lookups; ++i) {
+		/* every 16th key is an existing id, so that exact matches are covered too */
+		if (i % 16)
+			route_bench_random_id(b->keys[i].id);
+		else
+			memcpy(b->keys[i].id, b->group.ids[rand() % num].raw.id, DNET_ID_SIZE);
+		b->keys[i].group_id = 1;
+	}
+
+	b->ring = dnet_route_ring_create(&b->group);
+	if (!b->ring)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void route_bench_cleanup(struct route_bench *b)
+{
+	int i;
+
+	if (b->idcs) {
+		for (i = 0; i < b->idc_num; ++i)
+			free(b->idcs[i]);
+	}
+
+	free(b->ring);
+	free(b->keys);
+	free(b->idcs);
+	free(b->group.ids);
+}
+
+static int route_bench_run(struct route_bench *b)
+{
+	struct dnet_net_state *st;
+	double start, ring_ns, old_ns;
+	unsigned long sum[2] = {0, 0};
+	long i;
+	int pos;
+
+	for (i = 0; i < b->lookups; ++i) {
+		pos = dnet_route_ring_pos(b->ring, &b->keys[i]);
+		if (pos != route_bench_old_pos(&b->group, &b->keys[i]))
+			return -EINVAL;
+	}
+
+	start = route_bench_now();
+	for (i = 0; i < b->lookups; ++i) {
+		st = b->ring->ids[dnet_route_ring_pos(b->ring, &b->keys[i])].st;
+		sum[0] += (unsigned long)st;
+	}
+	ring_ns = route_bench_now() - start;
+
+	start = route_bench_now();
+	for (i = 0; i < b->lookups; ++i) {
+		st = b->group.ids[route_bench_old_pos(&b->group, &b->keys[i])].idc->st;
+		sum[1] += (unsigned long)st;
+	}
+	old_ns = route_bench_now() - start;
+
+	if (sum[0] != sum[1])
+		return -EINVAL;
+
+	printf("%8d ids  lookup  ring %7.1f ns/op  binary search %7.1f ns/op  speedup %5.2fx\n",
+			b->num, ring_ns / b->lookups, old_ns / b->lookups, old_ns / ring_ns);
+	return 0;
+}
+
+/*
+ * Join and removal the way they were done before merge-insert
+ */
+static int route_bench_old_join(struct dnet_group *g, struct dnet_idc *idc)
+{
+	int i, num = 0;
+
+	g->ids = realloc(g->ids, (g->id_num + idc->id_num) * sizeof(struct dnet_state_id));
+	if (!g->ids)
+		return -ENOMEM;
+
+	for (i = 0; i < idc->id_num; ++i) {
+		if (!bsearch(&idc->ids[i], g->ids, g->id_num, sizeof(struct dnet_state_id), route_bench_compare)) {
+			memcpy(&g->ids[g->id_num + num], &idc->ids[i], sizeof(struct dnet_state_id));
+			num++;
+		}
+	}
+
+	g->id_num += num;
+	qsort(g->ids, g->id_num, sizeof(struct dnet_state_id), route_bench_compare);
+	return 0;
+}
+
+static void route_bench_remove(struct dnet_group *g, struct dnet_idc *idc, int sort)
+{
+	int i, pos;
+
+	for (i = 0, pos = 0; i < g->id_num; ++i) {
+		if (g->ids[i].idc != idc) {
+			g->ids[pos] = g->ids[i];
+			pos++;
+		}
+	}
+
+	g->id_num = pos;
+
+	if (sort)
+		qsort(g->ids, g->id_num, sizeof(struct dnet_state_id), route_bench_compare);
+}
+
+static int route_bench_publish(struct dnet_group *g, struct dnet_route_ring **ring)
+{
+	free(*ring);
+
+	*ring = dnet_route_ring_create(g);
+	if (!*ring)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static struct dnet_idc *route_bench_idc_create(struct dnet_group *g)
+{
+	struct dnet_idc *idc;
+	int i;
+
+	idc = malloc(sizeof(struct dnet_idc) + ROUTE_BENCH_NODE_IDS * sizeof(struct dnet_state_id));
+	if (!idc)
+		return NULL;
+
+	idc->st = (struct dnet_net_state *)idc;
+	idc->group = g;
+	idc->id_num = ROUTE_BENCH_NODE_IDS;
+
+	for (i = 0; i < idc->id_num; ++i) {
+		route_bench_random_id(idc->ids[i].raw.id);
+		idc->ids[i].idc = idc;
+	}
+
+	return idc;
+}
+
+/*
+ * Every node leaves the ring of @nodes nodes and joins it back, both ways of updating the ring
+ * must end up with the same ids.
+ */
+static int route_bench_churn(int nodes)
+{
+	struct dnet_group old, cur;
+	struct dnet_route_ring *ring = NULL;
+	struct dnet_idc **idcs;
+	double start, sort_ns = 0, join_ns[2] = {0, 0}, remove_ns[2] = {0, 0}, join_max[2] = {0, 0}, t;
+	int i, err = 0;
+
+	memset(&old, 0, sizeof(struct dnet_group));
+	memset(&cur, 0, sizeof(struct dnet_group));
+
+	idcs = calloc(nodes, sizeof(struct dnet_idc *));
+	if (!idcs)
+		return -ENOMEM;
+
+	for (i = 0; i < nodes; ++i) {
+		idcs[i] = route_bench_idc_create(&cur);
+		if (!idcs[i]) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+
+		err = route_bench_old_join(&old, idcs[i]);
+		if (err)
+			goto err_out_free;
+
+		qsort(idcs[i]->ids, idcs[i]->id_num, sizeof(struct dnet_state_id), route_bench_compare);
+		err = dnet_idc_merge_ids(&cur, idcs[i]->ids, idcs[i]->id_num);
+		if (err < 0)
+			goto err_out_free;
+	}
+
+	err = route_bench_publish(&cur, &ring);
+	if (err)
+		goto err_out_free;
+
+	for (i = 0; i < nodes; ++i) {
+		start = route_bench_now();
+		route_bench_remove(&old, idcs[i], 1);
+		remove_ns[1] += route_bench_now() - start;
+
+		start = route_bench_now();
+		err = route_bench_old_join(&old, idcs[i]);
+		t = route_bench_now() - start;
+		if (err)
+			goto err_out_free;
+		join_ns[1] += t;
+		if (t > join_max[1])
+			join_max[1] = t;
+
+		start = route_bench_now();
+		route_bench_remove(&cur, idcs[i], 0);
+		err = route_bench_publish(&cur, &ring);
+		remove_ns[0] += route_bench_now() - start;
+		if (err)
+			goto err_out_free;
+
+		/* ids are sorted again although they are sorted already, like every joining node does */
+		start = route_bench_now();
+		qsort(idcs[i]->ids, idcs[i]->id_num, sizeof(struct dnet_state_id), route_bench_compare);
+		sort_ns += route_bench_now() - start;
+
+		start = route_bench_now();
+		err = dnet_idc_merge_ids(&cur, idcs[i]->ids, idcs[i]->id_num);
+		if (err >= 0)
+			err = route_bench_publish(&cur, &ring);
+		t = route_bench_now() - start;
+		if (err)
+			goto err_out_free;
+		join_ns[0] += t;
+		if (t > join_max[0])
+			join_max[0] = t;
+	}
+
+	if (old.id_num != cur.id_num) {
+		err = -EINVAL;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < cur.id_num; ++i) {
+		if (dnet_id_cmp_str(old.ids[i].raw.id, cur.ids[i].raw.id) || old.ids[i].idc != cur.ids[i].idc) {
+			err = -EINVAL;
+			goto err_out_free;
+		}
+	}
+
+	printf("%4d nodes x %d ids  join    merge %8.1f us (max %8.1f)  qsort %8.1f us (max %8.1f)  "
+			"speedup %5.2fx, sorting before lock %.1f us\n",
+			nodes, ROUTE_BENCH_NODE_IDS,
+			join_ns[0] / nodes / 1000, join_max[0] / 1000, join_ns[1] / nodes / 1000, join_max[1] / 1000,
+			join_ns[1] / join_ns[0], sort_ns / nodes / 1000);
+	printf("%4d nodes x %d ids  remove  linear %7.1f us               qsort %8.1f us               speedup %5.2fx\n",
+			nodes, ROUTE_BENCH_NODE_IDS,
+			remove_ns[0] / nodes / 1000, remove_ns[1] / nodes / 1000, remove_ns[1] / remove_ns[0]);
+
+err_out_free:
+	for (i = 0; i < nodes; ++i)
+		free(idcs[i]);
+	free(idcs);
+	free(ring);
+	free(old.ids);
+	free(cur.ids);
+	return err;
+}
+
+static void route_bench_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -n num                 - number of ids in the ring, can be specified multiple times\n"
+			"                           (default: 1000, 10000, 100000 and 1000000)\n"
+			"  -l lookups             - number of random lookups (default: 2000000)\n"
+			"  -j nodes               - number of 1000 ids nodes in route churn test, can be specified\n"
+			"                           multiple times (default: 10 and 100)\n"
+			"  -h                     - this help\n"
+			, p);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	int nums[16] = {1000, 10000, 100000, 1000000};
+	int nodes[16] = {10, 100};
+	int ch, i, num = 4, user_num = 0, node_num = 2, user_node_num = 0, err = 0;
+	long lookups = 2000000;
+	struct route_bench b;
+
+	while ((ch = getopt(argc, argv, "n:l:j:h")) != -1) {
+		switch (ch) {
+			case 'n':
+				if (user_num == sizeof(nums) / sizeof(nums[0]))
+					route_bench_usage(argv[0]);
+				nums[user_num++] = atoi(optarg);
+				num = user_num;
+				break;
+			case 'l':
+				lookups = atol(optarg);
+				break;
+			case 'j':
+				if (user_node_num == sizeof(nodes) / sizeof(nodes[0]))
+					route_bench_usage(argv[0]);
+				nodes[user_node_num++] = atoi(optarg);
+				node_num = user_node_num;
+				break;
+			case 'h':
+			default:
+				route_bench_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (lookups <= 0)
+		route_bench_usage(argv[0]);
+
+	srand(0);
+
+	for (i = 0; i < num; ++i) {
+		if (nums[i] <= 0)
+			route_bench_usage(argv[0]);
+
+		err = route_bench_init(&b, nums[i], lookups);
+		if (!err)
+			err = route_bench_run(&b);
+		route_bench_cleanup(&b);
+
+		if (err) {
+			fprintf(stderr, "%d ids: benchmark failed: %s [%d]\n", nums[i], strerror(-err), err);
+			return err;
+		}
+	}
+
+	for (i = 0; i < node_num; ++i) {
+		if (nodes[i] <= 0)
+			route_bench_usage(argv[0]);
+
+		err = route_bench_churn(nodes[i]);
+		if (err) {
+			fprintf(stderr, "%d nodes: route churn benchmark failed: %s [%d]\n", nodes[i], strerror(-err), err);
+			break;
+		}
+	}
+
+	return err;
+}
@@ -0,0 +1,279 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Receive slab microbenchmark.
+ *
+ * Allocates receive buffers of given sizes in batches and frees them either in the same thread
+ * or in another one, the way network thread allocates and IO thread frees receive buffers.
+ * Slab allocation is compared against malloc/free it replaced, slab hit rate is reported too.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+/* receive slabs are not exported through public headers */
+#include "../library/elliptics.h"
+
+#define SLAB_BENCH_BATCH		64
+
+struct slab_bench {
+	uint64_t		size;
+	long			ops;
+	int			remote;
+	int			use_slab;
+
+	struct dnet_io_slab	*slab;
+
+	/* batch handed over to freeing thread, NULL when it was freed */
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	struct dnet_io_req	**batch;
+	int			batch_num;
+	int			stop;
+};
+
+static double slab_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+static struct dnet_io_req *slab_bench_alloc(struct slab_bench *b)
+{
+	struct dnet_io_req *r;
+
+	if (b->use_slab)
+		return dnet_io_slab_alloc(b->slab, b->size);
+
+	/* receive path before slabs */
+	r = malloc(b->size);
+	if (r)
+		memset(r, 0, sizeof(struct dnet_io_req));
+	return r;
+}
+
+static void slab_bench_free_batch(struct slab_bench *b, struct dnet_io_req **batch, int num)
+{
+	int i;
+
+	for (i = 0; i < num; ++i) {
+		if (b->use_slab)
+			dnet_io_slab_free(batch[i]);
+		else
+			free(batch[i]);
+	}
+}
+
+static void *slab_bench_free_process(void *data)
+{
+	struct slab_bench *b = data;
+
+	pthread_mutex_lock(&b->lock);
+	while (1) {
+		while (!b->batch && !b->stop)
+			pthread_cond_wait(&b->wait, &b->lock);
+
+		if (!b->batch)
+			break;
+
+		slab_bench_free_batch(b, b->batch, b->batch_num);
+		b->batch = NULL;
+		pthread_cond_broadcast(&b->wait);
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	return NULL;
+}
+
+/*
+ * Two batches are used, so that buffers are allocated while the previous batch is being freed
+ */
+static int slab_bench_run(struct slab_bench *b)
+{
+	struct dnet_io_req *batch[2][SLAB_BENCH_BATCH];
+	pthread_t tid;
+	long done;
+	int i, cur = 0, err = 0;
+
+	if (b->remote) {
+		err = pthread_create(&tid, NULL, slab_bench_free_process, b);
+		if (err)
+			return -err;
+	}
+
+	for (done = 0; done < b->ops; done += SLAB_BENCH_BATCH) {
+		for (i = 0; i < SLAB_BENCH_BATCH; ++i) {
+			batch[cur][i] = slab_bench_alloc(b);
+			if (!batch[cur][i]) {
+				err = -ENOMEM;
+				break;
+			}
+		}
+
+		if (!b->remote) {
+			slab_bench_free_batch(b, batch[cur], i);
+		} else {
+			pthread_mutex_lock(&b->lock);
+			while (b->batch)
+				pthread_cond_wait(&b->wait, &b->lock);
+
+			b->batch = batch[cur];
+			b->batch_num = i;
+			pthread_cond_broadcast(&b->wait);
+			pthread_mutex_unlock(&b->lock);
+
+			cur ^= 1;
+		}
+
+		if (err)
+			break;
+	}
+
+	if (b->remote) {
+		pthread_mutex_lock(&b->lock);
+		b->stop = 1;
+		pthread_cond_broadcast(&b->wait);
+		pthread_mutex_unlock(&b->lock);
+
+		pthread_join(tid, NULL);
+		b->stop = 0;
+	}
+
+	return err;
+}
+
+static int slab_bench_size(uint64_t size, long ops)
+{
+	struct slab_bench b;
+	double start, ns[2][2];
+	uint64_t hit = 0, miss = 0, oversize = 0;
+	int remote, use_slab, err = 0;
+
+	memset(&b, 0, sizeof(struct slab_bench));
+	b.size = size;
+	b.ops = ops;
+
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_cond_init(&b.wait, NULL);
+
+	for (remote = 0; remote < 2; ++remote) {
+		for (use_slab = 0; use_slab < 2; ++use_slab) {
+			b.remote = remote;
+			b.use_slab = use_slab;
+
+			if (use_slab) {
+				b.slab = dnet_io_slab_create();
+				if (!b.slab) {
+					err = -ENOMEM;
+					goto err_out_destroy;
+				}
+			}
+
+			start = slab_bench_now();
+			err = slab_bench_run(&b);
+			ns[remote][use_slab] = slab_bench_now() - start;
+
+			if (use_slab) {
+				hit += b.slab->hit;
+				miss += b.slab->miss;
+				oversize += b.slab->oversize;
+
+				dnet_io_slab_destroy(b.slab);
+				b.slab = NULL;
+			}
+
+			if (err)
+				goto err_out_destroy;
+		}
+	}
+
+	printf("%8llu bytes  same thread  slab %6.1f ns/op  malloc %6.1f ns/op  "
+			"other thread  slab %6.1f ns/op  malloc %6.1f ns/op  slab hit rate %6.2f%%\n",
+			(unsigned long long)size,
+			ns[0][1] / ops, ns[0][0] / ops, ns[1][1] / ops, ns[1][0] / ops,
+			hit * 100.0 / (hit + miss + oversize));
+
+err_out_destroy:
+	pthread_cond_destroy(&b.wait);
+	pthread_mutex_destroy(&b.lock);
+	return err;
+}
+
+static void slab_bench_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -s size                - buffer size, can be specified multiple times\n"
+			"                           (default: 256, 1024, 4096, 32768 and 131072)\n"
+			"  -n ops                 - number of allocations per test (default: 4000000)\n"
+			"  -h                     - this help\n"
+			, p);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t sizes[16] = {256, 1024, 4096, 32768, 131072};
+	long ops = 4000000;
+	int ch, i, num = 5, user_num = 0, err = 0;
+
+	while ((ch = getopt(argc, argv, "s:n:h")) != -1) {
+		switch (ch) {
+			case 's':
+				if (user_num == sizeof(sizes) / sizeof(sizes[0]))
+					slab_bench_usage(argv[0]);
+				sizes[user_num++] = strtoull(optarg, NULL, 0);
+				num = user_num;
+				break;
+			case 'n':
+				ops = atol(optarg);
+				break;
+			case 'h':
+			default:
+				slab_bench_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	if (ops <= 0)
+		slab_bench_usage(argv[0]);
+
+	for (i = 0; i < num; ++i) {
+		if (sizes[i] < sizeof(struct dnet_io_req))
+			slab_bench_usage(argv[0]);
+
+		err = slab_bench_size(sizes[i], ops);
+		if (err) {
+			fprintf(stderr, "%llu bytes: benchmark failed: %s [%d]\n",
+					(unsigned long long)sizes[i], strerror(-err), err);
+			break;
+		}
+	}
+
+	return err;
+}
@@ -0,0 +1,322 @@
+/*
+ * 2012+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Transaction table microbenchmark.
+ *
+ * Compares per-state open-addressing transaction table against rb-tree it replaced.
+ * Every operation is done under mutex just like reply processing takes trans_lock,
+ * so numbers are lock hold times plus lock/unlock cost.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics/packet.h"
+#include "elliptics/interface.h"
+
+/* transaction table is not exported through public headers */
+#include "../library/elliptics.h"
+
+struct bench_rb_trans {
+	struct dnet_trans	t;
+	struct rb_node		entry;
+};
+
+static struct dnet_trans *bench_rb_search(struct rb_root *root, uint64_t trans)
+{
+	struct rb_node *n = root->rb_node;
+	struct bench_rb_trans *t;
+
+	while (n) {
+		t = rb_entry(n, struct bench_rb_trans, entry);
+
+		if (t->t.trans > trans)
+			n = n->rb_left;
+		else if (t->t.trans < trans)
+			n = n->rb_right;
+		else
+			return dnet_trans_get(&t->t);
+	}
+
+	return NULL;
+}
+
+static int bench_rb_insert(struct rb_root *root, struct bench_rb_trans *a)
+{
+	struct rb_node **n = &root->rb_node, *parent = NULL;
+	struct bench_rb_trans *t;
+
+	while (*n) {
+		parent = *n;
+
+		t = rb_entry(parent, struct bench_rb_trans, entry);
+
+		if (t->t.trans > a->t.trans)
+			n = &parent->rb_left;
+		else if (t->t.trans < a->t.trans)
+			n = &parent->rb_right;
+		else
+			return -EEXIST;
+	}
+
+	rb_link_node(&a->entry, parent, n);
+	rb_insert_color(&a->entry, root);
+	return 0;
+}
+
+struct bench {
+	long			num;
+	uint64_t		base;
+	long			*order;
+
+	pthread_mutex_t		lock;
+
+	struct dnet_trans_table	table;
+	struct dnet_trans	*table_trans;
+
+	struct rb_root		root;
+	struct bench_rb_trans	*rb_trans;
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+static void bench_shuffle(long *order, long num)
+{
+	long i, j, tmp;
+
+	for (i = 0; i < num; ++i)
+		order[i] = i;
+
+	for (i = num - 1; i > 0; --i) {
+		j = ((long)rand() * RAND_MAX + rand()) % (i + 1);
+
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+static void bench_report(const char *name, long num, double table_ns, double rb_ns)
+{
+	printf("%8ld  %-8s  table %7.1f ns/op  rbtree %7.1f ns/op  speedup %5.2fx\n",
+			num, name, table_ns / num, rb_ns / num, rb_ns / table_ns);
+}
+
+/*
+ * Transactions are inserted with sequential ids, replies are looked up in random order,
+ * window step removes the oldest transaction and inserts the next one.
+ */
+static int bench_run(struct bench *b)
+{
+	struct dnet_trans *t;
+	double start, insert[2], search[2], window[2], removal[2];
+	long i, num = b->num;
+	int err;
+
+	for (i = 0; i < num; ++i) {
+		b->table_trans[i].trans = b->base + i;
+		atomic_set(&b->table_trans[i].refcnt, 1);
+
+		b->rb_trans[i].t.trans = b->base + i;
+		atomic_set(&b->rb_trans[i].t.refcnt, 1);
+	}
+
+	start = bench_now();
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_lock(&b->lock);
+		err = dnet_trans_insert_nolock(&b->table, &b->table_trans[i]);
+		pthread_mutex_unlock(&b->lock);
+		if (err)
+			return err;
+	}
+	insert[0] = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_lock(&b->lock);
+		err = bench_rb_insert(&b->root, &b->rb_trans[i]);
+		pthread_mutex_unlock(&b->lock);
+		if (err)
+			return err;
+	}
+	insert[1] = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_lock(&b->lock);
+		t = dnet_trans_search(&b->table, b->base + b->order[i]);
+		pthread_mutex_unlock(&b->lock);
+		if (!t)
+			return -ENOENT;
+		dnet_trans_put(t);
+	}
+	search[0] = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_lock(&b->lock);
+		t = bench_rb_search(&b->root, b->base + b->order[i]);
+		pthread_mutex_unlock(&b->lock);
+		if (!t)
+			return -ENOENT;
+		dnet_trans_put(t);
+	}
+	search[1] = bench_now() - start;
+
+	/* every transaction is completed and reused with id shifted by the whole window */
+	start = bench_now();
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_lock(&b->lock);
+		dnet_trans_remove_nolock(&b->table, &b->table_trans[i]);
+		b->table_trans[i].trans += num;
+		err = dnet_trans_insert_nolock(&b->table, &b->table_trans[i]);
+		pthread_mutex_unlock(&b->lock);
+		if (err)
+			return err;
+	}
+	window[0] = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_lock(&b->lock);
+		rb_erase(&b->rb_trans[i].entry, &b->root);
+		b->rb_trans[i].t.trans += num;
+		err = bench_rb_insert(&b->root, &b->rb_trans[i]);
+		pthread_mutex_unlock(&b->lock);
+		if (err)
+			return err;
+	}
+	window[1] = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_lock(&b->lock);
+		dnet_trans_remove_nolock(&b->table, &b->table_trans[b->order[i]]);
+		pthread_mutex_unlock(&b->lock);
+	}
+	removal[0] = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_lock(&b->lock);
+		rb_erase(&b->rb_trans[b->order[i]].entry, &b->root);
+		pthread_mutex_unlock(&b->lock);
+	}
+	removal[1] = bench_now() - start;
+
+	if (b->table.num || b->root.rb_node)
+		return -EINVAL;
+
+	bench_report("insert", num, insert[0], insert[1]);
+	bench_report("search", num, search[0], search[1]);
+	bench_report("window", num, window[0], window[1]);
+	bench_report("remove", num, removal[0], removal[1]);
+	return 0;
+}
+
+static int bench_init(struct bench *b, long num)
+{
+	memset(b, 0, sizeof(struct bench));
+
+	b->num = num;
+	b->base = ((uint64_t)rand() << 20) ^ rand();
+	b->root = RB_ROOT;
+	pthread_mutex_init(&b->lock, NULL);
+
+	b->order = malloc(num * sizeof(long));
+	b->table_trans = calloc(num, sizeof(struct dnet_trans));
+	b->rb_trans = calloc(num, sizeof(struct bench_rb_trans));
+	if (!b->order || !b->table_trans || !b->rb_trans)
+		return -ENOMEM;
+
+	bench_shuffle(b->order, num);
+	return 0;
+}
+
+static void bench_cleanup(struct bench *b)
+{
+	dnet_trans_table_destroy(&b->table);
+	pthread_mutex_destroy(&b->lock);
+
+	free(b->order);
+	free(b->table_trans);
+	free(b->rb_trans);
+}
+
+static void trans_bench_usage(char *p)
+{
+	fprintf(stderr, "Usage: %s <options>\n"
+			"  -n num                 - number of in-flight transactions, can be specified multiple times\n"
+			"                           (default: 10000, 100000 and 1000000)\n"
+			"  -h                     - this help\n"
+			, p);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	long nums[16] = {10000, 100000, 1000000};
+	int ch, i, num = 3, user_num = 0, err = 0;
+	struct bench b;
+
+	while ((ch = getopt(argc, argv, "n:h")) != -1) {
+		switch (ch) {
+			case 'n':
+				if (user_num == sizeof(nums) / sizeof(nums[0]))
+					trans_bench_usage(argv[0]);
+				nums[user_num++] = atol(optarg);
+				num = user_num;
+				break;
+			case 'h':
+			default:
+				trans_bench_usage(argv[0]);
+				/* not reached */
+		}
+	}
+
+	srand(0);
+
+	for (i = 0; i < num; ++i) {
+		if (nums[i] <= 0)
+			trans_bench_usage(argv[0]);
+
+		err = bench_init(&b, nums[i]);
+		if (!err)
+			err = bench_run(&b);
+		bench_cleanup(&b);
+
+		if (err) {
+			fprintf(stderr, "%ld transactions: benchmark failed: %s [%d]\n", nums[i], strerror(-err), err);
+			break;
+		}
+	}
+
+	return err;
+}
@@ -189,6 +189,27 @@ struct dnet_range_data *dnet_read_range(struct dnet_session *s, struct dnet_io_a
 int __attribute__((weak)) dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
 		void *data, int fd, uint64_t offset, int close_on_exit);
 
+/*
+ * Same as above, but @data is not copied - its ownership is passed to the send queue.
+ * @release(@priv) is invoked when data has been sent or sending has failed,
+ * so caller must not touch @data after this call.
+ */
+int __attribute__((weak)) dnet_send_read_data_nocopy(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		void *data, void (* release)(void *priv), void *priv);
+
+/*
+ * Returns number of microseconds left until deadline of the request processed by calling IO thread,
+ * zero if deadline has already passed, or -1 if request has no deadline.
+ * Backends may check it before starting long operations nobody will wait for.
+ */
+long long __attribute__((weak)) dnet_request_time_left(void);
+
+/*
+ * Writes recently completed request traces into @file (configured trace_file if NULL)
+ * in Chrome trace-event JSON format. Returns -ENOTSUP if tracing is not enabled.
+ */
+int __attribute__((weak)) dnet_trace_dump(struct dnet_node *n, const char *file);
+
 /*
  * Reads given file from the storage. If there are multiple transformation functions,
  * they will be tried one after another.
@@ -250,6 +271,41 @@ enum dnet_log_level {
 #define DNET_CFG_NO_CSUM		(1<<3)		/* globally disable checksum verification and update */
 #define DNET_CFG_NO_META		(1<<4)		/* do not write metadata */
 #define DNET_CFG_RANDOMIZE_STATES	(1<<5)		/* randomize states for read requests */
+#define DNET_CFG_REUSEPORT		(1<<6)		/* every network thread gets its own SO_REUSEPORT listener,
+							 * accepted clients are served by accepting thread */
+#define DNET_CFG_SEND_DEADLINES		(1<<7)		/* attach deadline to requests, so remote IO pools drop them
+							 * when they can not be served in time, all nodes must support it */
+#define DNET_CFG_ROUTE_EPOCH		(1<<8)		/* receive route table epochs in route list and lookup acknowledges and
+							 * download only route table changes when remote epoch moves,
+							 * older nodes ignore the request and return full route table */
+#define DNET_CFG_SLICED_REPLIES		(1<<9)		/* ask remote nodes to send large file bodies of replies in slices,
+							 * so that small replies are not queued behind them,
+							 * nodes forwarding requests must support it */
+
+/*
+ * Network engines
+ */
+#define DNET_NET_ENGINE_EPOLL		0		/* epoll readiness notifications */
+#define DNET_NET_ENGINE_IO_URING	1		/* io_uring multishot recv and linked send requests
+							 * (poll requests before linux 6.0), falls back to epoll
+							 * if kernel does not support it */
+
+/*
+ * IO pool scheduling modes
+ */
+#define DNET_IO_POOL_SHARED		0		/* all IO threads pull requests from single shared queue */
+#define DNET_IO_POOL_WORK_STEALING	1		/* requests are queued to the IO thread affine to connection,
+							 * idle threads steal requests from others */
+
+/*
+ * IO queue classes, configured weights and thread limits are listed in this order
+ */
+#define DNET_IO_CLASS_READ		0		/* point reads and lookups, replies */
+#define DNET_IO_CLASS_WRITE		1		/* writes and removals */
+#define DNET_IO_CLASS_RANGE		2		/* listing, range reads and removals, bulk reads, defragmentation */
+#define DNET_IO_CLASS_EXEC		3		/* server-side execution */
+#define DNET_IO_CLASS_ADMIN		4		/* route table, statistics, status, join, auth and notifications */
+#define DNET_IO_CLASS_MAX		5
 
 struct dnet_log {
 	/*
@@ -435,6 +491,61 @@ struct dnet_config
 
 	uint64_t		cache_size;
 
+	/* IO pool scheduling mode, DNET_IO_POOL_* */
+	int			io_pool_mode;
+
+	/* Network readiness engine used by network threads, DNET_NET_ENGINE_* */
+	int			net_engine;
+
+	/*
+	 * CPU lists like "0-7,16-23", which network, blocking IO, nonblocking IO and check threads
+	 * are pinned to. NULL or empty string means no pinning.
+	 */
+	char			*net_cpus;
+	char			*io_cpus;
+	char			*nonblocking_io_cpus;
+	char			*check_cpus;
+
+	/*
+	 * Comma separated per-class weights and busy thread limits in DNET_IO_CLASS_* order,
+	 * like "8,4,1,2,2" and "0,0,4,8,0", zero limit means no limit.
+	 * Requests are queued into single FIFO if both are NULL.
+	 */
+	char			*io_class_weights;
+	char			*io_class_limits;
+
+	/*
+	 * Admission control: maximum number of requests and megabytes queued in every IO pool,
+	 * new requests are rejected with -EBUSY when exceeded, empty pool accepts any request,
+	 * zero means no limit
+	 */
+	int			io_queue_max;
+	int			io_queue_max_mb;
+
+	/*
+	 * IO pools are grown up to given number of threads when all threads are busy
+	 * and queued requests are not dequeued for a while, extra threads retire
+	 * after being idle for @io_thread_idle_timeout seconds.
+	 * Zero (or value not larger than io_thread_num) disables autoscaling.
+	 */
+	int			io_thread_max;
+	int			nonblocking_io_thread_max;
+	int			io_thread_idle_timeout;
+
+	/*
+	 * Size of per-thread log ring in kilobytes. When set, log messages are queued
+	 * and passed to @log callback by the background writer thread, messages which
+	 * do not fit into the ring are dropped. Zero means synchronous logging.
+	 */
+	int			log_ring_kb;
+
+	/*
+	 * Every @trace_sample'th request is traced, its stage timings are dumped
+	 * into @trace_file by dnet_trace_dump(). Zero disables tracing.
+	 */
+	int			trace_sample;
+	char			*trace_file;
+
 	/* so that we do not change major version frequently */
 	int			reserved_for_future_use[12];
 };
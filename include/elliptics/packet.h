@@ -90,6 +90,29 @@ enum dnet_counters {
 	DNET_CNTR_DBW_SYSTEM,			/* Kyoto Cabinet DB write error KCESYSTEM */
 	DNET_CNTR_DBW_ERROR,			/* Kyoto Cabinet DB write error */
 	DNET_CNTR_UNKNOWN,			/* This slot is allocated for statistics gathered for unknown counters */
+	/*
+	 * Counters below were added after DNET_CNTR_UNKNOWN, so that it and all older counters
+	 * keep their numbers in stat replies. New counters go to the end.
+	 */
+	DNET_CNTR_RECV_SLAB_HIT,		/* Receive buffers taken from network thread cache */
+	DNET_CNTR_RECV_SLAB_MISS,		/* Receive buffers allocated (count) and oversized ones (err) */
+	DNET_CNTR_RECV_SLAB_RESIDENT,		/* Bytes allocated by receive slabs (count) and cached idle (err) */
+	DNET_CNTR_THREAD_PINNED,		/* Threads pinned to configured CPU sets (count) and failed to pin (err) */
+	DNET_CNTR_THREAD_CPU_MOVES,		/* Network and IO threads observed on other CPU than the last time */
+	DNET_CNTR_IO_QUEUE_READ,		/* Queued requests of given IO class (count) and average queue wait */
+	DNET_CNTR_IO_QUEUE_WRITE,		/* in usecs since previous statistics request (err) */
+	DNET_CNTR_IO_QUEUE_RANGE,
+	DNET_CNTR_IO_QUEUE_EXEC,
+	DNET_CNTR_IO_QUEUE_ADMIN,
+	DNET_CNTR_IO_REJECTED,			/* Requests rejected by admission control (count) and bytes queued in IO pools (err) */
+	DNET_CNTR_IO_EXPIRED,			/* Requests dropped from IO queues because their deadline has passed */
+	DNET_CNTR_IO_THREADS,			/* Number of threads in blocking (count) and nonblocking (err) IO pools */
+	DNET_CNTR_IO_THREADS_GROW,		/* Threads added because of queue wait (count) and blocked exec commands (err) */
+	DNET_CNTR_IO_THREADS_RETIRE,		/* Idle autoscaled threads which left IO pools */
+	DNET_CNTR_LOG_DROPPED,			/* Log messages dropped because of log ring overflow */
+	DNET_CNTR_OPLOCK_WAIT,			/* Contended oplock acquisitions (count) and total usecs spent waiting (err) */
+	DNET_CNTR_OPLOCK_WAIT_MAX,		/* Usecs spent waiting on the most contended stripe (count) and its index (err) */
+	DNET_CNTR_ROUTE_SYNC,			/* Route list downloads (count) and checks skipped since remote epoch did not move (err) */
 	__DNET_CNTR_MAX,
 };
 
@@ -122,6 +145,27 @@ enum dnet_counters {
 /* Do not locks operations - must be set for script callers or recursive operations */
 #define DNET_FLAGS_NOLOCK		(1<<4)
 
+/* Attached data starts with struct dnet_deadline, it is stripped by receiving node before processing */
+#define DNET_FLAGS_DEADLINE		(1<<5)
+
+/*
+ * Sender wants to receive route table epoch, it is attached to the acknowledge.
+ * Request only: older nodes copy request flags into replies, so it is ignored in replies.
+ */
+#define DNET_FLAGS_ROUTE_EPOCH		(1<<6)
+
+/* Reply only: attached data starts with struct dnet_route_epoch, it is stripped by receiving node */
+#define DNET_FLAGS_ROUTE_EPOCH_REPLY	(1<<7)
+
+/*
+ * Sender accepts sliced replies, replies copy it from the request.
+ * Ignored in received replies, since older nodes copy all request flags.
+ */
+#define DNET_FLAGS_SLICE_OK		(1<<8)
+
+/* Reply only: attached data starts with struct dnet_slice, receiving node assembles the whole reply */
+#define DNET_FLAGS_SLICE		(1<<9)
+
 struct dnet_id {
 	uint8_t			id[DNET_ID_SIZE];
 	uint32_t		group_id;
@@ -169,6 +213,54 @@ static inline void dnet_convert_cmd(struct dnet_cmd *cmd)
 	cmd->trans = dnet_bswap64(cmd->trans);
 }
 
+/*
+ * Request deadline. Timeout is relative to the moment request was sent,
+ * since clocks of different nodes are not synchronized.
+ */
+struct dnet_deadline
+{
+	uint64_t		timeout;	/* microseconds left until client stops waiting */
+	uint64_t		reserved;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_deadline(struct dnet_deadline *d)
+{
+	d->timeout = dnet_bswap64(d->timeout);
+}
+
+/*
+ * Route table epoch grows every time a state joins node's route table.
+ * DNET_CMD_ROUTE_LIST request may carry it as attached data,
+ * then only states which joined after given epoch are returned.
+ */
+struct dnet_route_epoch
+{
+	uint64_t		epoch;
+	uint64_t		reserved;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_route_epoch(struct dnet_route_epoch *e)
+{
+	e->epoch = dnet_bswap64(e->epoch);
+}
+
+/*
+ * Part of a reply with large attached data, sliced so that other replies could be sent in between.
+ * @offset is position of this part in the attached data of the whole reply, which is @total bytes long.
+ * Slices of one reply are sent in order and are not interleaved with slices of other replies.
+ */
+struct dnet_slice
+{
+	uint64_t		total;
+	uint64_t		offset;
+} __attribute__ ((packed));
+
+static inline void dnet_convert_slice(struct dnet_slice *s)
+{
+	s->total = dnet_bswap64(s->total);
+	s->offset = dnet_bswap64(s->offset);
+}
+
 /*
  * cmd flags which are not 'common' to all commands
  * they occupy higher 32 bits
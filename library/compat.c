@@ -13,15 +13,19 @@
  * GNU General Public License for more details.
  */
 
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "elliptics.h"
@@ -61,6 +65,166 @@ long dnet_get_id(void)
 }
 #endif
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+int dnet_futex_wait(volatile int *addr, int val, long timeout_ms)
+{
+	struct timespec ts;
+	int err;
+
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+	err = syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+	if (err < 0)
+		return -errno;
+
+	return 0;
+}
+
+int dnet_futex_wake(volatile int *addr, int num)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+#else
+/*
+ * No futexes, waiter polls with a small sleep
+ */
+int dnet_futex_wait(volatile int *addr, int val, long timeout_ms)
+{
+	if (timeout_ms > 1)
+		timeout_ms = 1;
+
+	if (*addr != val)
+		return -EAGAIN;
+
+	usleep(timeout_ms * 1000);
+	return 0;
+}
+
+int dnet_futex_wake(volatile int *addr __attribute__ ((unused)), int num __attribute__ ((unused))) { return 0; }
+#endif
+
+/*
+ * Parses CPU list like "0-7,16-23" into the set.
+ * Empty or NULL list produces empty set, which means thread is not pinned.
+ */
+int dnet_cpu_set_parse(struct dnet_cpu_set *set, const char *list)
+{
+	const char *p = list;
+	char *end;
+	long start, stop, cpu;
+
+	memset(set, 0, sizeof(struct dnet_cpu_set));
+
+	if (!list)
+		return 0;
+
+	while (*p) {
+		while (*p == ' ' || *p == ',')
+			p++;
+		if (!*p)
+			break;
+
+		start = strtol(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+
+		stop = start;
+		p = end;
+		if (*p == '-') {
+			p++;
+			stop = strtol(p, &end, 10);
+			if (end == p)
+				return -EINVAL;
+			p = end;
+		}
+
+		if (start < 0 || stop < start || stop >= DNET_CPU_SET_MAX)
+			return -ERANGE;
+
+		for (cpu = start; cpu <= stop; ++cpu) {
+			unsigned long bit = 1UL << (cpu % (8 * sizeof(unsigned long)));
+			unsigned long *word = &set->mask[cpu / (8 * sizeof(unsigned long))];
+
+			if (!(*word & bit))
+				set->num++;
+			*word |= bit;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef __linux__
+#include <sched.h>
+
+/*
+ * Pins calling thread to the CPU set configured for its class.
+ * Memory allocated by pinned thread afterwards (receive buffers of network thread for example)
+ * is placed on its local NUMA node by the first-touch policy.
+ */
+int dnet_thread_pin(struct dnet_node *n, enum dnet_thread_class cls)
+{
+	static const char *names[DNET_THREAD_CLASS_MAX] = {
+		[DNET_THREAD_NET] = "net",
+		[DNET_THREAD_IO] = "io",
+		[DNET_THREAD_NONBLOCKING_IO] = "nonblocking io",
+		[DNET_THREAD_CHECK] = "check",
+	};
+	struct dnet_cpu_set *set = &n->thread_cpus[cls];
+	cpu_set_t cpus;
+	int err, cpu;
+
+	if (!set->num)
+		return 0;
+
+	CPU_ZERO(&cpus);
+	for (cpu = 0; cpu < DNET_CPU_SET_MAX && cpu < CPU_SETSIZE; ++cpu) {
+		if (set->mask[cpu / (8 * sizeof(unsigned long))] & (1UL << (cpu % (8 * sizeof(unsigned long)))))
+			CPU_SET(cpu, &cpus);
+	}
+
+	err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+	if (err) {
+		atomic_inc(&n->threads_pin_failed);
+		dnet_log(n, DNET_LOG_ERROR, "Failed to pin %s thread %ld to %d CPUs: %s [%d]\n",
+				names[cls], dnet_get_id(), set->num, strerror(err), err);
+		return -err;
+	}
+
+	atomic_inc(&n->threads_pinned);
+	dnet_log(n, DNET_LOG_INFO, "Pinned %s thread %ld to %d CPUs, running on CPU %d\n",
+			names[cls], dnet_get_id(), set->num, sched_getcpu());
+	return 0;
+}
+
+/*
+ * Counts migrations of the calling thread between CPUs, @last_cpu is thread's private state
+ */
+void dnet_thread_cpu_check(struct dnet_node *n, int *last_cpu)
+{
+	int cpu = sched_getcpu();
+
+	if (cpu >= 0 && *last_cpu >= 0 && cpu != *last_cpu)
+		atomic_inc(&n->thread_cpu_moves);
+	*last_cpu = cpu;
+}
+#else
+int dnet_thread_pin(struct dnet_node *n, enum dnet_thread_class cls)
+{
+	if (n->thread_cpus[cls].num) {
+		atomic_inc(&n->threads_pin_failed);
+		dnet_log(n, DNET_LOG_ERROR, "Thread CPU affinity is not supported on this platform\n");
+	}
+	return 0;
+}
+
+void dnet_thread_cpu_check(struct dnet_node *n __attribute__ ((unused)), int *last_cpu __attribute__ ((unused))) {}
+#endif
+
 #ifdef HAVE_SENDFILE4_SUPPORT
 #include <sys/sendfile.h>
 int dnet_sendfile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t size)
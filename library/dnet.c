@@ -270,26 +270,44 @@ static int dnet_cmd_join_client(struct dnet_net_state *st, struct dnet_cmd *cmd,
 	return err;
 }
 
-static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd)
+/*
+ * When request carries struct dnet_route_epoch, only states which joined after that epoch are sent.
+ * States are never removed from the route table by route list, clients drop them when connection is reset.
+ */
+static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd, void *data)
 {
 	struct dnet_node *n = orig->n;
 	struct dnet_net_state *st;
 	struct dnet_group *g;
 	void *buf, *orig_buf;
 	size_t size = 0, send_size = 0, sz;
+	uint64_t since = 0;
 	int err;
 
+	if (cmd->size >= sizeof(struct dnet_route_epoch)) {
+		struct dnet_route_epoch e;
+
+		memcpy(&e, data, sizeof(struct dnet_route_epoch));
+		dnet_convert_route_epoch(&e);
+		since = e.epoch;
+	}
+
 	pthread_mutex_lock(&n->state_lock);
 	list_for_each_entry(g, &n->group_list, group_entry) {
 		list_for_each_entry(st, &g->state_list, state_entry) {
 			if (!memcmp(&st->addr, &orig->addr, sizeof(struct dnet_addr)))
 				continue;
+			if (st->route_epoch <= since)
+				continue;
 
 			size += st->idc->id_num * sizeof(struct dnet_raw_id) + sizeof(struct dnet_addr_cmd);
 		}
 	}
 	pthread_mutex_unlock(&n->state_lock);
 
+	if (!size)
+		return 0;
+
 	orig_buf = buf = malloc(size);
 	if (!buf) {
 		err = -ENOMEM;
@@ -301,6 +319,8 @@ static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd
 		list_for_each_entry(st, &g->state_list, state_entry) {
 			if (!memcmp(&st->addr, &orig->addr, sizeof(struct dnet_addr)))
 				continue;
+			if (st->route_epoch <= since)
+				continue;
 
 			sz = st->idc->id_num * sizeof(struct dnet_raw_id) + sizeof(struct dnet_addr_cmd);
 			if (sz <= size) {
@@ -384,7 +404,7 @@ static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_c
 	as->num = __DNET_CNTR_MAX;
 	as->cmd_num = __DNET_CMD_MAX;
 
-	memcpy(as->count, n->counters, sizeof(struct dnet_stat_count) * __DNET_CNTR_MAX);
+	dnet_counter_sum(n, as->count);
 
 	if (n->cb->storage_stat) {
 		err = n->cb->storage_stat(n->cb->command_private, &st);
@@ -412,6 +432,22 @@ static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_c
 	}
 	as->count[DNET_CNTR_NODE_FILES].count = n->cb->meta_total_elements(n->cb->command_private);
 
+	dnet_io_slab_stat(n, as->count);
+
+	if (n->log_async)
+		as->count[DNET_CNTR_LOG_DROPPED].count = atomic_read(&n->log_async->dropped);
+
+	dnet_locks_stat(n, as->count);
+
+	as->count[DNET_CNTR_ROUTE_SYNC].count = n->route_sync;
+	as->count[DNET_CNTR_ROUTE_SYNC].err = n->route_sync_skipped;
+
+	as->count[DNET_CNTR_THREAD_PINNED].count = atomic_read(&n->threads_pinned);
+	as->count[DNET_CNTR_THREAD_PINNED].err = atomic_read(&n->threads_pin_failed);
+	as->count[DNET_CNTR_THREAD_CPU_MOVES].count = atomic_read(&n->thread_cpu_moves);
+
+	dnet_io_pool_stat(n, as->count);
+
 	dnet_convert_addr_stat(as, as->num);
 
 	return dnet_send_reply(orig, cmd, as, sizeof(struct dnet_addr_stat) + __DNET_CNTR_MAX * sizeof(struct dnet_stat_count), 1);
@@ -529,14 +565,22 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 	struct dnet_node *n = st->n;
 	unsigned long long tid = cmd->trans & ~DNET_TRANS_REPLY;
 	struct dnet_io_attr *io;
-	struct timeval start, end;
-	long diff;
+	struct dnet_trace_span *span;
+	uint64_t start = 0;
+	int locked = !(cmd->flags & DNET_FLAGS_NOLOCK);
+	unsigned int lock_idx = 0;
+
+	if (locked) {
+		int shared = (cmd->cmd == DNET_CMD_READ) || (cmd->cmd == DNET_CMD_LOOKUP) || (cmd->cmd == DNET_CMD_STAT);
 
-	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
-		dnet_oplock(n, &cmd->id);
+		span = dnet_trace_begin(DNET_TRACE_OPLOCK);
+		lock_idx = dnet_oplock(n, &cmd->id, shared);
+		dnet_trace_span_end(span);
 	}
 
-	gettimeofday(&start, NULL);
+	/* processing time is only used in the log, most commands take less than a coarse clock tick */
+	if (dnet_log_enabled(n, DNET_LOG_INFO))
+		start = dnet_io_now_usecs();
 
 	switch (cmd->cmd) {
 		case DNET_CMD_AUTH:
@@ -552,7 +596,7 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 			err = dnet_cmd_join_client(st, cmd, data);
 			break;
 		case DNET_CMD_ROUTE_LIST:
-			err = dnet_cmd_route_list(st, cmd);
+			err = dnet_cmd_route_list(st, cmd, data);
 			break;
 		case DNET_CMD_EXEC:
 			err = dnet_cmd_exec(st, cmd, data);
@@ -630,7 +674,9 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 				 * Always check cache when reading!
 				 */
 				if ((io->flags & DNET_IO_FLAGS_CACHE) || (cmd->cmd != DNET_CMD_WRITE)) {
+					span = dnet_trace_begin(DNET_TRACE_CACHE);
 					err = dnet_cmd_cache_io(st, cmd, io, data + sizeof(struct dnet_io_attr));
+					dnet_trace_span_end(span);
 
 					if (io->flags & DNET_IO_FLAGS_CACHE_ONLY)
 						break;
@@ -674,7 +720,10 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 			if ((cmd->cmd == DNET_CMD_WRITE) || (cmd->cmd == DNET_CMD_READ)) {
 				cmd->flags &= ~DNET_FLAGS_NEED_ACK;
 			}
+
+			span = dnet_trace_begin(DNET_TRACE_BACKEND);
 			err = n->cb->command_handler(st, n->cb->command_private, cmd, data);
+			dnet_trace_span_end(span);
 
 			/* If there was error in WRITE command - send empty reply
 			   to notify client with error code and destroy transaction */
@@ -689,38 +738,50 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 			break;
 	}
 
-	dnet_stat_inc(st->stat, cmd->cmd, err);
+	dnet_state_stat_inc(st, cmd->cmd, err);
 	if (st->__join_state == DNET_JOIN)
 		dnet_counter_inc(n, cmd->cmd, err);
 	else
 		dnet_counter_inc(n, cmd->cmd + __DNET_CMD_MAX, err);
 
-	gettimeofday(&end, NULL);
-
-	diff = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
-	dnet_log(n, DNET_LOG_INFO, "%s: %s: trans: %llu, cflags: %llx, time: %ld usecs, err: %d.\n",
-			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), tid,
-			(unsigned long long)cmd->flags, diff, err);
+	if (start) {
+		dnet_log(n, DNET_LOG_INFO, "%s: %s: trans: %llu, cflags: %llx, time: %llu usecs, err: %d.\n",
+				dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), tid,
+				(unsigned long long)cmd->flags, (unsigned long long)(dnet_io_now_usecs() - start), err);
+	}
 
 	if (cmd->flags & DNET_FLAGS_NEED_ACK) {
-		struct dnet_cmd ack;
-
-		memcpy(&ack.id, &cmd->id, sizeof(struct dnet_id));
-		ack.cmd = cmd->cmd;
-		ack.trans = cmd->trans | DNET_TRANS_REPLY;
-		ack.size = 0;
-		ack.flags = cmd->flags & ~(DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE);
-		ack.status = err;
+		struct {
+			struct dnet_cmd		cmd;
+			struct dnet_route_epoch	epoch;
+		} __attribute__ ((packed)) ack;
+
+		memcpy(&ack.cmd.id, &cmd->id, sizeof(struct dnet_id));
+		ack.cmd.cmd = cmd->cmd;
+		ack.cmd.trans = cmd->trans | DNET_TRANS_REPLY;
+		ack.cmd.size = 0;
+		ack.cmd.flags = cmd->flags & ~(DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE | DNET_FLAGS_ROUTE_EPOCH_REPLY);
+		ack.cmd.status = err;
+
+		if (dnet_io_route_epoch) {
+			ack.cmd.flags |= DNET_FLAGS_ROUTE_EPOCH_REPLY;
+			ack.cmd.size = sizeof(struct dnet_route_epoch);
+
+			memset(&ack.epoch, 0, sizeof(struct dnet_route_epoch));
+			ack.epoch.epoch = n->route_epoch;
+			dnet_convert_route_epoch(&ack.epoch);
+		}
 
 		dnet_log(n, DNET_LOG_DEBUG, "%s: ack trans: %llu, flags: %llx, status: %d.\n",
-				dnet_dump_id(&cmd->id), tid, (unsigned long long)ack.flags, err);
+				dnet_dump_id(&cmd->id), tid, (unsigned long long)ack.cmd.flags, err);
 
-		dnet_convert_cmd(&ack);
-		err = dnet_send(st, &ack, sizeof(struct dnet_cmd));
+		dnet_convert_cmd(&ack.cmd);
+		err = dnet_send(st, &ack, sizeof(struct dnet_cmd) + (dnet_io_route_epoch ? sizeof(struct dnet_route_epoch) : 0));
 	}
 
-	if (!(cmd->flags & DNET_FLAGS_NOLOCK))
-		dnet_opunlock(n, &cmd->id);
+	/* handlers may rewrite cmd->id and cmd->flags, unlock the stripe locked above */
+	if (locked)
+		dnet_opunlock(n, lock_idx);
 
 	return err;
 }
@@ -907,10 +968,9 @@ err_out_free:
 	return err;
 }
 
-int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
-		int fd, uint64_t offset, int close_on_exit)
+static int __dnet_send_read_data(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int close_on_exit, void (* release)(void *priv), void *priv)
 {
-	struct dnet_net_state *st = state;
 	struct dnet_cmd *c;
 	struct dnet_io_attr *rio;
 	int hsize = sizeof(struct dnet_cmd) + sizeof(struct dnet_io_attr);
@@ -922,13 +982,15 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 	 * back to parental client, instead server will wrap data into
 	 * proper transaction reply next to this obscure packet.
 	 */
-	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING)
-		return 0;
+	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING) {
+		err = 0;
+		goto err_out_release;
+	}
 
 	c = malloc(hsize);
 	if (!c) {
 		err = -ENOMEM;
-		goto err_out_exit;
+		goto err_out_release;
 	}
 
 	memset(c, 0, hsize);
@@ -960,14 +1022,30 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 	dnet_convert_io_attr(rio);
 
 	if (data)
-		err = dnet_send_data(st, c, hsize, data, io->size);
+		err = dnet_send_data_nocopy(st, c, hsize, data, io->size, release, priv);
 	else
 		err = dnet_send_fd(st, c, hsize, fd, offset, io->size, close_on_exit);
 
 	free(c);
 
-err_out_exit:
 	return err;
+
+err_out_release:
+	if (release)
+		release(priv);
+	return err;
+}
+
+int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int close_on_exit)
+{
+	return __dnet_send_read_data(state, cmd, io, data, fd, offset, close_on_exit, NULL, NULL);
+}
+
+int dnet_send_read_data_nocopy(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		void (* release)(void *priv), void *priv)
+{
+	return __dnet_send_read_data(state, cmd, io, data, -1, 0, 0, release, priv);
 }
 
 void dnet_fill_addr_attr(struct dnet_node *n, struct dnet_addr_attr *attr)
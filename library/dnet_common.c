@@ -91,6 +91,25 @@ static char *dnet_counter_strings[] = {
 	[DNET_CNTR_DBW_SYSTEM] = "DNET_CNTR_DBW_SYSTEM",
 	[DNET_CNTR_DBW_ERROR] = "DNET_CNTR_DBW_ERROR",
 	[DNET_CNTR_UNKNOWN] = "UNKNOWN",
+	[DNET_CNTR_RECV_SLAB_HIT] = "DNET_CNTR_RECV_SLAB_HIT",
+	[DNET_CNTR_RECV_SLAB_MISS] = "DNET_CNTR_RECV_SLAB_MISS",
+	[DNET_CNTR_RECV_SLAB_RESIDENT] = "DNET_CNTR_RECV_SLAB_RESIDENT",
+	[DNET_CNTR_THREAD_PINNED] = "DNET_CNTR_THREAD_PINNED",
+	[DNET_CNTR_THREAD_CPU_MOVES] = "DNET_CNTR_THREAD_CPU_MOVES",
+	[DNET_CNTR_IO_QUEUE_READ] = "DNET_CNTR_IO_QUEUE_READ",
+	[DNET_CNTR_IO_QUEUE_WRITE] = "DNET_CNTR_IO_QUEUE_WRITE",
+	[DNET_CNTR_IO_QUEUE_RANGE] = "DNET_CNTR_IO_QUEUE_RANGE",
+	[DNET_CNTR_IO_QUEUE_EXEC] = "DNET_CNTR_IO_QUEUE_EXEC",
+	[DNET_CNTR_IO_QUEUE_ADMIN] = "DNET_CNTR_IO_QUEUE_ADMIN",
+	[DNET_CNTR_IO_REJECTED] = "DNET_CNTR_IO_REJECTED",
+	[DNET_CNTR_IO_EXPIRED] = "DNET_CNTR_IO_EXPIRED",
+	[DNET_CNTR_IO_THREADS] = "DNET_CNTR_IO_THREADS",
+	[DNET_CNTR_IO_THREADS_GROW] = "DNET_CNTR_IO_THREADS_GROW",
+	[DNET_CNTR_IO_THREADS_RETIRE] = "DNET_CNTR_IO_THREADS_RETIRE",
+	[DNET_CNTR_LOG_DROPPED] = "DNET_CNTR_LOG_DROPPED",
+	[DNET_CNTR_OPLOCK_WAIT] = "DNET_CNTR_OPLOCK_WAIT",
+	[DNET_CNTR_OPLOCK_WAIT_MAX] = "DNET_CNTR_OPLOCK_WAIT_MAX",
+	[DNET_CNTR_ROUTE_SYNC] = "DNET_CNTR_ROUTE_SYNC",
 };
 
 char *dnet_cmd_string(int cmd)
@@ -103,7 +122,7 @@ char *dnet_cmd_string(int cmd)
 
 char *dnet_counter_string(int cntr, int cmd_num)
 {
-	if (cntr <= 0 || cntr >= __DNET_CNTR_MAX || cntr >= DNET_CNTR_UNKNOWN)
+	if (cntr <= 0 || cntr >= __DNET_CNTR_MAX)
 		cntr = DNET_CNTR_UNKNOWN;
 
 	if (cntr < cmd_num)
@@ -219,13 +238,20 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * With versioned route tables only states which joined remote route table after the epoch
+ * it was previously downloaded at are requested. Epoch seen before sending request becomes
+ * the new synced one, so states joined while request was in flight are requested again next time.
+ */
 int dnet_recv_route_list(struct dnet_net_state *st)
 {
 	struct dnet_io_req req;
 	struct dnet_node *n = st->n;
 	struct dnet_trans *t;
 	struct dnet_cmd *cmd;
+	struct dnet_route_epoch *e = NULL;
 	struct dnet_wait *w;
+	uint64_t epoch = 0;
 	int err;
 
 	w = dnet_wait_alloc(0);
@@ -234,7 +260,10 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 		goto err_out_exit;
 	}
 
-	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd));
+	if (n->flags & DNET_CFG_ROUTE_EPOCH)
+		epoch = st->route_epoch_remote;
+
+	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd) + sizeof(struct dnet_route_epoch));
 	if (!t) {
 		err = -ENOMEM;
 		goto err_out_wait_put;
@@ -252,18 +281,32 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 
 	cmd->cmd = t->command = DNET_CMD_ROUTE_LIST;
 
+	if ((n->flags & DNET_CFG_ROUTE_EPOCH) && st->route_epoch_synced) {
+		e = (struct dnet_route_epoch *)(cmd + 1);
+
+		memset(e, 0, sizeof(struct dnet_route_epoch));
+		e->epoch = st->route_epoch_synced;
+		dnet_convert_route_epoch(e);
+
+		cmd->size = sizeof(struct dnet_route_epoch);
+	}
+
 	t->st = dnet_state_get(st);
 	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
 
-	dnet_convert_cmd(cmd);
+	dnet_log(n, DNET_LOG_DEBUG, "%s: list route request to %s, since epoch: %llu.\n", dnet_dump_id(&cmd->id),
+		dnet_server_convert_dnet_addr(&st->addr), (unsigned long long)st->route_epoch_synced);
 
-	dnet_log(n, DNET_LOG_DEBUG, "%s: list route request to %s.\n", dnet_dump_id(&cmd->id),
-		dnet_server_convert_dnet_addr(&st->addr));
+	dnet_convert_cmd(cmd);
 
 	memset(&req, 0, sizeof(req));
 	req.st = st;
 	req.header = cmd;
 	req.hsize = sizeof(struct dnet_cmd);
+	if (e) {
+		req.data = e;
+		req.dsize = sizeof(struct dnet_route_epoch);
+	}
 
 	dnet_wait_get(w);
 	err = dnet_trans_send(t, &req);
@@ -271,8 +314,11 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 		goto err_out_destroy;
 
 	err = dnet_wait_event(w, w->cond != 0, &n->wait_ts);
+	if (!err && !w->status)
+		st->route_epoch_synced = epoch;
 	dnet_wait_put(w);
 
+	n->route_sync++;
 	return 0;
 
 err_out_destroy:
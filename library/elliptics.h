@@ -58,8 +58,10 @@ extern "C" {
 struct dnet_node;
 struct dnet_group;
 struct dnet_net_state;
+struct dnet_uring_state;
 
-#define dnet_log(n, level, format, a...) do { if (n->log && (n->log->log_level >= level)) dnet_log_raw(n, level, format, ##a); } while (0)
+#define dnet_log_enabled(n, level) ((n)->log && ((n)->log->log_level >= (level)))
+#define dnet_log(n, level, format, a...) do { if (dnet_log_enabled(n, level)) dnet_log_raw(n, level, format, ##a); } while (0)
 #define dnet_log_err(n, f, a...) dnet_log(n, DNET_LOG_ERROR, f ": %s [%d].\n", ##a, strerror(errno), errno)
 
 struct dnet_io_req {
@@ -77,8 +79,59 @@ struct dnet_io_req {
 	int			fd;
 	off_t			local_offset;
 	size_t			fsize;
+
+	/*
+	 * When set, @data is not copied into the send queue, instead its ownership is passed to the queue
+	 * and @data_release(@data_priv) is invoked when request is sent or dropped.
+	 */
+	void			(* data_release)(void *priv);
+	void			*data_priv;
+
+	struct dnet_io_slab	*slab;
+	int			slab_class;
+
+	/* IO queue class and time request was queued at (monotonic usecs) */
+	int			io_class;
+	uint64_t		queue_time;
+
+	/* time (monotonic usecs) after which nobody waits for request completion, zero if not set */
+	uint64_t		deadline;
+
+	/* sampled request trace and its span closed when this request is freed (i.e. sent) */
+	struct dnet_trace	*trace;
+	struct dnet_trace_span	*trace_span;
+
+	/* sent request asks for route table epoch, received one must be acknowledged with it */
+	int			route_epoch;
+
+	/* counter of bulk list frames this request is accounted in, see dnet_io_req_fast() */
+	int			*send_bulk;
 };
 
+static inline uint64_t dnet_io_now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Monotonic clock with scheduler tick resolution (1-4 msecs), it does not read hardware counter,
+ * so it is the cheapest timing source for millisecond deadlines and idle timeouts
+ */
+static inline uint64_t dnet_coarse_usecs(void)
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
 /*
  * Currently executed network state machine:
  * receives and sends command and data.
@@ -90,8 +143,25 @@ struct dnet_io_req {
 /* Attached data should be discarded */
 #define DNET_IO_DROP		(1<<1)
 
+/* Reading slice extension of a reply, then its data into the reply being assembled */
+#define DNET_IO_SLICE		(1<<2)
+#define DNET_IO_SLICE_DATA	(1<<3)
+
 #define DNET_STATE_MAX_WEIGHT		(1024 * 10)
 
+/* number of transaction buckets frames queued into bulk list are counted in, see dnet_io_req_fast() */
+#define DNET_SEND_TRANS_HASH		64
+
+/*
+ * Open-addressing table of in-flight transactions indexed by transaction id, see trans.c
+ */
+struct dnet_trans;
+struct dnet_trans_table {
+	struct dnet_trans	**slots;
+	unsigned long		mask;
+	unsigned long		num;
+};
+
 struct dnet_net_state
 {
 	struct list_head	state_entry;
@@ -116,16 +186,49 @@ struct dnet_net_state
 	uint64_t		rcv_offset;
 	uint64_t		rcv_end;
 	unsigned int		rcv_flags;
+	/*
+	 * Received request waits for room in IO queue, receiving is stopped until it is queued.
+	 * Set by network thread and cleared by IO thread, so it is kept out of @rcv_flags.
+	 */
+	volatile int		rcv_parked;
 	void			*rcv_data;
+	/* sliced reply being assembled and number of its bytes received or being received */
+	struct dnet_slice	rcv_slice;
+	struct dnet_io_req	*rcv_sliced;
+	uint64_t		rcv_sliced_offset;
+	/* time the first byte of the current packet was received at, only set when tracing is enabled */
+	uint64_t		rcv_start;
 
 	int			epoll_fd;
+	struct dnet_net_io	*nio;
+
+	/* io_uring requests and received chunks of this state, see uring.c */
+	struct dnet_uring_state	*uring;
+
 	size_t			send_offset;
 	pthread_mutex_t		send_lock;
 	struct list_head	send_list;
 
+	/*
+	 * Small frames without file body are queued into fast lane and are sent
+	 * before queued large ones, unless the latter belong to the same transaction.
+	 * @send_cur is a partially sent frame, it must be completed before anything else.
+	 */
+	struct list_head	send_fast_list;
+	struct dnet_io_req	*send_cur;
+
+	/*
+	 * Frames queued into @send_list per transaction hash and those without command header,
+	 * small frame goes through the fast lane only if its bucket and @send_bulk_raw are zero.
+	 */
+	int			send_bulk[DNET_SEND_TRANS_HASH];
+	int			send_bulk_raw;
+
 	pthread_mutex_t		trans_lock;
-	struct rb_root		trans_root;
-	struct list_head	trans_list;
+	struct dnet_trans_table	trans_table;
+
+	/* transactions timed out since the last stall check */
+	volatile int		trans_timeouts;
 
 
 	int			la;
@@ -135,6 +238,16 @@ struct dnet_net_state
 
 	struct dnet_idc		*idc;
 
+	/*
+	 * Local route table epoch this state joined at, the last epoch received from remote node,
+	 * whether it was received since the last route table check, and remote epoch
+	 * route table was downloaded at (zero if it never was)
+	 */
+	uint64_t		route_epoch;
+	volatile uint64_t	route_epoch_remote;
+	volatile int		route_epoch_fresh;
+	uint64_t		route_epoch_synced;
+
 	struct dnet_stat_count	stat[__DNET_CMD_MAX];
 };
 
@@ -152,12 +265,22 @@ struct dnet_idc {
 };
 
 int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id *ids, int id_num);
+int dnet_idc_merge_ids(struct dnet_group *g, struct dnet_state_id *ids, int id_num);
 void dnet_idc_destroy_nolock(struct dnet_net_state *st);
 
-struct dnet_net_state *dnet_state_create(struct dnet_node *n,
+struct dnet_net_state *dnet_state_create_nio(struct dnet_node *n,
 		int group_id, struct dnet_raw_id *ids, int id_num,
 		struct dnet_addr *addr, int s, int *errp, int join,
-		int (* process)(struct dnet_net_state *st, struct epoll_event *ev));
+		int (* process)(struct dnet_net_state *st, struct epoll_event *ev),
+		struct dnet_net_io *nio);
+
+static inline struct dnet_net_state *dnet_state_create(struct dnet_node *n,
+		int group_id, struct dnet_raw_id *ids, int id_num,
+		struct dnet_addr *addr, int s, int *errp, int join,
+		int (* process)(struct dnet_net_state *st, struct epoll_event *ev))
+{
+	return dnet_state_create_nio(n, group_id, ids, id_num, addr, s, errp, join, process, NULL);
+}
 
 void dnet_state_reset(struct dnet_net_state *st);
 void dnet_state_remove_nolock(struct dnet_net_state *st);
@@ -174,6 +297,9 @@ int dnet_search_range(struct dnet_node *n, struct dnet_id *id,
 
 int dnet_recv_route_list(struct dnet_net_state *st);
 
+/* set while IO thread processes request whose sender wants route table epoch in acknowledge */
+extern __thread int dnet_io_route_epoch;
+
 void dnet_state_destroy(struct dnet_net_state *st);
 
 void dnet_schedule_command(struct dnet_net_state *st);
@@ -281,6 +407,55 @@ struct dnet_group
 	struct dnet_state_id	*ids;
 };
 
+/*
+ * Route snapshots.
+ *
+ * Every group's id ring is published as an immutable copy, lookups walk the current
+ * table without state_lock. Table and rings are replaced (under state_lock) whenever
+ * ids of a group change, old ones are freed after all readers which could see them
+ * have left their read-side sections. Rings are shared between consecutive tables,
+ * @refcnt counts tables which reference the ring and is only changed by updaters.
+ */
+struct dnet_route_id {
+	struct dnet_raw_id	raw;
+	struct dnet_net_state	*st;
+};
+
+/*
+ * Ring lookups first search @prefix - big-endian first 8 bytes of every id in Eytzinger
+ * (breadth-first, 1-based) order, so that the top of the search tree shares a few cache lines
+ * and next levels can be prefetched, @pos maps Eytzinger index back into @ids position.
+ * Full ids are only compared for ids which share the prefix with the key.
+ */
+struct dnet_route_ring {
+	int			refcnt;
+	unsigned int		group_id;
+	int			id_num;
+
+	uint64_t		*prefix;
+	int			*pos;
+
+	struct dnet_route_id	ids[];
+};
+
+struct dnet_route_table {
+	int			group_num;
+	struct dnet_route_ring	*rings[];
+};
+
+/* ring snapshot of group ids, it is freed with free() */
+struct dnet_route_ring *dnet_route_ring_create(struct dnet_group *g);
+int dnet_route_ring_pos(struct dnet_route_ring *ring, struct dnet_id *id);
+
+/*
+ * Readers are counted in per-thread shards, every shard has two counters and readers
+ * use the one selected by current @route_gp (grace period) parity, so that updater waits only
+ * for readers which entered before the table was replaced.
+ */
+struct dnet_route_reader {
+	volatile int		count[2];
+} __attribute__ ((aligned(64)));
+
 static inline struct dnet_group *dnet_group_get(struct dnet_group *g)
 {
 	atomic_inc(&g->refcnt);
@@ -305,24 +480,335 @@ struct dnet_transform
 int dnet_crypto_init(struct dnet_node *n, void *ns, int nsize);
 void dnet_crypto_cleanup(struct dnet_node *n);
 
+/*
+ * Receive buffers are cached in power-of-two classes from 512 bytes up to 64k,
+ * every class keeps at most DNET_IO_SLAB_CLASS_CACHE bytes of idle buffers.
+ */
+#define DNET_IO_SLAB_MIN_SHIFT		9
+#define DNET_IO_SLAB_CLASSES		8
+#define DNET_IO_SLAB_CLASS_CACHE	(4 * 1024 * 1024)
+
+struct dnet_io_slab_class {
+	/* accessed by owning network thread only */
+	struct dnet_io_req	*local;
+
+	struct dnet_lock	lock;
+	struct dnet_io_req	*remote;
+
+	atomic_t		cached;
+};
+
+struct dnet_io_slab {
+	struct dnet_io_slab_class	classes[DNET_IO_SLAB_CLASSES];
+
+	int			dead;
+	atomic_t		outstanding;
+	atomic_t		resident;
+
+	/* idle bytes shared with other slabs and their limit, used by per-thread slabs */
+	atomic_t		*total_cached;
+	long			total_cache_max;
+
+	uint64_t		hit, miss, oversize;
+};
+
+struct dnet_io_slab *dnet_io_slab_create(void);
+void dnet_io_slab_destroy(struct dnet_io_slab *slab);
+struct dnet_io_req *dnet_io_slab_alloc(struct dnet_io_slab *slab, uint64_t size);
+void dnet_io_slab_free(struct dnet_io_req *r);
+
+/*
+ * Buffers up to DNET_THREAD_SLAB_MAX bytes (including struct dnet_io_req) are taken
+ * from per-thread slab, it is used for transactions and reply headers.
+ * All per-thread slabs together keep at most DNET_THREAD_SLAB_CACHE bytes of idle buffers,
+ * so that idle memory does not grow with the number of IO threads.
+ */
+#define DNET_THREAD_SLAB_MAX		4096
+#define DNET_THREAD_SLAB_CACHE		(32 * 1024 * 1024)
+struct dnet_io_req *dnet_io_slab_thread_alloc(uint64_t size);
+void dnet_io_slab_stat(struct dnet_node *n, struct dnet_stat_count *count);
+
+/*
+ * Asynchronous logging: every thread formats its messages into own single-producer ring,
+ * which is drained by the node's log writer thread calling dnet_log callback.
+ * Messages which do not fit into the ring are dropped and accounted in @dropped.
+ */
+#define DNET_LOG_RING_MIN		4096
+#define DNET_LOG_WRITER_WAIT_MS		100
+
+struct dnet_log_record {
+	int			size;
+	int			level;
+	char			msg[0];
+};
+
+struct dnet_log_ring {
+	struct dnet_log_ring	*next;
+	volatile int		dead;
+	unsigned int		size;
+
+	volatile uint64_t	head __attribute__ ((aligned(64)));
+	volatile uint64_t	tail __attribute__ ((aligned(64)));
+
+	char			data[0] __attribute__ ((aligned(64)));
+};
+
+struct dnet_log_async {
+	struct dnet_node	*n;
+	pthread_t		tid;
+	pthread_key_t		key;
+	unsigned int		ring_size;
+
+	volatile int		need_exit;
+	volatile int		sleeping;
+	volatile int		wake_seq;
+
+	/* rings registered by new threads, writer moves them into its private @rings list */
+	struct dnet_log_ring	*pending;
+	struct dnet_log_ring	*rings;
+
+	atomic_t		dropped;
+};
+
+int dnet_log_async_start(struct dnet_node *n, int ring_kb);
+void dnet_log_async_stop(struct dnet_node *n);
+
+/*
+ * Request tracing: every @sample'th request received from the network gets a trace,
+ * which collects spans of processing stages (with the thread which executed them).
+ * Trace is completed when request and all replies queued while it was processed are freed,
+ * last DNET_TRACE_RING completed traces are kept for dnet_trace_dump().
+ */
+enum dnet_trace_stage {
+	DNET_TRACE_RECV = 0,		/* from the first header byte until the whole packet was read */
+	DNET_TRACE_QUEUE,		/* waiting in IO pool queue */
+	DNET_TRACE_PROCESS,		/* command processing in IO thread */
+	DNET_TRACE_OPLOCK,		/* waiting for operation lock */
+	DNET_TRACE_CACHE,		/* cache lookup/update */
+	DNET_TRACE_BACKEND,		/* backend command handler */
+	DNET_TRACE_SEND,		/* from reply (or forwarded request) being queued until it was sent */
+	__DNET_TRACE_MAX,
+};
+
+#define DNET_TRACE_SPANS		16
+#define DNET_TRACE_RING			1024
+
+struct dnet_trace_span {
+	int			stage;
+	int			tid;
+	uint64_t		start, end;
+};
+
+struct dnet_trace {
+	atomic_t		refcnt;
+	int			num;
+	uint64_t		seq;
+	uint64_t		start;
+	struct dnet_cmd		cmd;
+	struct dnet_addr	addr;
+	struct dnet_trace_log	*log;
+	struct dnet_trace_span	spans[DNET_TRACE_SPANS];
+};
+
+struct dnet_trace_log {
+	int			sample;
+	char			*file;
+	uint64_t		seq;
+
+	pthread_mutex_t		lock;
+	struct dnet_trace	*ring[DNET_TRACE_RING];
+	unsigned int		pos;
+};
+
+/* trace of the request being processed by current IO thread */
+extern __thread struct dnet_trace *dnet_trace_current;
+
+int dnet_trace_init(struct dnet_node *n, struct dnet_config *cfg);
+void dnet_trace_exit(struct dnet_node *n);
+struct dnet_trace *dnet_trace_sample(struct dnet_node *n, struct dnet_net_state *st, struct dnet_cmd *cmd);
+struct dnet_trace *dnet_trace_get(struct dnet_trace *t);
+void dnet_trace_put(struct dnet_trace *t, struct dnet_trace_span *span);
+struct dnet_trace_span *dnet_trace_span_start(struct dnet_trace *t, int stage, uint64_t start);
+void dnet_trace_span_add(struct dnet_trace *t, int stage, uint64_t start, uint64_t end);
+
+static inline void dnet_trace_span_end(struct dnet_trace_span *span)
+{
+	if (span)
+		span->end = dnet_io_now_usecs();
+}
+
+/* starts a span of current IO thread's trace, NULL if request is not traced */
+static inline struct dnet_trace_span *dnet_trace_begin(int stage)
+{
+	if (!dnet_trace_current)
+		return NULL;
+
+	return dnet_trace_span_start(dnet_trace_current, stage, dnet_io_now_usecs());
+}
+
+/*
+ * Network thread harvests up to DNET_NET_EVENTS events per epoll_wait() call,
+ * every ready state may receive up to DNET_NET_BUDGET_PACKETS packets or
+ * DNET_NET_BUDGET_BYTES bytes of a single packet per round.
+ */
+#define DNET_NET_EVENTS			64
+
+/* Listening state accepts up to this number of clients per call */
+#define DNET_ACCEPT_BATCH		64
+#define DNET_NET_BUDGET_PACKETS		32
+#define DNET_NET_BUDGET_BYTES		(1024 * 1024)
+
+struct dnet_uring;
+
+/*
+ * Hierarchical timing wheel of transaction timeouts, see timer.c
+ */
+#define DNET_WHEEL_LEVELS		4
+#define DNET_WHEEL_BITS			6
+#define DNET_WHEEL_SLOTS		(1 << DNET_WHEEL_BITS)
+
+struct dnet_timer {
+	struct list_head	entry;
+	uint64_t		expires;	/* monotonic msecs */
+	int			fired;
+};
+
+struct dnet_timer_wheel {
+	struct dnet_lock	lock;
+	uint64_t		now;		/* msecs, every timer before it has been moved to @expired */
+	long			count;		/* number of timers in @slots */
+	uint64_t		sleep_until;	/* msecs, owning thread sleeps until then, zero if it does not */
+	struct list_head	expired;
+	struct list_head	slots[DNET_WHEEL_LEVELS][DNET_WHEEL_SLOTS];
+};
+
+static inline void dnet_timer_init(struct dnet_timer *timer)
+{
+	INIT_LIST_HEAD(&timer->entry);
+}
+
+int dnet_timer_wheel_init(struct dnet_timer_wheel *w);
+void dnet_timer_wheel_destroy(struct dnet_timer_wheel *w);
+int dnet_timer_add(struct dnet_timer_wheel *w, struct dnet_timer *timer, uint64_t expires);
+void dnet_timer_cancel(struct dnet_timer_wheel *w, struct dnet_timer *timer);
+void dnet_timer_wheel_advance(struct dnet_timer_wheel *w);
+struct dnet_timer *dnet_timer_wheel_pop_nolock(struct dnet_timer_wheel *w);
+int dnet_timer_wheel_timeout(struct dnet_timer_wheel *w, int max);
+
 struct dnet_net_io {
 	int			epoll_fd;
+	/* eventfd polled by epoll engine, wakes thread up when earlier timer is armed */
+	int			wake_fd;
 	pthread_t		tid;
 	struct dnet_node	*n;
+	struct dnet_io_slab	*slab;
+
+	/* when not NULL, readiness is reported via io_uring instead of epoll */
+	struct dnet_uring	*ring;
+
+	/* timeouts of transactions sent through states of this thread */
+	struct dnet_timer_wheel	wheel;
 };
 
+void dnet_io_net_wake(struct dnet_net_io *nio);
+
+/*
+ * io_uring network engine, see uring.c
+ */
+struct dnet_uring *dnet_uring_create(struct dnet_node *n);
+void dnet_uring_destroy(struct dnet_uring *ring);
+void dnet_uring_state_destroy(struct dnet_net_state *st);
+int dnet_uring_schedule(struct dnet_net_state *st, int send);
+void dnet_uring_unschedule(struct dnet_net_state *st, int send);
+void dnet_uring_rearm(struct dnet_net_state *st);
+int dnet_uring_wait(struct dnet_net_io *nio, struct epoll_event *ev, int num, int timeout);
+void dnet_uring_wake(struct dnet_uring *ring);
+ssize_t dnet_uring_recv(struct dnet_net_state *st, void *data, size_t size);
+int dnet_uring_send(struct dnet_net_state *st);
+
 enum dnet_work_io_mode {
 	DNET_WORK_IO_MODE_BLOCKING = 0,
 	DNET_WORK_IO_MODE_NONBLOCKING,
 	DNET_WORK_IO_MODE_EXEC_BLOCKING,
 };
 
+/*
+ * Bounded lock-free multi-producer multi-consumer queue of IO requests (Dmitry Vyukov's algorithm).
+ * Every cell carries a sequence number, which tells whether cell is ready to be filled or consumed.
+ * Size must be a power of two.
+ */
+#define DNET_IO_QUEUE_SIZE		(64 * 1024)
+
+struct dnet_io_queue_cell {
+	volatile unsigned long	seq;
+	struct dnet_io_req	*r;
+};
+
+struct dnet_io_queue {
+	struct dnet_io_queue_cell	*cells;
+	unsigned long		mask;
+
+	char			pad0[64];
+	volatile unsigned long	enqueue_pos;
+	char			pad1[64];
+	volatile unsigned long	dequeue_pos;
+	char			pad2[64];
+};
+
+/* per-thread queue size and maximum number of threads with own queue in work-stealing mode */
+#define DNET_IO_LOCAL_QUEUE_SIZE	4096
+#define DNET_WORK_POOL_MAX_THREADS	1024
+
 struct dnet_work_pool;
 struct dnet_work_io {
 	struct list_head	wio_entry;
 	int			thread_index;
 	pthread_t		tid;
 	struct dnet_work_pool	*pool;
+
+	/* work-stealing mode only */
+	struct dnet_io_queue	local;
+	volatile int		sleeping;
+	volatile int		wake_seq;
+
+	/*
+	 * Thread allocates its @local queue of @local_size cells after it was pinned,
+	 * so that queue lands on its NUMA node, and sets @started (and @start_err) when done
+	 */
+	int			local_size;
+	volatile int		started;
+	int			start_err;
+
+	/* position in weighted class schedule */
+	unsigned int		class_tick;
+
+	/* thread was added by autoscaling and retires when idle */
+	int			elastic;
+};
+
+/*
+ * Pool is grown when all threads are busy and nothing was dequeued for this long,
+ * no more than one thread is added per this interval
+ */
+#define DNET_IO_SCALE_WAIT_USECS	20000
+#define DNET_IO_IDLE_TIMEOUT_DEFAULT	30
+
+/*
+ * Weighted class schedule is built from weights capped by DNET_IO_CLASS_WEIGHT_MAX
+ */
+#define DNET_IO_CLASS_WEIGHT_MAX	64
+
+struct dnet_io_classes {
+	/* number of classes, 1 means all requests go to single FIFO */
+	int			num;
+	int			weight[DNET_IO_CLASS_MAX];
+	int			limit[DNET_IO_CLASS_MAX];
+};
+
+struct dnet_io_class_stat {
+	volatile unsigned long	wait_usecs;
+	volatile unsigned long	dequeued;
+	char			pad[64 - 2 * sizeof(unsigned long)];
 };
 
 struct dnet_work_pool {
@@ -330,10 +816,73 @@ struct dnet_work_pool {
 	int			mode;
 	int			num;
 	atomic_t		avail;
-	struct list_head	list;
+
+	/*
+	 * Per-class queues, threads pick class to serve from weighted round-robin schedule
+	 * and fall back to other classes if that one is empty or has reached its busy thread limit.
+	 * In work-stealing mode only DNET_IO_CLASS_READ requests go to per-thread queues.
+	 */
+	struct dnet_io_classes	classes;
+	struct dnet_io_queue	queues[DNET_IO_CLASS_MAX];
+	atomic_t		class_active[DNET_IO_CLASS_MAX];
+	struct dnet_io_class_stat	class_stat[DNET_IO_CLASS_MAX];
+	int			schedule_num;
+	unsigned char		schedule[DNET_IO_CLASS_MAX * DNET_IO_CLASS_WEIGHT_MAX];
+
+	/*
+	 * Admission control: requests (except replies) are rejected when pool has @queue_max requests
+	 * or @queue_max_bytes bytes queued, zero means no limit
+	 */
+	int			queue_max;
+	unsigned long		queue_max_bytes;
+	volatile long		queued;
+	volatile long		queued_bytes;
+	volatile unsigned long	rejected;
+
+	/* requests dropped by IO threads, since their deadline has passed */
+	volatile unsigned long	expired;
+
+	/*
+	 * Autoscaling: pool has between @min and @max threads,
+	 * @last_dequeue and @last_grow are monotonic usecs
+	 */
+	int			min, max;
+	int			idle_timeout;
+	volatile uint64_t	last_dequeue;
+	volatile uint64_t	last_grow;
+	volatile unsigned long	grown_wait;
+	volatile unsigned long	grown_blocked;
+	volatile unsigned long	retired;
+
+	/* number of queued exec requests with DNET_SPH_FLAGS_SRC_BLOCK flag */
+	atomic_t		queued_blocked_sph;
+
+	/*
+	 * Requests which did not fit into full class queue, in arrival order.
+	 * States of parked requests do not receive until IO threads make room and requeue them.
+	 */
+	struct dnet_lock	parked_lock;
+	struct list_head	parked;
+	volatile int		parked_num;
+
+	/*
+	 * Idle threads park on @wake_seq futex,
+	 * producer wakes a single thread only when @sleepers is not zero.
+	 */
+	volatile int		sleepers;
+	volatile int		wake_seq;
+
+	/* protects @wio_list and @num */
 	pthread_mutex_t		lock;
-	pthread_cond_t		wait;
 	struct list_head	wio_list;
+
+	/*
+	 * Work-stealing mode: threads with own queues,
+	 * array is only appended to, so it can be read without locks.
+	 */
+	int			work_stealing;
+	volatile int		wio_num;
+	struct dnet_work_io	*wio_array[DNET_WORK_POOL_MAX_THREADS];
 };
 
 struct dnet_io {
@@ -347,22 +896,68 @@ struct dnet_io {
 };
 
 int dnet_state_accept_process(struct dnet_net_state *st, struct epoll_event *ev);
+int dnet_io_listen_reuseport_open(struct dnet_node *n, struct dnet_config *cfg, int *s, int *socks);
+void dnet_io_listen_reuseport(struct dnet_node *n, int *socks, int num);
 int dnet_state_net_process(struct dnet_net_state *st, struct epoll_event *ev);
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg);
 void dnet_io_exit(struct dnet_node *n);
+void dnet_io_pool_stat(struct dnet_node *n, struct dnet_stat_count *count);
 
 void dnet_io_req_free(struct dnet_io_req *r);
 
+/*
+ * Operation locks are striped reader/writer locks, commands which do not modify
+ * objects (READ, LOOKUP, STAT) take them in shared mode, the rest - in exclusive.
+ * Every stripe accounts number of contended acquisitions and time spent waiting.
+ */
+struct dnet_lock_stripe {
+	pthread_rwlock_t	lock;
+	uint64_t		waits;
+	uint64_t		wait_usecs;
+} __attribute__ ((aligned(64)));
+
 struct dnet_locks {
 	int			num;
-	pthread_mutex_t		lock[0];
+	struct dnet_lock_stripe	lock[0];
 };
 
 void dnet_locks_destroy(struct dnet_node *n);
 int dnet_locks_init(struct dnet_node *n, int num);
-void dnet_oplock(struct dnet_node *n, struct dnet_id *key);
-void dnet_opunlock(struct dnet_node *n, struct dnet_id *key);
-int dnet_optrylock(struct dnet_node *n, struct dnet_id *key);
+void dnet_locks_stat(struct dnet_node *n, struct dnet_stat_count *count);
+unsigned int dnet_oplock(struct dnet_node *n, struct dnet_id *key, int shared);
+void dnet_opunlock(struct dnet_node *n, unsigned int idx);
+int dnet_optrylock(struct dnet_node *n, struct dnet_id *key, unsigned int *idx);
+
+/*
+ * Thread classes, which may be pinned to CPU sets
+ */
+enum dnet_thread_class {
+	DNET_THREAD_NET = 0,
+	DNET_THREAD_IO,
+	DNET_THREAD_NONBLOCKING_IO,
+	DNET_THREAD_CHECK,
+	DNET_THREAD_CLASS_MAX,
+};
+
+#define DNET_CPU_SET_MAX		1024
+#define DNET_CPU_SET_LONGS		(DNET_CPU_SET_MAX / (8 * sizeof(unsigned long)))
+
+struct dnet_cpu_set {
+	/* number of CPUs in the set, thread is not pinned if it is zero */
+	int			num;
+	unsigned long		mask[DNET_CPU_SET_LONGS];
+};
+
+/*
+ * Counters are incremented by many threads at once, so every thread updates its own shard
+ * (threads are spread over DNET_COUNTER_SHARDS shards round-robin), and shards are summed up
+ * only when statistics are requested.
+ */
+#define DNET_COUNTER_SHARDS		32
+
+struct dnet_counter_shard {
+	struct dnet_stat_count	counters[__DNET_CNTR_MAX];
+} __attribute__ ((aligned(64)));
 
 struct dnet_node
 {
@@ -401,6 +996,8 @@ struct dnet_node
 	int			error;
 
 	struct dnet_log		*log;
+	struct dnet_log_async	*log_async;
+	struct dnet_trace_log	*trace;
 
 	struct dnet_wait	*wait;
 	struct timespec		wait_ts;
@@ -425,8 +1022,19 @@ struct dnet_node
 	pthread_mutex_t		reconnect_lock;
 	struct list_head	reconnect_list;
 
+	/* values set by dnet_counter_set(), incremented counters live in per-thread shards */
 	struct dnet_lock	counters_lock;
 	struct dnet_stat_count	counters[__DNET_CNTR_MAX];
+	struct dnet_counter_shard	counter_shards[DNET_COUNTER_SHARDS];
+
+	struct dnet_route_table	* volatile route;
+	volatile int		route_gp;
+	struct dnet_route_reader	route_readers[DNET_COUNTER_SHARDS];
+
+	/* route table epoch, protected by state_lock, and route table check statistics */
+	volatile uint64_t	route_epoch;
+	unsigned long		route_sync;
+	unsigned long		route_sync_skipped;
 
 	int			bg_ionice_class;
 	int			bg_ionice_prio;
@@ -443,6 +1051,11 @@ struct dnet_node
 
 	size_t			cache_size;
 	void			*cache;
+
+	struct dnet_cpu_set	thread_cpus[DNET_THREAD_CLASS_MAX];
+	atomic_t		threads_pinned;
+	atomic_t		threads_pin_failed;
+	atomic_t		thread_cpu_moves;
 };
 
 
@@ -452,9 +1065,53 @@ struct dnet_session {
 	int *groups;
 };
 
+/*
+ * Shards may be shared by several threads and per-state counters are updated by all IO threads,
+ * so increments are atomic and counters can be read at any time.
+ */
+static inline void dnet_stat_count_inc(struct dnet_stat_count *c, int err)
+{
+	if (!err)
+		__sync_add_and_fetch(&c->count, 1);
+	else
+		__sync_add_and_fetch(&c->err, 1);
+}
+
+static inline void dnet_state_stat_inc(struct dnet_net_state *st, int cmd, int err)
+{
+	if (cmd >= __DNET_CMD_MAX)
+		cmd = DNET_CMD_UNKNOWN;
+
+	dnet_stat_count_inc(&st->stat[cmd], err);
+}
+
+int dnet_counter_shard_index(void);
+void dnet_counter_sum(struct dnet_node *n, struct dnet_stat_count *count);
+
+/*
+ * Route table read-side section: returned counter must be passed to dnet_route_read_unlock(),
+ * @n->route may be dereferenced in between, states found there must be grabbed
+ * with dnet_state_get() before leaving the section. Sections must not take state_lock.
+ */
+static inline volatile int *dnet_route_read_lock(struct dnet_node *n)
+{
+	struct dnet_route_reader *r = &n->route_readers[dnet_counter_shard_index()];
+	volatile int *count = &r->count[n->route_gp & 1];
+
+	/* full barrier: updater either sees this reader or reader sees the new table */
+	__sync_add_and_fetch(count, 1);
+	return count;
+}
+
+static inline void dnet_route_read_unlock(volatile int *count)
+{
+	__sync_sub_and_fetch(count, 1);
+}
+
 static inline int dnet_counter_init(struct dnet_node *n)
 {
 	memset(&n->counters, 0, __DNET_CNTR_MAX * sizeof(struct dnet_stat_count));
+	memset(&n->counter_shards, 0, sizeof(n->counter_shards));
 	return dnet_lock_init(&n->counters_lock);
 }
 
@@ -468,17 +1125,9 @@ static inline void dnet_counter_inc(struct dnet_node *n, int counter, int err)
 	if (counter >= __DNET_CNTR_MAX)
 		counter = DNET_CNTR_UNKNOWN;
 
-	dnet_lock_lock(&n->counters_lock);
-	if (!err)
-		n->counters[counter].count++;
-	else
-		n->counters[counter].err++;
-	dnet_lock_unlock(&n->counters_lock);
+	dnet_stat_count_inc(&n->counter_shards[dnet_counter_shard_index()].counters[counter], err);
 
-	dnet_log(n, DNET_LOG_DEBUG, "Incrementing counter: %d, err: %d, value is: %llu %llu.\n",
-				counter, err,
-				(unsigned long long)n->counters[counter].count,
-				(unsigned long long)n->counters[counter].err);
+	dnet_log(n, DNET_LOG_DEBUG, "Incrementing counter: %d, err: %d.\n", counter, err);
 }
 
 static inline void dnet_counter_set(struct dnet_node *n, int counter, int err, int64_t val)
@@ -508,7 +1157,39 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r);
 int dnet_recv(struct dnet_net_state *st, void *data, unsigned int size);
 int dnet_sendfile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t size);
 
-int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r);
+/*
+ * Maximum number of vectors and bytes gathered into single sendmsg() call
+ */
+#define DNET_SEND_IOV_MAX		64
+#define DNET_SEND_BATCH_BYTES		(1024 * 1024)
+
+/*
+ * Frames up to this size without file body go through the fast lane.
+ * File bodies are sent in slices of DNET_SEND_FILE_SLICE bytes, so that
+ * network thread could serve other connections in between. Replies to requests
+ * with DNET_FLAGS_SLICE_OK are split into frames of the same size, so that
+ * fast lane frames could be sent between them.
+ */
+#define DNET_SEND_FAST_SIZE		4096
+#define DNET_SEND_FILE_SLICE		(1024 * 1024)
+
+struct dnet_send_batch {
+	struct iovec		iov[DNET_SEND_IOV_MAX];
+	int			iov_num;
+
+	struct dnet_io_req	*reqs[DNET_SEND_IOV_MAX];
+	int			req_num;
+
+	size_t			total;
+
+	/* request with file body, it is always the last one in the batch */
+	struct dnet_io_req	*fd_req;
+};
+
+int dnet_send_batch_gather(struct dnet_net_state *st, struct dnet_send_batch *b);
+int dnet_send_batch_advance(struct dnet_net_state *st, struct dnet_send_batch *b, size_t sent);
+void dnet_send_request_complete(struct dnet_net_state *st, struct dnet_io_req *r);
+int dnet_send_batch(struct dnet_net_state *st);
 
 struct dnet_config;
 int dnet_socket_create(struct dnet_node *n, struct dnet_config *cfg, struct dnet_addr *addr, int listening);
@@ -527,10 +1208,15 @@ int __attribute__((weak)) dnet_state_join_nolock(struct dnet_net_state *st);
 
 struct dnet_trans
 {
-	struct rb_node			trans_entry;
-	struct list_head		trans_list_entry;
+	/* transaction is in trans_table of @st */
+	int				hashed;
 
-	struct timeval			time, start;
+	/* timeout, armed and cancelled under trans_lock of @st */
+	struct dnet_timer		timer;
+	struct dnet_timer_wheel		*wheel;
+
+	/* monotonic usecs */
+	uint64_t			start;
 
 	struct dnet_net_state		*orig; /* only for forward */
 
@@ -553,6 +1239,13 @@ struct dnet_trans *dnet_trans_alloc(struct dnet_node *n, uint64_t size);
 int dnet_trans_alloc_send_state(struct dnet_net_state *st, struct dnet_trans_control *ctl);
 int dnet_trans_timer_setup(struct dnet_trans *t);
 
+/* must be called under trans_lock of transaction's state */
+static inline void dnet_trans_timer_cancel(struct dnet_trans *t)
+{
+	if (t->wheel)
+		dnet_timer_cancel(t->wheel, &t->timer);
+}
+
 static inline struct dnet_trans *dnet_trans_get(struct dnet_trans *t)
 {
 	atomic_inc(&t->refcnt);
@@ -565,10 +1258,11 @@ static inline void dnet_trans_put(struct dnet_trans *t)
 		dnet_trans_destroy(t);
 }
 
-int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a);
+int dnet_trans_insert_nolock(struct dnet_trans_table *tt, struct dnet_trans *a);
 void dnet_trans_remove(struct dnet_trans *t);
-void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t);
-struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans);
+void dnet_trans_remove_nolock(struct dnet_trans_table *tt, struct dnet_trans *t);
+struct dnet_trans *dnet_trans_search(struct dnet_trans_table *tt, uint64_t trans);
+void dnet_trans_table_destroy(struct dnet_trans_table *tt);
 
 int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req);
 
@@ -577,6 +1271,8 @@ int dnet_recv_list(struct dnet_node *n, struct dnet_net_state *st);
 ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 		int fd, uint64_t offset, uint64_t dsize, int close_on_exit);
 ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize);
+ssize_t dnet_send_data_nocopy(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize,
+		void (* release)(void *priv), void *priv);
 ssize_t dnet_send(struct dnet_net_state *st, void *data, uint64_t size);
 ssize_t dnet_send_nolock(struct dnet_net_state *st, void *data, uint64_t size);
 
@@ -704,6 +1400,13 @@ int dnet_set_name(char *name);
 int dnet_ioprio_set(long pid, int class_id, int prio);
 int dnet_ioprio_get(long pid);
 
+int dnet_futex_wait(volatile int *addr, int val, long timeout_ms);
+int dnet_futex_wake(volatile int *addr, int num);
+
+int dnet_cpu_set_parse(struct dnet_cpu_set *set, const char *list);
+int dnet_thread_pin(struct dnet_node *n, enum dnet_thread_class cls);
+void dnet_thread_cpu_check(struct dnet_node *n, int *last_cpu);
+
 struct dnet_map_fd {
 	int			fd;
 	uint64_t		offset, size;
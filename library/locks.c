@@ -13,10 +13,14 @@
  * GNU General Public License for more details.
  */
 
+#define _GNU_SOURCE
+
 #include <sys/stat.h>
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -29,7 +33,7 @@ void dnet_locks_destroy(struct dnet_node *n)
 
 	if (n->locks) {
 		for (i = 0; i < n->locks->num; ++i) {
-			pthread_mutex_destroy(&n->locks->lock[i]);
+			pthread_rwlock_destroy(&n->locks->lock[i].lock);
 		}
 
 		free(n->locks);
@@ -39,68 +43,138 @@ void dnet_locks_destroy(struct dnet_node *n)
 
 int dnet_locks_init(struct dnet_node *n, int num)
 {
+	pthread_rwlockattr_t attr;
+	struct dnet_locks *locks;
 	int err, i;
 
-	n->locks = malloc(sizeof(struct dnet_locks) + num * sizeof(pthread_mutex_t));
-	if (!n->locks) {
-		err = -ENOMEM;
+	err = posix_memalign((void **)&locks, sizeof(struct dnet_lock_stripe),
+			sizeof(struct dnet_locks) + num * sizeof(struct dnet_lock_stripe));
+	if (err) {
+		err = -err;
 		goto err_out_exit;
 	}
 
-	n->locks->num = num;
+	memset(locks, 0, sizeof(struct dnet_locks) + num * sizeof(struct dnet_lock_stripe));
+	n->locks = locks;
+
+	err = pthread_rwlockattr_init(&attr);
+	if (err) {
+		err = -err;
+		goto err_out_free;
+	}
+
+	/* writes to hot keys must not be starved by the stream of reads */
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
 
 	for (i = 0; i < num; ++i) {
-		err = pthread_mutex_init(&n->locks->lock[i], NULL);
+		err = pthread_rwlock_init(&locks->lock[i].lock, &attr);
 		if (err) {
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Could not create lock %d/%d: %s [%d]\n", i, num, strerror(-err), err);
-
-			n->locks->num = i;
 			goto err_out_destroy;
 		}
+
+		locks->num = i + 1;
 	}
 
+	pthread_rwlockattr_destroy(&attr);
 	return 0;
 
 err_out_destroy:
+	pthread_rwlockattr_destroy(&attr);
 	dnet_locks_destroy(n);
+	goto err_out_exit;
+err_out_free:
+	free(locks);
+	n->locks = NULL;
 err_out_exit:
 	return err;
 }
 
+/*
+ * Object ids are usually hashes, but clients may pick arbitrary ones,
+ * so every word of the id is mixed in (murmur3 finalizer) instead of plain XOR.
+ */
 static unsigned int dnet_ophash_index(struct dnet_node *n, struct dnet_id *key)
 {
-	unsigned int *ptr = (unsigned int *)key->id;
-	unsigned int h = 0;
+	uint64_t *ptr = (uint64_t *)key->id;
+	uint64_t h = key->group_id;
 	unsigned int i;
 
-	for (i = 0; i < sizeof(key->id) / sizeof(unsigned int); ++i) {
+	for (i = 0; i < sizeof(key->id) / sizeof(uint64_t); ++i) {
 		h ^= ptr[i];
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
 	}
 
 	return h % n->locks->num;
 }
 
-void dnet_oplock(struct dnet_node *n, struct dnet_id *key)
+/*
+ * Returns index of the locked stripe, it has to be passed to dnet_opunlock(),
+ * since command handlers may rewrite the key (like group_id) while lock is held.
+ */
+unsigned int dnet_oplock(struct dnet_node *n, struct dnet_id *key, int shared)
 {
 	unsigned int idx = dnet_ophash_index(n, key);
+	struct dnet_lock_stripe *s = &n->locks->lock[idx];
+	uint64_t start;
+	int err;
+
+	if (shared)
+		err = pthread_rwlock_tryrdlock(&s->lock);
+	else
+		err = pthread_rwlock_trywrlock(&s->lock);
+	if (!err)
+		return idx;
+
+	start = dnet_io_now_usecs();
+
+	if (shared)
+		pthread_rwlock_rdlock(&s->lock);
+	else
+		pthread_rwlock_wrlock(&s->lock);
 
-	pthread_mutex_lock(&n->locks->lock[idx]);
+	__sync_add_and_fetch(&s->waits, 1);
+	__sync_add_and_fetch(&s->wait_usecs, dnet_io_now_usecs() - start);
+	return idx;
 }
 
-void dnet_opunlock(struct dnet_node *n, struct dnet_id *key)
+void dnet_opunlock(struct dnet_node *n, unsigned int idx)
 {
-	unsigned int idx = dnet_ophash_index(n, key);
-
-	pthread_mutex_unlock(&n->locks->lock[idx]);
+	pthread_rwlock_unlock(&n->locks->lock[idx].lock);
 }
 
-int dnet_optrylock(struct dnet_node *n, struct dnet_id *key)
+int dnet_optrylock(struct dnet_node *n, struct dnet_id *key, unsigned int *idx)
 {
-	unsigned int idx = dnet_ophash_index(n, key);
 	int err;
 
-	err = pthread_mutex_trylock(&n->locks->lock[idx]);
+	*idx = dnet_ophash_index(n, key);
+
+	err = pthread_rwlock_trywrlock(&n->locks->lock[*idx].lock);
 	return err;
 }
 
+void dnet_locks_stat(struct dnet_node *n, struct dnet_stat_count *count)
+{
+	struct dnet_lock_stripe *s;
+	int i;
+
+	if (!n->locks)
+		return;
+
+	for (i = 0; i < n->locks->num; ++i) {
+		s = &n->locks->lock[i];
+
+		count[DNET_CNTR_OPLOCK_WAIT].count += s->waits;
+		count[DNET_CNTR_OPLOCK_WAIT].err += s->wait_usecs;
+
+		if (s->wait_usecs > count[DNET_CNTR_OPLOCK_WAIT_MAX].count) {
+			count[DNET_CNTR_OPLOCK_WAIT_MAX].count = s->wait_usecs;
+			count[DNET_CNTR_OPLOCK_WAIT_MAX].err = i;
+		}
+	}
+}
@@ -21,6 +21,7 @@
 #include <sys/syscall.h>
 
 #include <errno.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <stdarg.h>
@@ -42,19 +43,329 @@ int dnet_log_init(struct dnet_node *n, struct dnet_log *l)
 	return 0;
 }
 
+/*
+ * Asynchronous logging.
+ *
+ * Every thread which logs into the node gets its own ring on the first message,
+ * so producers never contend with each other. Ring is a single-producer/single-consumer
+ * byte buffer of variable sized records, record which does not fit into the tail
+ * of the buffer is preceded by a padding record and placed at its beginning.
+ *
+ * Writer thread is the only consumer, it walks all rings and calls dnet_log callback,
+ * so callback does not have to be thread-safe anymore and never blocks IO threads.
+ * When ring is full, message is dropped and accounted, writer periodically reports drops.
+ *
+ * Rings of exited threads are marked dead by pthread key destructor and freed by the writer.
+ */
+
+static int dnet_log_ring_put(struct dnet_log_ring *r, int level, const char *msg, int len)
+{
+	unsigned int need = ALIGN(sizeof(struct dnet_log_record) + len + 1, 8);
+	unsigned int pos = r->head & (r->size - 1);
+	unsigned int pad = 0;
+	uint64_t head = r->head;
+	struct dnet_log_record *rec;
+
+	if (pos + need > r->size)
+		pad = r->size - pos;
+
+	if (head + pad + need - r->tail > r->size)
+		return -ENOSPC;
+
+	if (pad) {
+		rec = (struct dnet_log_record *)(r->data + pos);
+		rec->size = pad;
+		rec->level = -1;
+
+		head += pad;
+		pos = 0;
+	}
+
+	rec = (struct dnet_log_record *)(r->data + pos);
+	rec->size = need;
+	rec->level = level;
+	memcpy(rec->msg, msg, len);
+	rec->msg[len] = '\0';
+
+	/* record must be visible before the writer sees new head */
+	__sync_synchronize();
+	r->head = head + need;
+
+	return 0;
+}
+
+static int dnet_log_ring_drain(struct dnet_log *l, struct dnet_log_ring *r)
+{
+	uint64_t head = r->head, tail = r->tail;
+	struct dnet_log_record *rec;
+	int num = 0;
+
+	__sync_synchronize();
+
+	while (tail != head) {
+		rec = (struct dnet_log_record *)(r->data + (tail & (r->size - 1)));
+		if (rec->level >= 0) {
+			l->log(l->log_private, rec->level, rec->msg);
+			num++;
+		}
+
+		tail += rec->size;
+
+		__sync_synchronize();
+		r->tail = tail;
+	}
+
+	return num;
+}
+
+static void dnet_log_ring_release(void *data)
+{
+	struct dnet_log_ring *r = data;
+
+	__sync_synchronize();
+	r->dead = 1;
+}
+
+static struct dnet_log_ring *dnet_log_ring_get(struct dnet_log_async *a)
+{
+	struct dnet_log_ring *r;
+
+	r = pthread_getspecific(a->key);
+	if (r)
+		return r;
+
+	r = malloc(sizeof(struct dnet_log_ring) + a->ring_size);
+	if (!r)
+		return NULL;
+
+	memset(r, 0, sizeof(struct dnet_log_ring));
+	r->size = a->ring_size;
+
+	if (pthread_setspecific(a->key, r)) {
+		free(r);
+		return NULL;
+	}
+
+	do {
+		r->next = a->pending;
+	} while (!__sync_bool_compare_and_swap(&a->pending, r->next, r));
+
+	return r;
+}
+
+static int dnet_log_async_put(struct dnet_log_async *a, int level, const char *msg, int len)
+{
+	struct dnet_log_ring *r;
+
+	r = dnet_log_ring_get(a);
+	if (!r)
+		return -ENOMEM;
+
+	if (dnet_log_ring_put(r, level, msg, len)) {
+		atomic_inc(&a->dropped);
+		return 0;
+	}
+
+	__sync_synchronize();
+	if (a->sleeping) {
+		__sync_add_and_fetch(&a->wake_seq, 1);
+		dnet_futex_wake(&a->wake_seq, 1);
+	}
+
+	return 0;
+}
+
+static int dnet_log_async_idle(struct dnet_log_async *a)
+{
+	struct dnet_log_ring *r;
+
+	if (a->pending || a->need_exit)
+		return 0;
+
+	for (r = a->rings; r; r = r->next) {
+		if (r->head != r->tail)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void *dnet_log_async_process(void *data)
+{
+	struct dnet_log_async *a = data;
+	struct dnet_log *l = a->n->log;
+	struct dnet_log_ring *r, **prev, *pending;
+	int seq, num, dead, need_exit, dropped, reported = 0;
+	char buf[128];
+
+	dnet_set_name("dnet_log");
+
+	while (1) {
+		seq = a->wake_seq;
+		need_exit = a->need_exit;
+
+		pending = __sync_lock_test_and_set(&a->pending, NULL);
+		while (pending) {
+			r = pending;
+			pending = r->next;
+
+			r->next = a->rings;
+			a->rings = r;
+		}
+
+		num = 0;
+		prev = &a->rings;
+		while ((r = *prev) != NULL) {
+			/* everything written before thread has exited is drained below */
+			dead = r->dead;
+			__sync_synchronize();
+
+			num += dnet_log_ring_drain(l, r);
+
+			if (dead) {
+				*prev = r->next;
+				free(r);
+				continue;
+			}
+
+			prev = &r->next;
+		}
+
+		dropped = atomic_read(&a->dropped);
+		if (dropped != reported) {
+			snprintf(buf, sizeof(buf), "Log rings overflow: %d messages dropped, %d total.\n",
+					dropped - reported, dropped);
+			l->log(l->log_private, DNET_LOG_ERROR, buf);
+			reported = dropped;
+		}
+
+		if (num)
+			continue;
+
+		if (need_exit)
+			break;
+
+		a->sleeping = 1;
+		__sync_synchronize();
+
+		if (dnet_log_async_idle(a))
+			dnet_futex_wait(&a->wake_seq, seq, DNET_LOG_WRITER_WAIT_MS);
+
+		a->sleeping = 0;
+	}
+
+	return NULL;
+}
+
+int dnet_log_async_start(struct dnet_node *n, int ring_kb)
+{
+	struct dnet_log_async *a;
+	unsigned int size;
+	int err;
+
+	if (!n->log || !n->log->log || ring_kb <= 0)
+		return 0;
+
+	a = malloc(sizeof(struct dnet_log_async));
+	if (!a) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(a, 0, sizeof(struct dnet_log_async));
+
+	for (size = DNET_LOG_RING_MIN; size < (unsigned int)ring_kb * 1024; size <<= 1)
+		;
+
+	a->n = n;
+	a->ring_size = size;
+	atomic_init(&a->dropped, 0);
+
+	err = pthread_key_create(&a->key, dnet_log_ring_release);
+	if (err) {
+		err = -err;
+		goto err_out_free;
+	}
+
+	err = pthread_create(&a->tid, NULL, dnet_log_async_process, a);
+	if (err) {
+		err = -err;
+		goto err_out_key_delete;
+	}
+
+	n->log_async = a;
+
+	dnet_log(n, DNET_LOG_INFO, "Started asynchronous logging, per-thread ring size: %u bytes.\n", size);
+	return 0;
+
+err_out_key_delete:
+	pthread_key_delete(a->key);
+err_out_free:
+	free(a);
+err_out_exit:
+	dnet_log(n, DNET_LOG_ERROR, "Failed to start asynchronous logging: %s [%d]\n", strerror(-err), err);
+	return err;
+}
+
+/*
+ * Must be called when node threads are stopped, writer drains all rings before exit,
+ * the rest of messages are logged synchronously.
+ */
+void dnet_log_async_stop(struct dnet_node *n)
+{
+	struct dnet_log_async *a = n->log_async;
+	struct dnet_log_ring *r;
+
+	if (!a)
+		return;
+
+	n->log_async = NULL;
+
+	a->need_exit = 1;
+	__sync_add_and_fetch(&a->wake_seq, 1);
+	dnet_futex_wake(&a->wake_seq, 1);
+
+	pthread_join(a->tid, NULL);
+
+	pthread_key_delete(a->key);
+
+	while ((r = a->rings) != NULL) {
+		a->rings = r->next;
+		free(r);
+	}
+
+	while ((r = a->pending) != NULL) {
+		a->pending = r->next;
+		free(r);
+	}
+
+	free(a);
+}
+
 void dnet_log_raw(struct dnet_node *n, int level, const char *format, ...)
 {
 	va_list args;
 	char buf[1024];
 	struct dnet_log *l = n->log;
+	struct dnet_log_async *a = n->log_async;
 	int buflen = sizeof(buf);
+	int len;
 
 	if (!l->log || (l->log_level < level))
 		return;
 
 	va_start(args, format);
-	vsnprintf(buf, buflen, format, args);
+	len = vsnprintf(buf, buflen, format, args);
+	va_end(args);
+
 	buf[buflen-1] = '\0';
+	if (len < 0)
+		return;
+	if (len >= buflen)
+		len = buflen - 1;
+
+	if (a && !dnet_log_async_put(a, level, buf, len))
+		return;
+
 	l->log(l->log_private, level, buf);
-	va_end(args);
 }
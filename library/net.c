@@ -123,6 +123,10 @@ int dnet_socket_create_addr(struct dnet_node *n, int sock_type, int proto, int f
 	if (listening) {
 		err = 1;
 		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &err, 4);
+#ifdef SO_REUSEPORT
+		if (n->flags & DNET_CFG_REUSEPORT)
+			setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &err, 4);
+#endif
 
 		err = bind(s, sa, salen);
 		if (err) {
@@ -231,53 +235,243 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * The whole table is detached at once, transactions are released without state lock held,
+ * since their completion callbacks may send new requests through this state.
+ */
 static void dnet_state_clean(struct dnet_net_state *st)
 {
-	struct rb_node *rb_node;
+	struct dnet_trans_table tt;
 	struct dnet_trans *t;
+	unsigned long i;
 	int num = 0;
 
-	while (1) {
-		t = NULL;
+	pthread_mutex_lock(&st->trans_lock);
+	tt = st->trans_table;
+	memset(&st->trans_table, 0, sizeof(struct dnet_trans_table));
 
-		pthread_mutex_lock(&st->trans_lock);
-		rb_node = rb_first(&st->trans_root);
-		if (rb_node) {
-			t = rb_entry(rb_node, struct dnet_trans, trans_entry);
-			dnet_trans_get(t);
-			dnet_trans_remove_nolock(&st->trans_root, t);
-			list_del_init(&t->trans_list_entry);
-		}
-		pthread_mutex_unlock(&st->trans_lock);
+	for (i = 0; tt.slots && i <= tt.mask; ++i) {
+		t = tt.slots[i];
+		if (!t)
+			continue;
 
+		t->hashed = 0;
+		dnet_trans_timer_cancel(t);
+	}
+	pthread_mutex_unlock(&st->trans_lock);
+
+	for (i = 0; tt.slots && i <= tt.mask; ++i) {
+		t = tt.slots[i];
 		if (!t)
-			break;
+			continue;
 
-		dnet_trans_put(t);
 		dnet_trans_put(t);
 		num++;
 	}
 
+	dnet_trans_table_destroy(&tt);
+
 	dnet_log(st->n, DNET_LOG_NOTICE, "Cleaned state %s, transactions freed: %d\n", dnet_state_dump_addr(st), num);
 }
 
+static struct dnet_cmd *dnet_io_req_cmd(struct dnet_io_req *r)
+{
+	if (r->header && r->hsize >= sizeof(struct dnet_cmd))
+		return r->header;
+	if (!r->hsize && r->data && r->dsize >= sizeof(struct dnet_cmd))
+		return r->data;
+	return NULL;
+}
+
+/*
+ * Checks whether request may go through the fast lane. Replies of the same transaction must not be reordered,
+ * so small frame is queued into bulk list if a frame of the same transaction may be already there.
+ * Bulk list frames are counted per transaction hash, collisions only send small frame through the bulk list.
+ * Request which is not fast is accounted in its counter.
+ * Must be called with send lock held.
+ */
+static int dnet_io_req_fast(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd;
+	int *bulk;
+
+	cmd = dnet_io_req_cmd(r);
+
+	/* command is in network byte order, hash does not have to match host order one */
+	bulk = cmd ? &st->send_bulk[cmd->trans % DNET_SEND_TRANS_HASH] : &st->send_bulk_raw;
+
+	if (cmd && !(r->fd >= 0 && r->fsize) && (r->hsize + r->dsize <= DNET_SEND_FAST_SIZE) &&
+			!*bulk && !st->send_bulk_raw)
+		return 1;
+
+	r->send_bulk = bulk;
+	(*bulk)++;
+	return 0;
+}
+
+/*
+ * Checks whether reply with file body should be split into slices, i.e. its body is large
+ * and it was requested with DNET_FLAGS_SLICE_OK. Command in @r->header is in network byte order.
+ */
+static int dnet_io_req_sliced(struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+
+	if (r->fd < 0 || r->fsize <= DNET_SEND_FILE_SLICE || r->dsize || !r->header || r->hsize < sizeof(struct dnet_cmd))
+		return 0;
+
+	return (cmd->trans & dnet_bswap64(DNET_TRANS_REPLY)) && (cmd->flags & dnet_bswap64(DNET_FLAGS_SLICE_OK));
+}
+
+/*
+ * Splits reply with large file body into frames with at most DNET_SEND_FILE_SLICE bytes of the body.
+ * Every frame starts its attached data with struct dnet_slice, the rest of @orig header goes into the first one.
+ * Descriptor is closed by the last slice, which also carries the trace of the whole reply.
+ * Slices are appended to @list.
+ */
+static int dnet_io_req_slice(struct dnet_io_req *orig, struct list_head *list)
+{
+	struct dnet_cmd *cmd;
+	struct dnet_slice *sl;
+	struct dnet_io_req *r, *tmp;
+	size_t ext = orig->hsize - sizeof(struct dnet_cmd);
+	uint64_t total, offset = 0, foffset = 0, size;
+	int err;
+
+	cmd = orig->header;
+	total = dnet_bswap64(cmd->size);
+
+	while (foffset < orig->fsize) {
+		size = orig->fsize - foffset;
+		if (size > DNET_SEND_FILE_SLICE)
+			size = DNET_SEND_FILE_SLICE;
+
+		r = dnet_io_slab_thread_alloc(sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) +
+				sizeof(struct dnet_slice) + ext);
+		if (!r) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+
+		r->header = r + 1;
+		r->hsize = sizeof(struct dnet_cmd) + sizeof(struct dnet_slice) + ext;
+		r->fd = orig->fd;
+		r->local_offset = orig->local_offset + foffset;
+		r->fsize = size;
+
+		cmd = r->header;
+		memcpy(cmd, orig->header, sizeof(struct dnet_cmd));
+		dnet_convert_cmd(cmd);
+		cmd->flags = (cmd->flags & ~DNET_FLAGS_SLICE_OK) | DNET_FLAGS_SLICE;
+		cmd->size = sizeof(struct dnet_slice) + ext + size;
+		dnet_convert_cmd(cmd);
+
+		sl = (struct dnet_slice *)(cmd + 1);
+		sl->total = total;
+		sl->offset = offset;
+		dnet_convert_slice(sl);
+
+		memcpy(sl + 1, orig->header + sizeof(struct dnet_cmd), ext);
+
+		list_add_tail(&r->req_entry, list);
+
+		offset += ext + size;
+		foffset += size;
+		ext = 0;
+	}
+
+	r->close_on_exit = orig->close_on_exit;
+
+	if (dnet_trace_current) {
+		r->trace = dnet_trace_get(dnet_trace_current);
+		r->trace_span = dnet_trace_begin(DNET_TRACE_SEND);
+	}
+
+	return 0;
+
+err_out_free:
+	list_for_each_entry_safe(r, tmp, list, req_entry) {
+		list_del(&r->req_entry);
+		dnet_io_req_free(r);
+	}
+	return err;
+}
+
+static int dnet_io_req_queue_sliced(struct dnet_net_state *st, struct dnet_io_req *orig)
+{
+	struct dnet_io_req *r, *tmp;
+	LIST_HEAD(slices);
+	int err;
+
+	err = dnet_io_req_slice(orig, &slices);
+	if (err)
+		return err;
+
+	pthread_mutex_lock(&st->send_lock);
+	list_for_each_entry_safe(r, tmp, &slices, req_entry) {
+		list_del(&r->req_entry);
+
+		dnet_io_req_fast(st, r);
+		list_add_tail(&r->req_entry, &st->send_list);
+	}
+
+	if (!st->need_exit)
+		dnet_schedule_send(st);
+	pthread_mutex_unlock(&st->send_lock);
+
+	return 0;
+}
+
+/*
+ * Deadline is placed right after command header as the beginning of attached data,
+ * @header has to have enough space after command for struct dnet_deadline.
+ * Command in @orig->header is in network byte order.
+ */
+static void dnet_io_req_add_deadline(struct dnet_cmd *cmd, struct dnet_io_req *orig)
+{
+	struct dnet_deadline *d = (struct dnet_deadline *)(cmd + 1);
+	uint64_t now = dnet_io_now_usecs();
+
+	memcpy(cmd, orig->header, sizeof(struct dnet_cmd));
+
+	dnet_convert_cmd(cmd);
+	cmd->flags |= DNET_FLAGS_DEADLINE;
+	cmd->size += sizeof(struct dnet_deadline);
+	dnet_convert_cmd(cmd);
+
+	memset(d, 0, sizeof(struct dnet_deadline));
+	d->timeout = orig->deadline > now ? orig->deadline - now : 0;
+	dnet_convert_deadline(d);
+}
+
 /*
- * Eventually we may end up with proper reference counters here, but for now let's just copy the whole buf.
- * Large data blocks are being sent through sendfile anyway, so it should not be _that_ costly operation.
+ * Header is always copied, since it is usually small and allocated on stack.
+ * Data is copied too, unless @orig->data_release is set - in that case data ownership
+ * is passed to the queue and release callback is invoked after data was sent,
+ * or when request is dropped (including queueing failure).
+ *
+ * Large data blocks are being sent through sendfile anyway.
  */
 static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig)
 {
 	void *buf;
 	struct dnet_io_req *r;
 	int offset = 0;
+	size_t dsize = orig->data_release ? 0 : orig->dsize;
+	size_t dsize_ext = 0;
 	int err;
 
-	buf = r = malloc(sizeof(struct dnet_io_req) + orig->dsize + orig->hsize);
+	if (dnet_io_req_sliced(orig))
+		return dnet_io_req_queue_sliced(st, orig);
+
+	if (orig->deadline && orig->hsize >= sizeof(struct dnet_cmd) && (st->n->flags & DNET_CFG_SEND_DEADLINES))
+		dsize_ext = sizeof(struct dnet_deadline);
+
+	buf = r = dnet_io_slab_thread_alloc(sizeof(struct dnet_io_req) + dsize + orig->hsize + dsize_ext);
 	if (!r) {
 		err = -ENOMEM;
-		goto err_out_exit;
+		goto err_out_release;
 	}
-	memset(r, 0, sizeof(struct dnet_io_req));
 	r->fd = -1;
 
 	if (orig->header && orig->hsize) {
@@ -285,15 +479,42 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 		r->hsize = orig->hsize;
 
 		offset = r->hsize;
-		memcpy(r->header, orig->header, r->hsize);
+
+		if (dsize_ext) {
+			dnet_io_req_add_deadline(r->header, orig);
+			memcpy(r->header + sizeof(struct dnet_cmd) + dsize_ext, orig->header + sizeof(struct dnet_cmd),
+					orig->hsize - sizeof(struct dnet_cmd));
+
+			r->hsize += dsize_ext;
+			offset = r->hsize;
+		} else {
+			memcpy(r->header, orig->header, r->hsize);
+		}
+
+		/* header is in network byte order */
+		if (orig->route_epoch && orig->hsize >= sizeof(struct dnet_cmd))
+			((struct dnet_cmd *)r->header)->flags |= dnet_bswap64(DNET_FLAGS_ROUTE_EPOCH);
+
+		if ((st->n->flags & DNET_CFG_SLICED_REPLIES) && orig->hsize >= sizeof(struct dnet_cmd) &&
+				!(((struct dnet_cmd *)r->header)->trans & dnet_bswap64(DNET_TRANS_REPLY)))
+			((struct dnet_cmd *)r->header)->flags |= dnet_bswap64(DNET_FLAGS_SLICE_OK);
 	}
 
 	if (orig->data && orig->dsize) {
-		r->data = buf + sizeof(struct dnet_io_req) + offset;
 		r->dsize = orig->dsize;
-		
-		offset += r->dsize;
-		memcpy(r->data, orig->data, r->dsize);
+
+		if (orig->data_release) {
+			r->data = orig->data;
+			r->data_release = orig->data_release;
+			r->data_priv = orig->data_priv;
+		} else {
+			r->data = buf + sizeof(struct dnet_io_req) + offset;
+
+			offset += r->dsize;
+			memcpy(r->data, orig->data, r->dsize);
+		}
+	} else if (orig->data_release) {
+		orig->data_release(orig->data_priv);
 	}
 
 	if (orig->fd >= 0 && orig->fsize) {
@@ -303,8 +524,16 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 		r->fsize = orig->fsize;
 	}
 
+	if (dnet_trace_current) {
+		r->trace = dnet_trace_get(dnet_trace_current);
+		r->trace_span = dnet_trace_begin(DNET_TRACE_SEND);
+	}
+
 	pthread_mutex_lock(&st->send_lock);
-	list_add_tail(&r->req_entry, &st->send_list);
+	if (dnet_io_req_fast(st, r))
+		list_add_tail(&r->req_entry, &st->send_fast_list);
+	else
+		list_add_tail(&r->req_entry, &st->send_list);
 
 	if (!st->need_exit)
 		dnet_schedule_send(st);
@@ -312,15 +541,21 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 
 	return 0;
 
-err_out_exit:
+err_out_release:
+	if (orig->data_release)
+		orig->data_release(orig->data_priv);
 	return err;
 }
 
 void dnet_io_req_free(struct dnet_io_req *r)
 {
+	if (r->trace)
+		dnet_trace_put(r->trace, r->trace_span);
 	if (r->fd >= 0 && r->fsize && r->close_on_exit)
 		close(r->fd);
-	free(r);
+	if (r->data_release)
+		r->data_release(r->data_priv);
+	dnet_io_slab_free(r);
 }
 
 static int dnet_wait(struct dnet_net_state *st, unsigned int events, long timeout)
@@ -417,7 +652,8 @@ ssize_t dnet_send(struct dnet_net_state *st, void *data, uint64_t size)
 	return dnet_io_req_queue(st, &r);
 }
 
-ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize)
+ssize_t dnet_send_data_nocopy(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize,
+		void (* release)(void *priv), void *priv)
 {
 	struct dnet_io_req r;
 
@@ -427,10 +663,17 @@ ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize,
 	r.data = data;
 	r.dsize = dsize;
 	r.fd = -1;
+	r.data_release = release;
+	r.data_priv = priv;
 
 	return dnet_io_req_queue(st, &r);
 }
 
+ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize)
+{
+	return dnet_send_data_nocopy(st, header, hsize, data, dsize, NULL, NULL);
+}
+
 static ssize_t dnet_send_fd_nolock(struct dnet_net_state *st, int fd, uint64_t offset, uint64_t dsize)
 {
 	ssize_t err;
@@ -470,25 +713,49 @@ ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 	return dnet_io_req_queue(st, &r);
 }
 
-static void dnet_trans_timestamp(struct dnet_net_state *st, struct dnet_trans *t)
+/*
+ * Arms transaction timeout in the wheel of network thread serving @st,
+ * transaction expires at @deadline (monotonic usecs) or after node's wait timeout if it is zero.
+ * Must be called under @st->trans_lock.
+ */
+static void dnet_trans_timestamp(struct dnet_net_state *st, struct dnet_trans *t, uint64_t deadline)
 {
-	gettimeofday(&t->time, NULL);
-	t->time.tv_sec += st->n->wait_ts.tv_sec;
+	struct dnet_node *n = st->n;
+
+	if (!deadline)
+		deadline = dnet_io_now_usecs() + n->wait_ts.tv_sec * 1000000ULL + n->wait_ts.tv_nsec / 1000;
 
-	list_move_tail(&t->trans_list_entry, &st->trans_list);
+	if (!t->wheel)
+		t->wheel = st->nio ? &st->nio->wheel : &n->io->net[0].wheel;
+
+	if (dnet_timer_add(t->wheel, &t->timer, (deadline + 999) / 1000))
+		dnet_io_net_wake(container_of(t->wheel, struct dnet_net_io, wheel));
 }
 
 int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req)
 {
 	struct dnet_net_state *st = req->st;
+	struct dnet_node *n = st->n;
 	int err;
 
+	/*
+	 * Forwarded requests keep deadline received from the client
+	 */
+	if ((n->flags & DNET_CFG_SEND_DEADLINES) && !req->deadline)
+		req->deadline = dnet_io_now_usecs() + n->wait_ts.tv_sec * 1000000ULL;
+
+	/*
+	 * Only route table related requests ask for remote epoch, other replies are not touched
+	 */
+	if ((n->flags & DNET_CFG_ROUTE_EPOCH) && ((t->command == DNET_CMD_ROUTE_LIST) || (t->command == DNET_CMD_LOOKUP)))
+		req->route_epoch = 1;
+
 	dnet_trans_get(t);
 
 	pthread_mutex_lock(&st->trans_lock);
-	err = dnet_trans_insert_nolock(&st->trans_root, t);
+	err = dnet_trans_insert_nolock(&st->trans_table, t);
 	if (!err)
-		dnet_trans_timestamp(st, t);
+		dnet_trans_timestamp(st, t, req->deadline);
 	pthread_mutex_unlock(&st->trans_lock);
 	if (err)
 		goto err_out_put;
@@ -670,13 +937,13 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 		uint64_t tid = cmd->trans & ~DNET_TRANS_REPLY;
 
 		pthread_mutex_lock(&st->trans_lock);
-		t = dnet_trans_search(&st->trans_root, tid);
+		t = dnet_trans_search(&st->trans_table, tid);
 		if (t) {
 			if (!(cmd->flags & DNET_FLAGS_MORE)) {
-				dnet_trans_remove_nolock(&st->trans_root, t);
-				list_del_init(&t->trans_list_entry);
+				dnet_trans_remove_nolock(&st->trans_table, t);
+				dnet_trans_timer_cancel(t);
 			} else
-				dnet_trans_timestamp(st, t);
+				dnet_trans_timestamp(st, t, 0);
 		}
 		pthread_mutex_unlock(&st->trans_lock);
 
@@ -791,6 +1058,10 @@ void dnet_set_sockopt(int s)
 	opt = 10;
 	setsockopt(s, IPPROTO_TCP, TCP_KEEPINTVL, &opt, 4);
 
+	/* frames are coalesced by the batched send path, do not let Nagle delay them */
+	opt = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &opt, 4);
+
 	l.l_onoff = 1;
 	l.l_linger = 1;
 
@@ -807,10 +1078,13 @@ int dnet_setup_control_nolock(struct dnet_net_state *st)
 	int err, pos;
 
 	if (st->epoll_fd == -1) {
-		pos = io->net_thread_pos;
-		if (++io->net_thread_pos >= io->net_thread_num)
-			io->net_thread_pos = 0;
-		st->epoll_fd = io->net[pos].epoll_fd;
+		if (!st->nio) {
+			pos = io->net_thread_pos;
+			if (++io->net_thread_pos >= io->net_thread_num)
+				io->net_thread_pos = 0;
+			st->nio = &io->net[pos];
+		}
+		st->epoll_fd = st->nio->epoll_fd;
 
 		err = dnet_schedule_recv(st);
 		if (err)
@@ -824,6 +1098,7 @@ err_out_unschedule:
 	dnet_unschedule_recv(st);
 
 	st->epoll_fd = -1;
+	st->nio = NULL;
 	list_del_init(&st->storage_state_entry);
 	return err;
 }
@@ -876,10 +1151,15 @@ static int dnet_auth_send(struct dnet_net_state *st)
 	return dnet_trans_alloc_send_state(st, &ctl);
 }
 
-struct dnet_net_state *dnet_state_create(struct dnet_node *n,
+/*
+ * When @nio is not NULL, state is served by given network thread,
+ * otherwise network threads are selected in round-robin manner.
+ */
+struct dnet_net_state *dnet_state_create_nio(struct dnet_node *n,
 		int group_id, struct dnet_raw_id *ids, int id_num,
 		struct dnet_addr *addr, int s, int *errp, int join,
-		int (* process)(struct dnet_net_state *st, struct epoll_event *ev))
+		int (* process)(struct dnet_net_state *st, struct epoll_event *ev),
+		struct dnet_net_io *nio)
 {
 	int err = -ENOMEM;
 	struct dnet_net_state *st;
@@ -920,10 +1200,11 @@ struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 	INIT_LIST_HEAD(&st->state_entry);
 	INIT_LIST_HEAD(&st->storage_state_entry);
 
-	st->trans_root = RB_ROOT;
-	INIT_LIST_HEAD(&st->trans_list);
+	memset(&st->trans_table, 0, sizeof(struct dnet_trans_table));
+	st->trans_timeouts = 0;
 
 	st->epoll_fd = -1;
+	st->nio = nio;
 
 	err = pthread_mutex_init(&st->trans_lock, NULL);
 	if (err) {
@@ -933,6 +1214,7 @@ struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 	}
 
 	INIT_LIST_HEAD(&st->send_list);
+	INIT_LIST_HEAD(&st->send_fast_list);
 	err = pthread_mutex_init(&st->send_lock, NULL);
 	if (err) {
 		err = -err;
@@ -1049,10 +1331,19 @@ static void dnet_state_send_clean(struct dnet_net_state *st)
 {
 	struct dnet_io_req *r, *tmp;
 
+	list_for_each_entry_safe(r, tmp, &st->send_fast_list, req_entry) {
+		list_del(&r->req_entry);
+		dnet_io_req_free(r);
+	}
+
 	list_for_each_entry_safe(r, tmp, &st->send_list, req_entry) {
 		list_del(&r->req_entry);
 		dnet_io_req_free(r);
 	}
+
+	memset(st->send_bulk, 0, sizeof(st->send_bulk));
+	st->send_bulk_raw = 0;
+	st->send_cur = NULL;
 }
 
 void dnet_state_destroy(struct dnet_net_state *st)
@@ -1065,8 +1356,13 @@ void dnet_state_destroy(struct dnet_net_state *st)
 	}
 
 	dnet_state_clean(st);
+	dnet_trans_table_destroy(&st->trans_table);
 
 	dnet_state_send_clean(st);
+	dnet_uring_state_destroy(st);
+
+	if (st->rcv_sliced)
+		dnet_io_req_free(st->rcv_sliced);
 
 	pthread_mutex_destroy(&st->send_lock);
 	pthread_mutex_destroy(&st->trans_lock);
@@ -1077,23 +1373,26 @@ void dnet_state_destroy(struct dnet_net_state *st)
 	free(st);
 }
 
+static void dnet_send_reply_release(void *priv)
+{
+	dnet_io_slab_free(priv);
+}
+
 int dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int size, int more)
 {
 	struct dnet_net_state *st = state;
+	struct dnet_io_req *buf;
 	struct dnet_cmd *c;
-	void *data;
-	int err;
 
 	if (st == st->n->st)
 		return 0;
 
-	c = malloc(sizeof(struct dnet_cmd) + size);
-	if (!c)
+	/* small replies come from per-thread cache, dnet_io_req in front of them is used for release only */
+	buf = dnet_io_slab_thread_alloc(sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) + size);
+	if (!buf)
 		return -ENOMEM;
 
-	memset(c, 0, sizeof(struct dnet_cmd) + size);
-
-	data = c + 1;
+	c = (struct dnet_cmd *)(buf + 1);
 	*c = *cmd;
 
 	if ((cmd->flags & DNET_FLAGS_NEED_ACK) || more)
@@ -1103,49 +1402,19 @@ int dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int
 	c->trans |= DNET_TRANS_REPLY;
 
 	if (size)
-		memcpy(data, odata, size);
+		memcpy(c + 1, odata, size);
 
 	dnet_log(st->n, DNET_LOG_NOTICE, "%s: %s: reply: size: %u, cflags: %llx.\n",
 		dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), size, (unsigned long long)c->flags);
 
 	dnet_convert_cmd(c);
 
-	err = dnet_send(st, c, sizeof(struct dnet_cmd) + size);
-	free(c);
-
-	return err;
+	/* reply buffer is handed over to the send queue, it will be released after it is sent */
+	return dnet_send_data_nocopy(st, NULL, 0, c, sizeof(struct dnet_cmd) + size, dnet_send_reply_release, buf);
 }
 
-int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
+void dnet_send_request_complete(struct dnet_net_state *st, struct dnet_io_req *r)
 {
-	int cork;
-	int err = 0;
-	size_t offset = st->send_offset;
-
-	/* Use TCP_CORK to send headers and packet body in one piece */
-	cork = 1;
-	setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
-
-	if (r->hsize && r->header && st->send_offset < r->hsize) {
-		err = dnet_send_nolock(st, r->header + offset, r->hsize - offset);
-		if (err)
-			goto err_out_exit;
-	}
-
-	if (r->dsize && r->data && st->send_offset < (r->dsize + r->hsize)) {
-		offset = st->send_offset - r->hsize;
-		err = dnet_send_nolock(st, r->data + offset, r->dsize - offset);
-		if (err)
-			goto err_out_exit;
-	}
-
-	if (r->fd >= 0 && r->fsize && st->send_offset < (r->dsize + r->hsize + r->fsize)) {
-		offset = st->send_offset - r->dsize - r->hsize;
-		err = dnet_send_fd_nolock(st, r->fd, r->local_offset + offset, r->fsize - offset);
-		if (err)
-			goto err_out_exit;
-	}
-
 	if (r->hsize > sizeof(struct dnet_cmd)) {
 		struct dnet_cmd *cmd = r->header;
 		int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK);
@@ -1157,24 +1426,212 @@ int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 			(unsigned long long)cmd->size, nonblocking);
 	}
 
-err_out_exit:
-	if (st->send_offset == (r->dsize + r->hsize + r->fsize)) {
-		pthread_mutex_lock(&st->send_lock);
-		list_del(&r->req_entry);
+	pthread_mutex_lock(&st->send_lock);
+	list_del(&r->req_entry);
+	if (r->send_bulk)
+		(*r->send_bulk)--;
+	pthread_mutex_unlock(&st->send_lock);
+
+	dnet_io_req_free(r);
+	st->send_offset = 0;
+	st->send_cur = NULL;
+}
+
+/*
+ * Adds memory part of the request into the batch.
+ * Returns non-zero if batch is full or request has file body, which must be sent next.
+ */
+static int dnet_send_batch_add(struct dnet_send_batch *b, struct dnet_io_req *r, size_t skip)
+{
+	if (b->iov_num + 2 > DNET_SEND_IOV_MAX || b->total >= DNET_SEND_BATCH_BYTES)
+		return 1;
+
+	if (r->header && r->hsize > skip) {
+		b->iov[b->iov_num].iov_base = r->header + skip;
+		b->iov[b->iov_num].iov_len = r->hsize - skip;
+		b->total += b->iov[b->iov_num].iov_len;
+		b->iov_num++;
+		skip = 0;
+	} else {
+		skip -= r->hsize;
+	}
+
+	if (r->data && r->dsize > skip) {
+		b->iov[b->iov_num].iov_base = r->data + skip;
+		b->iov[b->iov_num].iov_len = r->dsize - skip;
+		b->total += b->iov[b->iov_num].iov_len;
+		b->iov_num++;
+	}
+
+	b->reqs[b->req_num++] = r;
+
+	if (r->fd >= 0 && r->fsize) {
+		b->fd_req = r;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Gathers headers and data of queued requests into single iovec array.
+ * Partially sent frame goes first, then fast lane frames, then large ones. Fast lane may take at most half
+ * of the batch if there are large frames queued, so that they are not starved.
+ * Batch stops at the first request with file body, which is sent after its header.
+ *
+ * Only network thread removes requests from the send lists, other threads only append to them,
+ * so gathered requests may be accessed without lock.
+ *
+ * Returns -EAGAIN and unschedules sending if send queue is empty.
+ */
+int dnet_send_batch_gather(struct dnet_net_state *st, struct dnet_send_batch *b)
+{
+	struct dnet_io_req *r;
+	int full = 0, fast_max = DNET_SEND_IOV_MAX;
+
+	b->iov_num = b->req_num = 0;
+	b->total = 0;
+	b->fd_req = NULL;
+
+	pthread_mutex_lock(&st->send_lock);
+	if (list_empty(&st->send_list) && list_empty(&st->send_fast_list)) {
+		dnet_unschedule_send(st);
 		pthread_mutex_unlock(&st->send_lock);
+		return -EAGAIN;
+	}
 
-		dnet_io_req_free(r);
-		st->send_offset = 0;
+	if (st->send_cur)
+		full = dnet_send_batch_add(b, st->send_cur, st->send_offset);
+
+	if (!list_empty(&st->send_list))
+		fast_max = DNET_SEND_IOV_MAX / 2;
+
+	list_for_each_entry(r, &st->send_fast_list, req_entry) {
+		if (full || b->iov_num + 2 > fast_max)
+			break;
+		if (r == st->send_cur)
+			continue;
+
+		full = dnet_send_batch_add(b, r, 0);
+	}
+
+	list_for_each_entry(r, &st->send_list, req_entry) {
+		if (full)
+			break;
+		if (r == st->send_cur)
+			continue;
+
+		full = dnet_send_batch_add(b, r, 0);
+	}
+	pthread_mutex_unlock(&st->send_lock);
+
+	return 0;
+}
+
+/*
+ * Completes requests whose memory parts were fully sent by @sent bytes of the batch.
+ * Request with file body becomes current one, it is completed after its body is sent.
+ *
+ * Returns -EAGAIN if a frame was sent partially.
+ */
+int dnet_send_batch_advance(struct dnet_net_state *st, struct dnet_send_batch *b, size_t sent)
+{
+	struct dnet_io_req *r;
+	size_t left;
+	int i;
+
+	for (i = 0; i < b->req_num; ++i) {
+		r = b->reqs[i];
+
+		if (r != st->send_cur)
+			st->send_offset = 0;
+
+		left = 0;
+		if (st->send_offset < r->hsize + r->dsize)
+			left = r->hsize + r->dsize - st->send_offset;
+
+		if (sent < left) {
+			st->send_offset += sent;
+			st->send_cur = r;
+			return -EAGAIN;
+		}
+
+		sent -= left;
+		st->send_offset += left;
+
+		if (r == b->fd_req) {
+			st->send_cur = r;
+			break;
+		}
+
+		dnet_send_request_complete(st, r);
 	}
 
+	return 0;
+}
+
+/*
+ * Sends gathered batch with one sendmsg() call, file body is sent after its header with sendfile() slice.
+ *
+ * Returns 0 if something was sent and there may be more to send, -EAGAIN if socket is full or
+ * send queue is empty, or negative error code.
+ */
+int dnet_send_batch(struct dnet_net_state *st)
+{
+	struct dnet_send_batch b;
+	struct msghdr msg;
+	ssize_t err = 0, sent = 0;
+
+	err = dnet_send_batch_gather(st, &b);
+	if (err)
+		return err;
+
+	if (b.iov_num) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = b.iov;
+		msg.msg_iovlen = b.iov_num;
+
+		sent = sendmsg(st->write_s, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | (b.fd_req ? MSG_MORE : 0));
+		if (sent < 0) {
+			err = -errno;
+			if (err != -EAGAIN)
+				dnet_log_err(st->n, "%s: failed to send %d requests: size: %zu, socket: %d",
+						dnet_state_dump_addr(st), b.req_num, b.total, st->write_s);
+			goto err_out_exit;
+		}
+
+		if (sent == 0) {
+			dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.\n",
+					dnet_state_dump_addr(st), st->write_s);
+			err = -ECONNRESET;
+			goto err_out_exit;
+		}
+	}
+
+	err = dnet_send_batch_advance(st, &b, sent);
+	if (err)
+		goto err_out_exit;
+
+	if (b.fd_req) {
+		size_t offset = st->send_offset - b.fd_req->dsize - b.fd_req->hsize;
+		size_t size = b.fd_req->fsize - offset;
+
+		if (size > DNET_SEND_FILE_SLICE)
+			size = DNET_SEND_FILE_SLICE;
+
+		err = dnet_send_fd_nolock(st, b.fd_req->fd, b.fd_req->local_offset + offset, size);
+		if (st->send_offset == b.fd_req->dsize + b.fd_req->hsize + b.fd_req->fsize)
+			dnet_send_request_complete(st, b.fd_req);
+		if (err)
+			goto err_out_exit;
+	}
+
+err_out_exit:
 	if (err && err != -EAGAIN) {
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: setting send need_exit to %d\n", dnet_state_dump_addr(st), err);
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: setting send need_exit to %zd\n", dnet_state_dump_addr(st), err);
 		st->need_exit = err;
 	}
 
-	cork = 0;
-	setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
-
 	return err;
 }
 
@@ -15,6 +15,7 @@
 
 #include <sys/stat.h>
 
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -146,6 +147,151 @@ static struct dnet_group *dnet_group_search(struct dnet_node *n, unsigned int gr
 	return found;
 }
 
+static void dnet_route_table_free(struct dnet_route_table *t)
+{
+	int i;
+
+	if (!t)
+		return;
+
+	for (i = 0; i < t->group_num; ++i) {
+		if (--t->rings[i]->refcnt == 0)
+			free(t->rings[i]);
+	}
+
+	free(t);
+}
+
+static void dnet_route_flip_and_drain(struct dnet_node *n)
+{
+	int i, idx = n->route_gp & 1;
+
+	/* full barrier after new table was published */
+	__sync_add_and_fetch(&n->route_gp, 1);
+
+	for (i = 0; i < DNET_COUNTER_SHARDS; ++i) {
+		while (n->route_readers[i].count[idx])
+			sched_yield();
+	}
+}
+
+/*
+ * Waits until all readers which could have seen the previous table leave their sections.
+ *
+ * Reader may load @route_gp parity before the previous update flipped it and increment
+ * that stale counter only afterwards, so a single flip would not wait for it while it
+ * walks the table being replaced now. Both counters are drained in turn, like SRCU does,
+ * so every reader which could have seen the previous table has left.
+ */
+static void dnet_route_synchronize(struct dnet_node *n)
+{
+	dnet_route_flip_and_drain(n);
+	dnet_route_flip_and_drain(n);
+}
+
+static inline uint64_t dnet_route_prefix(const unsigned char *id)
+{
+	uint64_t p = 0;
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		p = (p << 8) | id[i];
+
+	return p;
+}
+
+/*
+ * Fills Eytzinger layout by in-order walk of the implicit tree, returns next sorted position
+ */
+static int dnet_route_ring_build(struct dnet_route_ring *ring, int i, int k)
+{
+	if (k <= ring->id_num) {
+		i = dnet_route_ring_build(ring, i, 2 * k);
+
+		ring->prefix[k] = dnet_route_prefix(ring->ids[i].raw.id);
+		ring->pos[k] = i;
+		i++;
+
+		i = dnet_route_ring_build(ring, i, 2 * k + 1);
+	}
+
+	return i;
+}
+
+struct dnet_route_ring *dnet_route_ring_create(struct dnet_group *g)
+{
+	struct dnet_route_ring *ring;
+	int i;
+
+	ring = malloc(sizeof(struct dnet_route_ring) + g->id_num * sizeof(struct dnet_route_id) +
+			(g->id_num + 1) * (sizeof(uint64_t) + sizeof(int)));
+	if (!ring)
+		return NULL;
+
+	ring->refcnt = 0;
+	ring->group_id = g->group_id;
+	ring->id_num = g->id_num;
+
+	ring->prefix = (uint64_t *)&ring->ids[g->id_num];
+	ring->pos = (int *)&ring->prefix[g->id_num + 1];
+
+	for (i = 0; i < g->id_num; ++i) {
+		ring->ids[i].raw = g->ids[i].raw;
+		ring->ids[i].st = g->ids[i].idc->st;
+	}
+
+	dnet_route_ring_build(ring, 0, 1);
+	return ring;
+}
+
+/*
+ * Publishes new snapshot of group @g ids, must be called under state_lock after ids were changed.
+ * If new snapshot can not be allocated, the whole table is dropped, since stale one
+ * may point to states being freed. Lookups fail until the next successful update then.
+ */
+static void dnet_route_update_nolock(struct dnet_node *n, struct dnet_group *g)
+{
+	struct dnet_route_table *old = n->route, *t = NULL;
+	struct dnet_route_ring *ring = NULL;
+	int i, num = old ? old->group_num : 0;
+
+	if (g->id_num) {
+		ring = dnet_route_ring_create(g);
+		if (!ring)
+			goto err_out_publish;
+	}
+
+	t = malloc(sizeof(struct dnet_route_table) + (num + 1) * sizeof(struct dnet_route_ring *));
+	if (!t)
+		goto err_out_publish;
+
+	t->group_num = 0;
+	for (i = 0; i < num; ++i) {
+		if (old->rings[i]->group_id != g->group_id)
+			t->rings[t->group_num++] = old->rings[i];
+	}
+	if (ring)
+		t->rings[t->group_num++] = ring;
+
+	for (i = 0; i < t->group_num; ++i)
+		t->rings[i]->refcnt++;
+
+	n->route = t;
+	dnet_route_synchronize(n);
+	dnet_route_table_free(old);
+	return;
+
+err_out_publish:
+	free(ring);
+
+	n->route = NULL;
+	dnet_route_synchronize(n);
+	dnet_route_table_free(old);
+
+	dnet_log(n, DNET_LOG_ERROR, "Failed to allocate route table snapshot for group %d, route table dropped.\n",
+			g->group_id);
+}
+
 static int dnet_idc_compare(const void *k1, const void *k2)
 {
 	const struct dnet_state_id *id1 = k1;
@@ -154,6 +300,9 @@ static int dnet_idc_compare(const void *k1, const void *k2)
 	return dnet_id_cmp_str(id1->raw.id, id2->raw.id);
 }
 
+/*
+ * Compaction keeps the order, so the ring stays sorted
+ */
 static void dnet_idc_remove_ids(struct dnet_net_state *st, struct dnet_group *g)
 {
 	int i, pos;
@@ -166,9 +315,55 @@ static void dnet_idc_remove_ids(struct dnet_net_state *st, struct dnet_group *g)
 	}
 
 	g->id_num = pos;
-
-	qsort(g->ids,  g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
 	st->idc = NULL;
+
+	dnet_route_update_nolock(st->n, g);
+}
+
+/*
+ * Merges sorted @ids into sorted group ring, ids which are already present in the ring
+ * (or repeated in @ids) are skipped. Returns number of added ids or negative error,
+ * group is not changed on error.
+ */
+int dnet_idc_merge_ids(struct dnet_group *g, struct dnet_state_id *ids, int id_num)
+{
+	struct dnet_state_id *merged, *last = NULL;
+	int i = 0, j = 0, pos = 0, cmp;
+
+	merged = malloc((g->id_num + id_num) * sizeof(struct dnet_state_id));
+	if (!merged)
+		return -ENOMEM;
+
+	while (i < g->id_num || j < id_num) {
+		if (j == id_num)
+			cmp = -1;
+		else if (i == g->id_num)
+			cmp = 1;
+		else
+			cmp = dnet_id_cmp_str(g->ids[i].raw.id, ids[j].raw.id);
+
+		if (cmp <= 0) {
+			merged[pos++] = g->ids[i++];
+			last = &g->ids[i - 1];
+
+			/* new id which is already in the ring */
+			if (cmp == 0)
+				j++;
+			continue;
+		}
+
+		if (!last || dnet_id_cmp_str(last->raw.id, ids[j].raw.id))
+			merged[pos++] = ids[j];
+		last = &ids[j++];
+	}
+
+	free(g->ids);
+	g->ids = merged;
+
+	cmp = pos - g->id_num;
+	g->id_num = pos;
+
+	return cmp;
 }
 
 int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id *ids, int id_num)
@@ -194,6 +389,9 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 		sid->idc = idc;
 	}
 
+	/* sorted outside of state_lock, so that the ring is updated by a single linear merge */
+	qsort(idc->ids, id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
+
 	pthread_mutex_lock(&n->state_lock);
 
 	g = dnet_group_search(n, group_id);
@@ -205,28 +403,12 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 		list_add_tail(&g->group_entry, &n->group_list);
 	}
 
-	g->ids = realloc(g->ids, (g->id_num + id_num) * sizeof(struct dnet_state_id));
-	if (!g->ids) {
-		g->id_num = 0;
+	num = dnet_idc_merge_ids(g, idc->ids, id_num);
+	if (num <= 0) {
+		err = num ? num : -EEXIST;
 		goto err_out_unlock_put;
 	}
 
-	num = 0;
-	for (i=0; i<id_num; ++i) {
-		if (!bsearch(&idc->ids[i], g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare)) {
-			memcpy(&g->ids[g->id_num + num], &idc->ids[i], sizeof(struct dnet_state_id));
-			num++;
-		}
-	}
-
-	if (!num) {
-		err = -EEXIST;
-		goto err_out_unlock_put;
-	}
-
-	g->id_num += num;
-	qsort(g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
-
 	list_add_tail(&st->state_entry, &g->state_list);
 	list_add_tail(&st->storage_state_entry, &n->storage_state_list);
 
@@ -235,6 +417,9 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 	idc->group = g;
 
 	st->idc = idc;
+	st->route_epoch = ++n->route_epoch;
+
+	dnet_route_update_nolock(n, g);
 
 	if (n->log->log_level > DNET_LOG_DEBUG) {
 		for (i=0; i<g->id_num; ++i) {
@@ -307,96 +492,74 @@ void dnet_idc_destroy_nolock(struct dnet_net_state *st)
 	free(idc);
 }
 
-static int __dnet_idc_search(struct dnet_group *g, struct dnet_id *id)
+static struct dnet_route_ring *dnet_route_ring_search(struct dnet_route_table *t, unsigned int group_id)
 {
-	int low, high, i, cmp;
-	struct dnet_state_id *sid;
+	int i;
 
-	for (low = -1, high = g->id_num; high-low > 1; ) {
-		i = low + (high - low)/2;
-		sid = &g->ids[i];
+	if (!t)
+		return NULL;
 
-		cmp = dnet_id_cmp_str(sid->raw.id, id->id);
-		if (cmp < 0)
-			low = i;
-		else if (cmp > 0)
-			high = i;
-		else
-			goto out;
+	for (i = 0; i < t->group_num; ++i) {
+		if (t->rings[i]->group_id == group_id)
+			return t->rings[i];
 	}
-	i = high - 1;
 
-out:
-	if (i == -1)
-		i = g->id_num - 1;
-
-	return i;
-}
-
-static struct dnet_state_id *dnet_idc_search(struct dnet_group *g, struct dnet_id *id)
-{
-	return &g->ids[__dnet_idc_search(g, id)];
+	return NULL;
 }
 
-static int dnet_search_range_nolock(struct dnet_node *n, struct dnet_id *id, struct dnet_raw_id *start, struct dnet_raw_id *next)
+/*
+ * Returns position of the id which precedes (or is equal to) @id in the ring
+ */
+int dnet_route_ring_pos(struct dnet_route_ring *ring, struct dnet_id *id)
 {
-	struct dnet_state_id *sid;
-	struct dnet_group *group;
-	int idc_pos;
-
-	group = dnet_group_search(n, id->group_id);
-	if (!group)
-		return -ENOENT;
+	uint64_t key = dnet_route_prefix(id->id);
+	unsigned int k = 1, num = ring->id_num;
+	int i;
+
+	/* lower bound of the prefix: the first id whose prefix is not less than key's one */
+	while (k <= num) {
+		__builtin_prefetch(ring->prefix + 8 * k);
+		k = 2 * k + (ring->prefix[k] < key);
+	}
+	k >>= __builtin_ffs(~k);
 
-	idc_pos = __dnet_idc_search(group, id);
-	sid = &group->ids[idc_pos];
-	memcpy(start, &sid->raw, sizeof(struct dnet_raw_id));
+	i = k ? ring->pos[k] : ring->id_num;
 
-	if (++idc_pos >= group->id_num)
-		idc_pos = 0;
-	sid = &group->ids[idc_pos];
-	memcpy(next, &sid->raw, sizeof(struct dnet_raw_id));
+	/* ids with the same prefix are compared in full */
+	if (k && ring->prefix[k] == key) {
+		while (i < ring->id_num && dnet_route_prefix(ring->ids[i].raw.id) == key &&
+				dnet_id_cmp_str(ring->ids[i].raw.id, id->id) <= 0)
+			i++;
+	}
 
-	dnet_group_put(group);
+	/* the last id not greater than the key, ring wraps around */
+	if (--i < 0)
+		i = ring->id_num - 1;
 
-	return 0;
+	return i;
 }
 
 int dnet_search_range(struct dnet_node *n, struct dnet_id *id, struct dnet_raw_id *start, struct dnet_raw_id *next)
 {
-	int err;
-
-	pthread_mutex_lock(&n->state_lock);
-	err = dnet_search_range_nolock(n, id, start, next);
-	pthread_mutex_unlock(&n->state_lock);
+	struct dnet_route_ring *ring;
+	volatile int *rcount;
+	int pos, err = -ENOENT;
 
-	return err;
-}
-
-static struct dnet_state_id *__dnet_state_search_id(struct dnet_node *n, struct dnet_id *id)
-{
-	struct dnet_state_id *sid;
-	struct dnet_group *group;
-
-	group = dnet_group_search(n, id->group_id);
-	if (!group)
-		return NULL;
+	rcount = dnet_route_read_lock(n);
+	ring = dnet_route_ring_search(n->route, id->group_id);
+	if (ring) {
+		pos = dnet_route_ring_pos(ring, id);
+		memcpy(start, &ring->ids[pos].raw, sizeof(struct dnet_raw_id));
 
-	sid = dnet_idc_search(group, id);
+		if (++pos >= ring->id_num)
+			pos = 0;
+		memcpy(next, &ring->ids[pos].raw, sizeof(struct dnet_raw_id));
 
-	dnet_group_put(group);
-
-	return sid;
-}
-
-static struct dnet_net_state *__dnet_state_search(struct dnet_node *n, struct dnet_id *id)
-{
-	struct dnet_state_id *sid = __dnet_state_search_id(n, id);
-
-	if (!sid)
-		return NULL;
+		err = 0;
+	}
+	dnet_route_read_unlock(rcount);
 
-	return dnet_state_get(sid->idc->st);
+	return err;
 }
 
 struct dnet_net_state *dnet_state_search_by_addr(struct dnet_node *n, struct dnet_addr *addr)
@@ -423,23 +586,21 @@ struct dnet_net_state *dnet_state_search_by_addr(struct dnet_node *n, struct dne
 	return found;
 }
 
+/*
+ * Does not need state_lock anymore, the name is kept for existing callers
+ */
 struct dnet_net_state *dnet_state_search_nolock(struct dnet_node *n, struct dnet_id *id)
 {
-	struct dnet_net_state *found;
-
-	found = __dnet_state_search(n, id);
-	if (!found) {
-		struct dnet_group *g;
-
-		g = dnet_group_search(n, id->group_id);
-		if (!g)
-			goto err_out_exit;
+	struct dnet_net_state *found = NULL;
+	struct dnet_route_ring *ring;
+	volatile int *rcount;
 
-		found = dnet_state_get(g->ids[0].idc->st);
-		dnet_group_put(g);
-	}
+	rcount = dnet_route_read_lock(n);
+	ring = dnet_route_ring_search(n->route, id->group_id);
+	if (ring)
+		found = dnet_state_get(ring->ids[dnet_route_ring_pos(ring, id)].st);
+	dnet_route_read_unlock(rcount);
 
-err_out_exit:
 	return found;
 }
 
@@ -447,15 +608,12 @@ struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id
 {
 	struct dnet_net_state *found;
 
-	pthread_mutex_lock(&n->state_lock);
 	found = dnet_state_search_nolock(n, id);
 	if (found == n->st) {
 		dnet_state_put(found);
 		found = NULL;
 	}
 
-	pthread_mutex_unlock(&n->state_lock);
-
 	return found;
 }
 
@@ -465,13 +623,7 @@ struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id
  */
 struct dnet_net_state *dnet_node_state(struct dnet_node *n)
 {
-	struct dnet_net_state *found;
-
-	pthread_mutex_lock(&n->state_lock);
-	found = dnet_state_search_nolock(n, &n->id);
-	pthread_mutex_unlock(&n->state_lock);
-
-	return found;
+	return dnet_state_search_nolock(n, &n->id);
 }
 
 struct dnet_node *dnet_node_create(struct dnet_config *cfg)
@@ -582,14 +734,38 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 	n->client_prio = cfg->client_prio;
 	n->server_prio = cfg->server_prio;
 
+	err = dnet_cpu_set_parse(&n->thread_cpus[DNET_THREAD_NET], cfg->net_cpus);
+	if (!err)
+		err = dnet_cpu_set_parse(&n->thread_cpus[DNET_THREAD_IO], cfg->io_cpus);
+	if (!err)
+		err = dnet_cpu_set_parse(&n->thread_cpus[DNET_THREAD_NONBLOCKING_IO], cfg->nonblocking_io_cpus);
+	if (!err)
+		err = dnet_cpu_set_parse(&n->thread_cpus[DNET_THREAD_CHECK], cfg->check_cpus);
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "Failed to parse thread CPU lists: %s [%d]\n", strerror(-err), err);
+		goto err_out_free;
+	}
+
+	atomic_init(&n->threads_pinned, 0);
+	atomic_init(&n->threads_pin_failed, 0);
+	atomic_init(&n->thread_cpu_moves, 0);
+
 	err = dnet_crypto_init(n, cfg->ns, cfg->nsize);
 	if (err)
 		goto err_out_free;
 
-	err = dnet_io_init(n, cfg);
+	err = dnet_log_async_start(n, cfg->log_ring_kb);
 	if (err)
 		goto err_out_crypto_cleanup;
 
+	err = dnet_trace_init(n, cfg);
+	if (err)
+		goto err_out_log_stop;
+
+	err = dnet_io_init(n, cfg);
+	if (err)
+		goto err_out_trace_exit;
+
 	err = dnet_check_thread_start(n);
 	if (err)
 		goto err_out_io_exit;
@@ -599,6 +775,10 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 
 err_out_io_exit:
 	dnet_io_exit(n);
+err_out_trace_exit:
+	dnet_trace_exit(n);
+err_out_log_stop:
+	dnet_log_async_stop(n);
 err_out_crypto_cleanup:
 	dnet_crypto_cleanup(n);
 err_out_free:
@@ -612,6 +792,37 @@ err_out_exit:
 	return NULL;
 }
 
+static __thread int dnet_counter_shard_current;
+
+int dnet_counter_shard_index(void)
+{
+	static int next;
+
+	if (!dnet_counter_shard_current)
+		dnet_counter_shard_current = __sync_fetch_and_add(&next, 1) % DNET_COUNTER_SHARDS + 1;
+
+	return dnet_counter_shard_current - 1;
+}
+
+void dnet_counter_sum(struct dnet_node *n, struct dnet_stat_count *count)
+{
+	struct dnet_stat_count *c;
+	int i, j;
+
+	dnet_lock_lock(&n->counters_lock);
+	memcpy(count, n->counters, sizeof(struct dnet_stat_count) * __DNET_CNTR_MAX);
+	dnet_lock_unlock(&n->counters_lock);
+
+	for (i = 0; i < DNET_COUNTER_SHARDS; ++i) {
+		for (j = 0; j < __DNET_CNTR_MAX; ++j) {
+			c = &n->counter_shards[i].counters[j];
+
+			count[j].count += c->count;
+			count[j].err += c->err;
+		}
+	}
+}
+
 int dnet_need_exit(struct dnet_node *n)
 {
 	return n->need_exit;
@@ -646,6 +857,12 @@ void dnet_node_cleanup_common_resources(struct dnet_node *n)
 	dnet_wait_put(n->wait);
 
 	close(n->autodiscovery_socket);
+
+	dnet_route_table_free(n->route);
+	n->route = NULL;
+
+	dnet_trace_exit(n);
+	dnet_log_async_stop(n);
 }
 
 void dnet_node_destroy(struct dnet_node *n)
@@ -13,8 +13,14 @@
  * GNU General Public License for more details.
  */
 
+#define _GNU_SOURCE
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 
+#include <limits.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -37,32 +43,212 @@ static char *dnet_work_io_mode_str(int mode)
 	return dnet_work_io_mode_string[mode];
 }
 
+static int dnet_io_queue_init(struct dnet_io_queue *q, unsigned long size)
+{
+	unsigned long i;
+
+	memset(q, 0, sizeof(struct dnet_io_queue));
+
+	q->cells = malloc(size * sizeof(struct dnet_io_queue_cell));
+	if (!q->cells)
+		return -ENOMEM;
+
+	for (i = 0; i < size; ++i) {
+		q->cells[i].seq = i;
+		q->cells[i].r = NULL;
+	}
+
+	q->mask = size - 1;
+	return 0;
+}
+
+static void dnet_io_queue_destroy(struct dnet_io_queue *q)
+{
+	free(q->cells);
+}
+
+static int dnet_io_queue_push(struct dnet_io_queue *q, struct dnet_io_req *r)
+{
+	struct dnet_io_queue_cell *cell;
+	unsigned long pos, seq;
+	long diff;
+
+	pos = q->enqueue_pos;
+	while (1) {
+		cell = &q->cells[pos & q->mask];
+		seq = cell->seq;
+		__sync_synchronize();
+
+		diff = (long)seq - (long)pos;
+		if (diff == 0) {
+			if (__sync_bool_compare_and_swap(&q->enqueue_pos, pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return -EAGAIN;
+		}
+
+		pos = q->enqueue_pos;
+	}
+
+	cell->r = r;
+	__sync_synchronize();
+	cell->seq = pos + 1;
+
+	return 0;
+}
+
+static struct dnet_io_req *dnet_io_queue_pop(struct dnet_io_queue *q)
+{
+	struct dnet_io_queue_cell *cell;
+	struct dnet_io_req *r;
+	unsigned long pos, seq;
+	long diff;
+
+	pos = q->dequeue_pos;
+	while (1) {
+		cell = &q->cells[pos & q->mask];
+		seq = cell->seq;
+		__sync_synchronize();
+
+		diff = (long)seq - (long)(pos + 1);
+		if (diff == 0) {
+			if (__sync_bool_compare_and_swap(&q->dequeue_pos, pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return NULL;
+		}
+
+		pos = q->dequeue_pos;
+	}
+
+	r = cell->r;
+	__sync_synchronize();
+	cell->seq = pos + q->mask + 1;
+
+	return r;
+}
+
+static void dnet_work_io_wake(struct dnet_work_io *wio)
+{
+	__sync_add_and_fetch(&wio->wake_seq, 1);
+	dnet_futex_wake(&wio->wake_seq, 1);
+}
+
+/*
+ * Wake up to @num sleeping threads. In work-stealing mode threads with own queue
+ * park on their own futex, the rest (and all threads in shared mode) wait on the pool one.
+ */
+static void dnet_work_pool_wake(struct dnet_work_pool *pool, int num)
+{
+	struct dnet_work_io *wio;
+	int i, wio_num;
+
+	__sync_synchronize();
+
+	if (!pool->sleepers)
+		return;
+
+	wio_num = pool->wio_num;
+	for (i = 0; i < wio_num && num > 0; ++i) {
+		wio = pool->wio_array[i];
+		if (wio->sleeping) {
+			dnet_work_io_wake(wio);
+			num--;
+		}
+	}
+
+	if (num > 0) {
+		__sync_add_and_fetch(&pool->wake_seq, 1);
+		dnet_futex_wake(&pool->wake_seq, num);
+	}
+}
+
+static void dnet_io_queue_drain(struct dnet_io_queue *q)
+{
+	struct dnet_io_req *r;
+
+	while ((r = dnet_io_queue_pop(q)) != NULL) {
+		dnet_state_put(r->st);
+		dnet_io_req_free(r);
+	}
+}
+
+static void dnet_work_io_free(struct dnet_work_io *wio)
+{
+	if (wio->local.cells) {
+		dnet_io_queue_drain(&wio->local);
+		dnet_io_queue_destroy(&wio->local);
+	}
+
+	free(wio);
+}
+
 static void dnet_work_pool_cleanup(struct dnet_work_pool *pool)
 {
-	struct dnet_io_req *r, *tmp;
 	struct dnet_work_io *wio, *wio_tmp;
+	struct dnet_io_req *r, *tmp;
+	int i;
+
+	dnet_work_pool_wake(pool, INT_MAX);
+
+	/*
+	 * Elastic threads check @need_exit under pool lock before leaving @wio_list,
+	 * so list is not changed after this point
+	 */
+	pthread_mutex_lock(&pool->lock);
+	pthread_mutex_unlock(&pool->lock);
 
 	list_for_each_entry_safe(wio, wio_tmp, &pool->wio_list, wio_entry) {
 		pthread_join(wio->tid, NULL);
+	}
+
+	list_for_each_entry_safe(wio, wio_tmp, &pool->wio_list, wio_entry) {
 		list_del(&wio->wio_entry);
-		free(wio);
+		dnet_work_io_free(wio);
 	}
 
+	for (i = 0; i < pool->classes.num; ++i) {
+		dnet_io_queue_drain(&pool->queues[i]);
+		dnet_io_queue_destroy(&pool->queues[i]);
+	}
 
-	list_for_each_entry_safe(r, tmp, &pool->list, req_entry) {
+	list_for_each_entry_safe(r, tmp, &pool->parked, req_entry) {
 		list_del(&r->req_entry);
+		dnet_state_put(r->st);
 		dnet_io_req_free(r);
 	}
 
-	pthread_cond_destroy(&pool->wait);
+	dnet_lock_destroy(&pool->parked_lock);
 	pthread_mutex_destroy(&pool->lock);
 	free(pool);
 }
 
-static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool, int num, void *(* process)(void *))
+static void *dnet_io_process(void *data_);
+
+/*
+ * Waits until thread has allocated its own queue, thread exits right away if that failed
+ */
+static int dnet_work_io_wait_started(struct dnet_work_io *wio)
 {
-	int i, err;
-	struct dnet_work_io *wio, *tmp;
+	while (!wio->started)
+		dnet_futex_wait(&wio->started, 0, 1000);
+
+	__sync_synchronize();
+	return wio->start_err;
+}
+
+/*
+ * Threads which were started before failure keep running and are accounted in the pool,
+ * it is up to the caller to tear the pool down if it can not work with fewer threads.
+ *
+ * Elastic threads never get own queue in work-stealing mode, so that they can retire
+ * without leaving holes in @wio_array.
+ */
+static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool, int num, int elastic,
+		void *(* process)(void *))
+{
+	int i, err = 0;
+	struct dnet_work_io *wio;
 
 	pthread_mutex_lock(&pool->lock);
 
@@ -70,46 +256,166 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 		wio = malloc(sizeof(struct dnet_work_io));
 		if (!wio) {
 			err = -ENOMEM;
-			goto err_out_io_threads;
+			break;
 		}
 
-		wio->thread_index = i;
+		memset(wio, 0, sizeof(struct dnet_work_io));
+
+		wio->thread_index = pool->num + i;
 		wio->pool = pool;
+		wio->elastic = elastic;
+
+		if (pool->work_stealing && !elastic && pool->wio_num < DNET_WORK_POOL_MAX_THREADS) {
+			wio->thread_index = pool->wio_num;
+			wio->local_size = DNET_IO_LOCAL_QUEUE_SIZE;
+		}
+
 		list_add_tail(&wio->wio_entry, &pool->wio_list);
 
 		err = pthread_create(&wio->tid, NULL, process, wio);
 		if (err) {
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create IO thread: %d\n", err);
-			goto err_out_io_threads;
+
+			list_del(&wio->wio_entry);
+			dnet_work_io_free(wio);
+			break;
+		}
+
+		if (wio->local_size) {
+			err = dnet_work_io_wait_started(wio);
+			if (err) {
+				dnet_log(n, DNET_LOG_ERROR, "Failed to allocate IO thread queue: %d\n", err);
+
+				pthread_join(wio->tid, NULL);
+				list_del(&wio->wio_entry);
+				dnet_work_io_free(wio);
+				break;
+			}
+
+			pool->wio_array[wio->thread_index] = wio;
+			__sync_synchronize();
+			pool->wio_num = wio->thread_index + 1;
 		}
 	}
 
-	dnet_log(n, DNET_LOG_INFO, "Grew %s pool by: %d -> %d IO threads\n",
-			dnet_work_io_mode_str(pool->mode), pool->num, pool->num + num);
+	if (i) {
+		dnet_log(n, DNET_LOG_INFO, "Grew %s pool by: %d -> %d IO threads%s\n",
+				dnet_work_io_mode_str(pool->mode), pool->num, pool->num + i,
+				elastic ? " (autoscaling)" : "");
 
-	atomic_add(&pool->avail, num);
-	pool->num += num;
+		atomic_add(&pool->avail, i);
+		pool->num += i;
+	}
 	pthread_mutex_unlock(&pool->lock);
 
-	return 0;
+	return err;
+}
 
-err_out_io_threads:
-	list_for_each_entry_safe(wio, tmp, &pool->wio_list, wio_entry) {
-		pthread_join(wio->tid, NULL);
-		list_del(&wio->wio_entry);
-		free(wio);
+/*
+ * Adds one elastic thread when every thread of the pool is busy and nothing was dequeued
+ * for DNET_IO_SCALE_WAIT_USECS, which usually means threads are blocked in disk IO
+ * while requests queue up behind them.
+ */
+static void dnet_work_pool_autoscale(struct dnet_node *n, struct dnet_work_pool *pool)
+{
+	uint64_t now, last_grow;
+
+	if (pool->num >= pool->max || atomic_read(&pool->avail) > 0)
+		return;
+
+	now = dnet_io_now_usecs();
+	last_grow = pool->last_grow;
+	if (now - pool->last_dequeue < DNET_IO_SCALE_WAIT_USECS || now - last_grow < DNET_IO_SCALE_WAIT_USECS)
+		return;
+
+	/* only one network thread grows the pool per interval */
+	if (!__sync_bool_compare_and_swap(&pool->last_grow, last_grow, now))
+		return;
+
+	if (!dnet_work_pool_grow(n, pool, 1, 1, dnet_io_process))
+		__sync_add_and_fetch(&pool->grown_wait, 1);
+}
+
+/*
+ * Elastic thread leaves the pool after being idle for @pool->idle_timeout seconds,
+ * unless pool would shrink below its configured size. Returns 1 if thread has retired
+ * and its @wio was freed.
+ */
+static int dnet_work_pool_retire(struct dnet_work_io *wio, uint64_t *idle_since)
+{
+	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_node *n = pool->n;
+	uint64_t now = dnet_coarse_usecs();
+	int num, retire = 0;
+
+	if (!*idle_since) {
+		*idle_since = now;
+		return 0;
 	}
 
+	if (now - *idle_since < pool->idle_timeout * 1000000ULL)
+		return 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!n->need_exit && pool->num > pool->min) {
+		list_del(&wio->wio_entry);
+		num = --pool->num;
+		atomic_dec(&pool->avail);
+		retire = 1;
+	}
 	pthread_mutex_unlock(&pool->lock);
 
-	return err;
+	if (!retire) {
+		*idle_since = now;
+		return 0;
+	}
+
+	__sync_add_and_fetch(&pool->retired, 1);
+
+	dnet_log(n, DNET_LOG_INFO, "Retired idle %s pool thread: %d IO threads left\n",
+			dnet_work_io_mode_str(pool->mode), num);
+
+	pthread_detach(wio->tid);
+	dnet_work_io_free(wio);
+	return 1;
 }
 
-static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num, int mode, void *(* process)(void *))
+/*
+ * Builds smooth weighted round-robin schedule, so that classes with large weights
+ * are interleaved with others instead of being served in long runs.
+ */
+static void dnet_work_pool_build_schedule(struct dnet_work_pool *pool)
+{
+	int current[DNET_IO_CLASS_MAX];
+	int i, j, best, total = 0;
+
+	for (i = 0; i < pool->classes.num; ++i) {
+		current[i] = 0;
+		total += pool->classes.weight[i];
+	}
+
+	for (j = 0; j < total; ++j) {
+		best = 0;
+		for (i = 0; i < pool->classes.num; ++i) {
+			current[i] += pool->classes.weight[i];
+			if (current[i] > current[best])
+				best = i;
+		}
+
+		current[best] -= total;
+		pool->schedule[j] = best;
+	}
+
+	pool->schedule_num = total;
+}
+
+static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num, int max, int mode, int work_stealing,
+		struct dnet_io_classes *classes, void *(* process)(void *))
 {
 	struct dnet_work_pool *pool;
-	int err;
+	struct dnet_work_io *wio, *tmp;
+	int err, i;
 
 	pool = malloc(sizeof(struct dnet_work_pool));
 	if (!pool) {
@@ -122,40 +428,248 @@ static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num,
 	pool->num = 0;
 	atomic_set(&pool->avail, 0);
 	pool->mode = mode;
+	pool->work_stealing = work_stealing;
 	pool->n = n;
-	INIT_LIST_HEAD(&pool->list);
+	atomic_set(&pool->queued_blocked_sph, 0);
 	INIT_LIST_HEAD(&pool->wio_list);
+	INIT_LIST_HEAD(&pool->parked);
+
+	pool->min = num;
+	pool->max = max > num ? max : num;
+	pool->idle_timeout = DNET_IO_IDLE_TIMEOUT_DEFAULT;
+	pool->last_dequeue = pool->last_grow = dnet_io_now_usecs();
+
+	memcpy(&pool->classes, classes, sizeof(struct dnet_io_classes));
+	dnet_work_pool_build_schedule(pool);
+
+	for (i = 0; i < pool->classes.num; ++i) {
+		atomic_init(&pool->class_active[i], 0);
+
+		err = dnet_io_queue_init(&pool->queues[i], DNET_IO_QUEUE_SIZE);
+		if (err)
+			goto err_out_queue_destroy;
+	}
 
 	err = pthread_mutex_init(&pool->lock, NULL);
 	if (err) {
 		err = -err;
-		goto err_out_free;
+		goto err_out_queue_destroy;
 	}
 
-	err = pthread_cond_init(&pool->wait, NULL);
+	err = dnet_lock_init(&pool->parked_lock);
 	if (err) {
 		err = -err;
 		goto err_out_mutex_destroy;
 	}
 
-	err = dnet_work_pool_grow(n, pool, num, process);
+	err = dnet_work_pool_grow(n, pool, num, 0, process);
 	if (err)
-		goto err_out_cond_destroy;
+		goto err_out_io_threads;
 
 	return pool;
 
-err_out_cond_destroy:
-	pthread_cond_destroy(&pool->wait);
+err_out_io_threads:
+	pool->wio_num = 0;
+	list_for_each_entry_safe(wio, tmp, &pool->wio_list, wio_entry) {
+		pthread_join(wio->tid, NULL);
+		list_del(&wio->wio_entry);
+		dnet_work_io_free(wio);
+	}
+	dnet_lock_destroy(&pool->parked_lock);
 err_out_mutex_destroy:
 	pthread_mutex_destroy(&pool->lock);
-err_out_free:
+err_out_queue_destroy:
+	while (--i >= 0)
+		dnet_io_queue_destroy(&pool->queues[i]);
 	free(pool);
 err_out_exit:
 	return NULL;
 }
 
-static void *dnet_io_process(void *data_);
-static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
+/*
+ * Work-stealing mode: requests received over given connection are queued to the same IO thread,
+ * which keeps connection state and related data hot in its CPU cache.
+ * Returns 1 if request was queued, 0 if caller has to put it into shared queue.
+ */
+static int dnet_work_pool_push_affine(struct dnet_work_pool *pool, struct dnet_io_req *r)
+{
+	struct dnet_work_io *wio;
+	int wio_num = pool->wio_num;
+	unsigned long backlog;
+
+	if (!wio_num)
+		return 0;
+
+	wio = pool->wio_array[((unsigned long)r->st / sizeof(struct dnet_net_state)) % wio_num];
+
+	if (dnet_io_queue_push(&wio->local, r))
+		return 0;
+
+	__sync_synchronize();
+
+	if (wio->sleeping) {
+		dnet_work_io_wake(wio);
+		return 1;
+	}
+
+	/*
+	 * Affine thread is busy and there is a backlog in its queue,
+	 * kick an idle thread, so that it could steal some work.
+	 */
+	backlog = wio->local.enqueue_pos - wio->local.dequeue_pos;
+	if (backlog > 1)
+		dnet_work_pool_wake(pool, 1);
+
+	return 1;
+}
+
+static int dnet_io_cmd_class(struct dnet_cmd *cmd)
+{
+	if (cmd->trans & DNET_TRANS_REPLY)
+		return DNET_IO_CLASS_READ;
+
+	switch (cmd->cmd) {
+	case DNET_CMD_LOOKUP:
+	case DNET_CMD_REVERSE_LOOKUP:
+	case DNET_CMD_READ:
+		return DNET_IO_CLASS_READ;
+	case DNET_CMD_WRITE:
+	case DNET_CMD_DEL:
+		return DNET_IO_CLASS_WRITE;
+	case DNET_CMD_LIST:
+	case DNET_CMD_READ_RANGE:
+	case DNET_CMD_DEL_RANGE:
+	case DNET_CMD_BULK_READ:
+	case DNET_CMD_DEFRAG:
+		return DNET_IO_CLASS_RANGE;
+	case DNET_CMD_EXEC:
+		return DNET_IO_CLASS_EXEC;
+	default:
+		return DNET_IO_CLASS_ADMIN;
+	}
+}
+
+/*
+ * Replies are always accepted, since they complete our own transactions and free their resources.
+ * Empty pool accepts any request, so that request larger than byte limit is not rejected forever,
+ * byte limit is checked against already queued backlog only.
+ */
+static int dnet_work_pool_overloaded(struct dnet_work_pool *pool, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+
+	if (cmd->trans & DNET_TRANS_REPLY)
+		return 0;
+
+	if (!pool->queued)
+		return 0;
+
+	if (pool->queue_max && pool->queued >= pool->queue_max)
+		return 1;
+
+	if (pool->queue_max_bytes && (unsigned long)pool->queued_bytes >= pool->queue_max_bytes)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Completes request with -EBUSY status without queueing it, so that client could fail over to another group
+ */
+static void dnet_work_pool_reject(struct dnet_work_pool *pool, struct dnet_io_req *r)
+{
+	struct dnet_net_state *st = r->st;
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_cmd ack;
+
+	__sync_add_and_fetch(&pool->rejected, 1);
+
+	dnet_log(st->n, DNET_LOG_NOTICE, "%s: %s: %s: rejecting request: trans: %llu, size: %llu, "
+			"queued: %ld/%d, queued bytes: %ld/%lu\n",
+			dnet_state_dump_addr(st), dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd),
+			(unsigned long long)cmd->trans, (unsigned long long)cmd->size,
+			pool->queued, pool->queue_max, pool->queued_bytes, pool->queue_max_bytes);
+
+	memcpy(&ack.id, &cmd->id, sizeof(struct dnet_id));
+	ack.cmd = cmd->cmd;
+	ack.trans = cmd->trans | DNET_TRANS_REPLY;
+	ack.size = 0;
+	ack.flags = cmd->flags & ~(DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE);
+	ack.status = -EBUSY;
+
+	dnet_convert_cmd(&ack);
+	dnet_send(st, &ack, sizeof(struct dnet_cmd));
+
+	dnet_io_req_free(r);
+	dnet_state_put(st);
+}
+
+/*
+ * Class queue is full - IO threads are hopelessly behind. Request is parked and its state stops
+ * receiving, so that network thread keeps serving other connections instead of waiting for room.
+ */
+static void dnet_work_pool_park(struct dnet_work_pool *pool, struct dnet_io_req *r)
+{
+	struct dnet_net_state *st = r->st;
+
+	st->rcv_parked = 1;
+	dnet_unschedule_recv(st);
+
+	dnet_lock_lock(&pool->parked_lock);
+	list_add_tail(&r->req_entry, &pool->parked);
+	pool->parked_num++;
+	dnet_lock_unlock(&pool->parked_lock);
+}
+
+/*
+ * Requeues parked requests in arrival order while there is room and resumes receiving on their states.
+ * Called by IO threads after dequeueing a request and by network thread right after parking,
+ * so that request parked after IO threads have drained the queue is not left behind.
+ */
+static void dnet_work_pool_unpark(struct dnet_work_pool *pool)
+{
+	struct dnet_net_state *st;
+	struct dnet_io_req *r;
+	int err;
+
+	while (pool->parked_num) {
+		dnet_lock_lock(&pool->parked_lock);
+		if (list_empty(&pool->parked)) {
+			dnet_lock_unlock(&pool->parked_lock);
+			break;
+		}
+
+		r = list_first_entry(&pool->parked, struct dnet_io_req, req_entry);
+		list_del(&r->req_entry);
+
+		/* request may be processed and freed as soon as it is queued */
+		st = dnet_state_get(r->st);
+
+		err = dnet_io_queue_push(&pool->queues[r->io_class], r);
+		if (err)
+			list_add(&r->req_entry, &pool->parked);
+		else
+			pool->parked_num--;
+		dnet_lock_unlock(&pool->parked_lock);
+
+		if (err) {
+			dnet_state_put(st);
+			break;
+		}
+
+		dnet_work_pool_wake(pool, 1);
+
+		__sync_lock_release(&st->rcv_parked);
+		if (!st->need_exit)
+			dnet_schedule_recv(st);
+		dnet_state_put(st);
+	}
+}
+
+/*
+ * Returns -EAGAIN if request was parked, network thread has to stop receiving from its state.
+ */
+static int dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 {
 	struct dnet_io *io = n->io;
 	struct dnet_cmd *cmd = r->header;
@@ -182,55 +696,177 @@ static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 	if (nonblocking)
 		pool = io->recv_pool_nb;
 
+	if (dnet_work_pool_overloaded(pool, r)) {
+		dnet_work_pool_reject(pool, r);
+		return 0;
+	}
+
+	__sync_add_and_fetch(&pool->queued, 1);
+	__sync_add_and_fetch(&pool->queued_bytes, r->dsize);
+
 #define cmd_is_exec_match(__cmd) (((__cmd)->cmd == DNET_CMD_EXEC) && ((__cmd)->size >= sizeof(struct sph)) && !((__cmd)->trans & DNET_TRANS_REPLY))
 
-	if (!list_empty(&pool->list) && cmd_is_exec_match(cmd)) {
-		int pool_has_blocked_sph = 0;
-		struct dnet_io_req *tmp;
-		struct sph *sph;
+	if (cmd_is_exec_match(cmd)) {
+		struct sph *sph = (struct sph *)r->data;
 		int edge_num = pool->num / 4 + 1;
 
-		pthread_mutex_lock(&pool->lock);
-		list_for_each_entry(tmp, &pool->list, req_entry) {
-			struct dnet_cmd *tmp_cmd = tmp->header;
-			unsigned long long tid = tmp_cmd->trans & ~DNET_TRANS_REPLY;
-			int reply = !!(tmp_cmd->trans & DNET_TRANS_REPLY);
-			unsigned long long sph_flags = 0;
-			int sph_match = 0;
-
-			if (cmd_is_exec_match(tmp_cmd)) {
-				sph = (struct sph *)tmp->data;
-				sph_flags = sph->flags;
-				sph_match = 1;
+		if (sph->flags & DNET_SPH_FLAGS_SRC_BLOCK) {
+			dnet_log(r->st->n, DNET_LOG_DEBUG, "%s: %s: pool-grow: %s: sph-flags: %llx, queued-blocked: %d, avail: %d\n",
+				dnet_state_dump_addr(r->st), dnet_dump_id(r->header), dnet_cmd_string(cmd->cmd),
+				(unsigned long long)sph->flags, atomic_read(&pool->queued_blocked_sph), atomic_read(&pool->avail));
+
+			if (atomic_read(&pool->queued_blocked_sph) && (atomic_read(&pool->avail) < edge_num)) {
+				if (!dnet_work_pool_grow(n, pool, edge_num, 0, dnet_io_process))
+					__sync_add_and_fetch(&pool->grown_blocked, edge_num);
 			}
 
+			atomic_inc(&pool->queued_blocked_sph);
+		}
+	}
 
-			dnet_log(r->st->n, DNET_LOG_DEBUG, "%s: %s: pool-grow: %s: cmd-size: %llu, cflags: %llx, "
-					"trans: %lld, reply: %d, sph-flags: %llx (match: %d), avail: %d\n",
-				dnet_state_dump_addr(tmp->st), dnet_dump_id(tmp->header), dnet_cmd_string(tmp_cmd->cmd),
-				(unsigned long long)tmp_cmd->size, (unsigned long long)tmp_cmd->flags,
-				tid, reply, sph_flags, sph_match, atomic_read(&pool->avail));
+	dnet_work_pool_autoscale(n, pool);
 
-			if (cmd_is_exec_match(tmp_cmd)) {
-				sph = (struct sph *)tmp->data;
-				if (sph->flags & DNET_SPH_FLAGS_SRC_BLOCK) {
-					pool_has_blocked_sph = 1;
-					break;
-				}
-			}
-		}
-		pthread_mutex_unlock(&pool->lock);
+	r->io_class = 0;
+	if (pool->classes.num > 1)
+		r->io_class = dnet_io_cmd_class(cmd);
+	r->queue_time = dnet_io_now_usecs();
 
-		sph = (struct sph *)r->data;
-		if ((sph->flags & DNET_SPH_FLAGS_SRC_BLOCK) && pool_has_blocked_sph && (atomic_read(&pool->avail) < edge_num)) {
-			dnet_work_pool_grow(n, pool, edge_num, dnet_io_process);
-		}
+	if (r->trace)
+		dnet_trace_span_add(r->trace, DNET_TRACE_RECV, r->trace->start, r->queue_time);
+
+	if (pool->work_stealing && r->io_class == DNET_IO_CLASS_READ && dnet_work_pool_push_affine(pool, r))
+		return 0;
+
+	/* only the state whose request did not fit is parked, other connections keep being served */
+	if (dnet_io_queue_push(&pool->queues[r->io_class], r)) {
+		dnet_work_pool_park(pool, r);
+		dnet_work_pool_wake(pool, 1);
+		dnet_work_pool_unpark(pool);
+		return -EAGAIN;
 	}
 
-	pthread_mutex_lock(&pool->lock);
-	list_add_tail(&r->req_entry, &pool->list);
-	pthread_cond_broadcast(&pool->wait);
-	pthread_mutex_unlock(&pool->lock);
+	dnet_work_pool_wake(pool, 1);
+	return 0;
+}
+
+/*
+ * Pops request of given class, unless class has reached its busy thread limit
+ */
+static struct dnet_io_req *dnet_work_pool_class_pop(struct dnet_work_pool *pool, struct dnet_io_queue *q, int cls)
+{
+	struct dnet_io_req *r;
+	int limit = pool->classes.limit[cls];
+
+	if (q->enqueue_pos == q->dequeue_pos)
+		return NULL;
+
+	if (limit && atomic_inc(&pool->class_active[cls]) > limit) {
+		atomic_dec(&pool->class_active[cls]);
+		return NULL;
+	}
+
+	r = dnet_io_queue_pop(q);
+	if (!r && limit)
+		atomic_dec(&pool->class_active[cls]);
+
+	return r;
+}
+
+static struct dnet_io_req *dnet_work_io_get(struct dnet_work_io *wio)
+{
+	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_work_io *victim;
+	struct dnet_io_req *r;
+	int i, cls, wio_num;
+
+	if (wio->local.cells) {
+		r = dnet_work_pool_class_pop(pool, &wio->local, DNET_IO_CLASS_READ);
+		if (r)
+			return r;
+	}
+
+	cls = pool->schedule[wio->class_tick++ % pool->schedule_num];
+	r = dnet_work_pool_class_pop(pool, &pool->queues[cls], cls);
+	if (r)
+		return r;
+
+	for (i = 0; i < pool->classes.num; ++i) {
+		if (i == cls)
+			continue;
+
+		r = dnet_work_pool_class_pop(pool, &pool->queues[i], i);
+		if (r)
+			return r;
+	}
+
+	wio_num = pool->wio_num;
+	for (i = 1; i <= wio_num; ++i) {
+		victim = pool->wio_array[(wio->thread_index + i) % wio_num];
+		if (victim == wio)
+			continue;
+
+		r = dnet_work_pool_class_pop(pool, &victim->local, DNET_IO_CLASS_READ);
+		if (r)
+			return r;
+	}
+
+	return NULL;
+}
+
+static struct dnet_io_req *dnet_work_pool_pop(struct dnet_work_io *wio)
+{
+	struct dnet_work_pool *pool = wio->pool;
+	volatile int *wait = &pool->wake_seq;
+	struct dnet_io_req *r;
+	int seq;
+
+	r = dnet_work_io_get(wio);
+	if (r)
+		goto out;
+
+	if (wio->local.cells)
+		wait = &wio->wake_seq;
+
+	/*
+	 * Announce that we are going to sleep and recheck the queues,
+	 * producer bumps wake sequence after adding request if it sees sleepers,
+	 * so futex wait will not block if something was queued in between.
+	 */
+	seq = *wait;
+	if (wio->local.cells)
+		wio->sleeping = 1;
+	__sync_add_and_fetch(&pool->sleepers, 1);
+
+	r = dnet_work_io_get(wio);
+	if (!r)
+		dnet_futex_wait(wait, seq, 1000);
+
+	__sync_sub_and_fetch(&pool->sleepers, 1);
+	wio->sleeping = 0;
+
+	if (!r)
+		r = dnet_work_io_get(wio);
+out:
+	if (r) {
+		struct dnet_cmd *cmd = r->header;
+		struct dnet_io_class_stat *stat = &pool->class_stat[r->io_class];
+
+		if (cmd_is_exec_match(cmd) && (((struct sph *)r->data)->flags & DNET_SPH_FLAGS_SRC_BLOCK))
+			atomic_dec(&pool->queued_blocked_sph);
+
+		pool->last_dequeue = dnet_io_now_usecs();
+
+		__sync_add_and_fetch(&stat->wait_usecs, pool->last_dequeue - r->queue_time);
+		__sync_add_and_fetch(&stat->dequeued, 1);
+
+		__sync_sub_and_fetch(&pool->queued, 1);
+		__sync_sub_and_fetch(&pool->queued_bytes, r->dsize);
+
+		if (pool->parked_num)
+			dnet_work_pool_unpark(pool);
+	}
+
+	return r;
 }
 
 
@@ -245,7 +881,7 @@ void dnet_schedule_command(struct dnet_net_state *st)
 		dnet_log(st->n, DNET_LOG_DEBUG, "freed: size: %llu, trans: %llu, reply: %d, ptr: %p.\n",
 						(unsigned long long)c->size, tid, tid != c->trans, st->rcv_data);
 #endif
-		free(st->rcv_data);
+		dnet_io_req_free(st->rcv_data);
 		st->rcv_data = NULL;
 	}
 
@@ -253,27 +889,183 @@ void dnet_schedule_command(struct dnet_net_state *st)
 	st->rcv_offset = 0;
 }
 
+/*
+ * Removes @size bytes of protocol extension from the beginning of attached data.
+ * Command is moved forward over the extension, its buffer is not freed through @r->header.
+ */
+static void dnet_io_req_strip_ext(struct dnet_io_req *r, size_t size)
+{
+	struct dnet_cmd *cmd = r->header;
+
+	cmd->size -= size;
+	memmove(r->header + size, cmd, sizeof(struct dnet_cmd));
+
+	r->header += size;
+	r->dsize = cmd->size;
+	r->data = r->dsize ? r->header + sizeof(struct dnet_cmd) : NULL;
+}
+
+/*
+ * Remote deadline is converted into local monotonic time and removed from attached data,
+ * so command processing and forwarding see the original request.
+ */
+static void dnet_io_req_strip_deadline(struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_deadline d;
+
+	if (!(cmd->flags & DNET_FLAGS_DEADLINE))
+		return;
+
+	cmd->flags &= ~DNET_FLAGS_DEADLINE;
+	if (cmd->size < sizeof(struct dnet_deadline))
+		return;
+
+	memcpy(&d, r->data, sizeof(struct dnet_deadline));
+	dnet_convert_deadline(&d);
+
+	r->deadline = dnet_io_now_usecs() + d.timeout;
+	if (!r->deadline)
+		r->deadline = 1;
+
+	dnet_io_req_strip_ext(r, sizeof(struct dnet_deadline));
+}
+
+/*
+ * Request flag is cleared, so that replies do not copy it, and is remembered in @r
+ * until acknowledge is sent. Request flag echoed back by older nodes is dropped.
+ * Epoch attached to reply is recorded in the state it was received from and is removed,
+ * so transaction completion sees the original reply.
+ */
+static void dnet_io_req_strip_route_epoch(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_route_epoch e;
+
+	if (!(cmd->trans & DNET_TRANS_REPLY)) {
+		if (cmd->flags & DNET_FLAGS_ROUTE_EPOCH) {
+			cmd->flags &= ~DNET_FLAGS_ROUTE_EPOCH;
+			r->route_epoch = 1;
+		}
+		return;
+	}
+
+	cmd->flags &= ~DNET_FLAGS_ROUTE_EPOCH;
+
+	if (!(cmd->flags & DNET_FLAGS_ROUTE_EPOCH_REPLY))
+		return;
+
+	cmd->flags &= ~DNET_FLAGS_ROUTE_EPOCH_REPLY;
+
+	if (cmd->size < sizeof(struct dnet_route_epoch))
+		return;
+
+	memcpy(&e, r->data, sizeof(struct dnet_route_epoch));
+	dnet_convert_route_epoch(&e);
+
+	st->route_epoch_remote = e.epoch;
+	st->route_epoch_fresh = 1;
+
+	dnet_io_req_strip_ext(r, sizeof(struct dnet_route_epoch));
+}
+
+/*
+ * Slice extension of a reply frame was received, slice data is read directly into the reply being assembled.
+ * The first slice allocates the whole reply, following ones must continue it without gaps.
+ */
+static int dnet_recv_slice(struct dnet_net_state *st)
+{
+	struct dnet_cmd *c = &st->rcv_cmd, *cmd;
+	struct dnet_slice *s = &st->rcv_slice;
+	struct dnet_io_req *r = st->rcv_sliced;
+	uint64_t size = c->size - sizeof(struct dnet_slice);
+
+	dnet_convert_slice(s);
+
+	if (!r) {
+		if (s->offset)
+			return -EPROTO;
+
+		r = dnet_io_slab_alloc(st->nio ? st->nio->slab : NULL,
+				s->total + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
+		if (!r)
+			return -ENOMEM;
+
+		r->header = r + 1;
+		r->hsize = sizeof(struct dnet_cmd);
+		memcpy(r->header, c, sizeof(struct dnet_cmd));
+
+		cmd = r->header;
+		cmd->flags &= ~DNET_FLAGS_SLICE;
+		cmd->size = s->total;
+
+		if (cmd->size) {
+			r->data = r->header + sizeof(struct dnet_cmd);
+			r->dsize = cmd->size;
+		}
+
+		if (st->n->trace)
+			r->trace = dnet_trace_sample(st->n, st, cmd);
+
+		st->rcv_sliced = r;
+		st->rcv_sliced_offset = 0;
+	}
+
+	cmd = r->header;
+	if (cmd->trans != c->trans || cmd->size != s->total || s->offset != st->rcv_sliced_offset ||
+			size > s->total - s->offset) {
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: invalid reply slice: trans: %llu/%llu, total: %llu/%llu, "
+				"offset: %llu/%llu, size: %llu.\n", dnet_state_dump_addr(st),
+				(unsigned long long)c->trans, (unsigned long long)cmd->trans,
+				(unsigned long long)s->total, (unsigned long long)cmd->size,
+				(unsigned long long)s->offset, (unsigned long long)st->rcv_sliced_offset,
+				(unsigned long long)size);
+		return -EPROTO;
+	}
+
+	st->rcv_sliced_offset += size;
+
+	st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) + s->offset;
+	st->rcv_end = st->rcv_offset + size;
+	st->rcv_flags = DNET_IO_SLICE_DATA;
+
+	return 0;
+}
+
 static int dnet_process_recv_single(struct dnet_net_state *st)
 {
 	struct dnet_node *n = st->n;
 	struct dnet_io_req *r;
 	void *data;
-	uint64_t size;
+	uint64_t size, received = 0;
 	int err;
 
+	if (st->rcv_parked)
+		return -EAGAIN;
+
 again:
 	/*
 	 * Reading command first.
 	 */
 	if (st->rcv_flags & DNET_IO_CMD)
 		data = &st->rcv_cmd;
+	else if (st->rcv_flags & DNET_IO_SLICE)
+		data = &st->rcv_slice;
+	else if (st->rcv_flags & DNET_IO_SLICE_DATA)
+		data = st->rcv_sliced;
 	else
 		data = st->rcv_data;
 	data += st->rcv_offset;
 	size = st->rcv_end - st->rcv_offset;
 
+	if (n->trace && (st->rcv_flags & DNET_IO_CMD) && !st->rcv_offset)
+		st->rcv_start = dnet_io_now_usecs();
+
 	if (size) {
-		err = recv(st->read_s, data, size, 0);
+		if (st->nio && st->nio->ring)
+			err = dnet_uring_recv(st, data, size);
+		else
+			err = recv(st->read_s, data, size, 0);
 		if (err < 0) {
 			err = -EAGAIN;
 			if (errno != EAGAIN && errno != EINTR) {
@@ -293,10 +1085,21 @@ again:
 		}
 
 		st->rcv_offset += err;
+		received += err;
 	}
 
-	if (st->rcv_offset != st->rcv_end)
+	if (st->rcv_offset != st->rcv_end) {
+		/*
+		 * Do not let a single large packet monopolize network thread,
+		 * the rest will be read when this state is scheduled next time.
+		 */
+		if (received >= DNET_NET_BUDGET_BYTES) {
+			err = -EAGAIN;
+			goto out;
+		}
+
 		goto again;
+	}
 
 	if (st->rcv_flags & DNET_IO_CMD) {
 		unsigned long long tid;
@@ -312,91 +1115,229 @@ again:
 				!!(c->trans & DNET_TRANS_REPLY),
 				(unsigned long long)c->size, (unsigned long long)c->flags, c->status);
 
-		r = malloc(c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
+		if ((c->flags & DNET_FLAGS_SLICE) && (c->trans & DNET_TRANS_REPLY)) {
+			if (c->size < sizeof(struct dnet_slice)) {
+				err = -EPROTO;
+				goto out;
+			}
+
+			st->rcv_offset = 0;
+			st->rcv_end = sizeof(struct dnet_slice);
+			st->rcv_flags = DNET_IO_SLICE;
+			goto again;
+		}
+
+		r = dnet_io_slab_alloc(st->nio ? st->nio->slab : NULL,
+				c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
 		if (!r) {
 			err = -ENOMEM;
 			goto out;
 		}
-		memset(r, 0, sizeof(struct dnet_io_req));
 
 		r->header = r + 1;
 		r->hsize = sizeof(struct dnet_cmd);
 		memcpy(r->header, &st->rcv_cmd, sizeof(struct dnet_cmd));
 
-		st->rcv_data = r;
-		st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd);
-		st->rcv_end = st->rcv_offset + c->size;
-		st->rcv_flags &= ~DNET_IO_CMD;
+		if (n->trace)
+			r->trace = dnet_trace_sample(n, st, c);
+
+		st->rcv_data = r;
+		st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd);
+		st->rcv_end = st->rcv_offset + c->size;
+		st->rcv_flags &= ~DNET_IO_CMD;
+
+		if (c->size) {
+			r->data = r->header + sizeof(struct dnet_cmd);
+			r->dsize = c->size;
+
+			/*
+			 * We read the command header, now get the data.
+			 */
+			goto again;
+		}
+	}
+
+	if (st->rcv_flags & DNET_IO_SLICE) {
+		err = dnet_recv_slice(st);
+		if (err)
+			goto out;
+
+		goto again;
+	}
+
+	if (st->rcv_flags & DNET_IO_SLICE_DATA) {
+		r = st->rcv_sliced;
+
+		/*
+		 * Slices of one reply share the byte budget of a single packet,
+		 * so that a large sliced reply does not hold network thread for the whole round.
+		 */
+		if (st->rcv_sliced_offset != r->dsize) {
+			dnet_schedule_command(st);
+			return -EAGAIN;
+		}
+
+		st->rcv_sliced = NULL;
+	} else {
+		r = st->rcv_data;
+		st->rcv_data = NULL;
+	}
+
+	dnet_schedule_command(st);
+
+	r->st = dnet_state_get(st);
+
+	/* requester's flag copied into reply by the remote node */
+	if (((struct dnet_cmd *)r->header)->trans & DNET_TRANS_REPLY)
+		((struct dnet_cmd *)r->header)->flags &= ~DNET_FLAGS_SLICE_OK;
+
+	dnet_io_req_strip_deadline(r);
+	dnet_io_req_strip_route_epoch(st, r);
+
+	return dnet_schedule_io(n, r);
+
+out:
+	if (err != -EAGAIN && err != -EINTR)
+		dnet_schedule_command(st);
+
+	return err;
+}
+
+/*
+ * Accepts pending clients until listen queue is empty or DNET_ACCEPT_BATCH clients were accepted.
+ * With DNET_CFG_REUSEPORT every network thread has its own listener and accepted clients
+ * are served by the accepting thread, otherwise they are spread over all network threads.
+ *
+ * Returns 0 if there may be more clients to accept.
+ */
+int dnet_state_accept_process(struct dnet_net_state *orig, struct epoll_event *ev __unused)
+{
+	struct dnet_node *n = orig->n;
+	struct dnet_net_io *nio = NULL;
+	int err = 0, cs, i;
+	struct dnet_addr addr;
+	struct dnet_net_state *st;
+
+	if (n->flags & DNET_CFG_REUSEPORT)
+		nio = orig->nio;
+
+	for (i = 0; i < DNET_ACCEPT_BATCH; ++i) {
+		memset(&addr, 0, sizeof(addr));
+
+		addr.addr_len = sizeof(addr.addr);
+		cs = accept4(orig->read_s, (struct sockaddr *)&addr.addr, &addr.addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (cs <= 0) {
+			err = -errno;
+			if (err != -EAGAIN)
+				dnet_log_err(n, "failed to accept new client at %s", dnet_state_dump_addr(orig));
+			goto err_out_exit;
+		}
+
+		dnet_set_sockopt(cs);
+
+		/* socket is closed in dnet_state_create_nio() on error */
+		st = dnet_state_create_nio(n, 0, NULL, 0, &addr, cs, &err, 0, dnet_state_net_process, nio);
+		if (!st) {
+			dnet_log(n, DNET_LOG_ERROR, "%s: Failed to create state for accepted client: %s [%d]\n",
+					dnet_server_convert_dnet_addr(&addr), strerror(-err), -err);
+			err = -EAGAIN;
+			goto err_out_exit;
+		}
+
+		dnet_log(n, DNET_LOG_INFO, "Accepted client %s, socket: %d.\n",
+				dnet_server_convert_dnet_addr(&addr), cs);
+	}
+
+	return 0;
+
+err_out_exit:
+	return err;
+}
+
+/*
+ * Opens SO_REUSEPORT listening sockets into @socks for all network threads but one, which serves
+ * node's own listening state. Sockets are opened before that state is created: if any of them fails,
+ * the others are closed and listening socket @s is recreated without SO_REUSEPORT, so that other
+ * processes can not bind to the same port and steal connections from the single listener.
+ *
+ * Returns number of opened sockets or negative error if listening socket could not be recreated.
+ */
+int dnet_io_listen_reuseport_open(struct dnet_node *n, struct dnet_config *cfg, int *s, int *socks)
+{
+	struct dnet_io *io = n->io;
+	int err = 0, i, num = 0;
 
-		if (c->size) {
-			r->data = r->header + sizeof(struct dnet_cmd);
-			r->dsize = c->size;
+	for (i = 0; i < io->net_thread_num - 1; ++i) {
+		err = dnet_socket_create_addr(n, n->sock_type, n->proto, n->family,
+				(struct sockaddr *)n->addr.addr, n->addr.addr_len, 1);
+		if (err < 0)
+			goto err_out_close;
 
-			/*
-			 * We read the command header, now get the data.
-			 */
-			goto again;
-		}
+		socks[num++] = err;
 	}
 
-	r = st->rcv_data;
-	st->rcv_data = NULL;
+	return num;
 
-	dnet_schedule_command(st);
+err_out_close:
+	while (--num >= 0)
+		dnet_sock_close(socks[num]);
 
-	r->st = dnet_state_get(st);
+	dnet_log(n, DNET_LOG_ERROR, "Failed to open SO_REUSEPORT listeners at %s: %d, using single listener\n",
+			dnet_dump_node(n), err);
 
-	dnet_schedule_io(n, r);
-	return 0;
+	n->flags &= ~DNET_CFG_REUSEPORT;
+	dnet_sock_close(*s);
 
-out:
-	if (err != -EAGAIN && err != -EINTR)
-		dnet_schedule_command(st);
+	n->addr.addr_len = sizeof(n->addr.addr);
+	err = dnet_socket_create(n, cfg, &n->addr, 1);
+	if (err < 0)
+		return err;
 
-	return err;
+	*s = err;
+	return 0;
 }
 
-int dnet_state_accept_process(struct dnet_net_state *orig, struct epoll_event *ev __unused)
+/*
+ * Creates listening states for sockets opened by dnet_io_listen_reuseport_open(),
+ * every one is served by its own network thread, other than the one serving node's listening state.
+ * Socket, whose state could not be created, is closed, the rest keep accepting clients.
+ */
+void dnet_io_listen_reuseport(struct dnet_node *n, int *socks, int num)
 {
-	struct dnet_node *n = orig->n;
-	int err, cs;
-	struct dnet_addr addr;
+	struct dnet_io *io = n->io;
 	struct dnet_net_state *st;
+	int err, i, pos = 0, opened = 0;
 
-	memset(&addr, 0, sizeof(addr));
-
-	addr.addr_len = sizeof(addr.addr);
-	cs = accept(orig->read_s, (struct sockaddr *)&addr.addr, &addr.addr_len);
-	if (cs <= 0) {
-		err = -errno;
-		if (err != -EAGAIN)
-			dnet_log_err(n, "failed to accept new client at %s", dnet_state_dump_addr(orig));
-		goto err_out_exit;
-	}
+	for (i = 0; i < io->net_thread_num && pos < num; ++i) {
+		if (&io->net[i] == n->st->nio)
+			continue;
 
-	dnet_set_sockopt(cs);
+		st = dnet_state_create_nio(n, 0, NULL, 0, &n->addr, socks[pos++], &err, 0,
+				dnet_state_accept_process, &io->net[i]);
+		if (!st) {
+			dnet_log(n, DNET_LOG_ERROR, "Failed to create SO_REUSEPORT listener for network thread %d at %s: %d\n",
+					i, dnet_dump_node(n), err);
+			continue;
+		}
 
-	st = dnet_state_create(n, 0, NULL, 0, &addr, cs, &err, 0, dnet_state_net_process);
-	if (!st) {
-		dnet_log(n, DNET_LOG_ERROR, "%s: Failed to create state for accepted client: %s [%d]\n",
-				dnet_server_convert_dnet_addr(&addr), strerror(-err), -err);
-		err = -EAGAIN;
-		goto err_out_exit;
+		opened++;
 	}
 
-	dnet_log(n, DNET_LOG_INFO, "Accepted client %s, socket: %d.\n",
-			dnet_server_convert_dnet_addr(&addr), cs);
+	while (pos < num)
+		dnet_sock_close(socks[pos++]);
 
-	return 0;
-	/* socket is closed in dnet_state_create() */
-err_out_exit:
-	return err;
+	dnet_log(n, DNET_LOG_INFO, "Opened %d additional SO_REUSEPORT listeners at %s\n", opened, dnet_dump_node(n));
 }
 
 void dnet_unschedule_send(struct dnet_net_state *st)
 {
 	struct epoll_event ev;
 
+	if (st->nio && st->nio->ring) {
+		dnet_uring_unschedule(st, 1);
+		return;
+	}
+
 	ev.events = EPOLLOUT;
 	ev.data.ptr = st;
 
@@ -407,40 +1348,27 @@ void dnet_unschedule_recv(struct dnet_net_state *st)
 {
 	struct epoll_event ev;
 
+	if (st->nio && st->nio->ring) {
+		dnet_uring_unschedule(st, 0);
+		return;
+	}
+
 	ev.events = EPOLLIN;
 	ev.data.ptr = st;
 
 	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->read_s, &ev);
 }
 
+/*
+ * Sends a single batch or file body slice, network thread calls us again while state has budget.
+ * io_uring engine submits batch as linked requests, their completion reports EPOLLOUT again.
+ */
 static int dnet_process_send_single(struct dnet_net_state *st)
 {
-	struct dnet_io_req *r = NULL;
-	int err;
-
-	while (1) {
-		r = NULL;
-
-		pthread_mutex_lock(&st->send_lock);
-		if (!list_empty(&st->send_list)) {
-			r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
-		} else {
-			dnet_unschedule_send(st);
-		}
-		pthread_mutex_unlock(&st->send_lock);
-
-		if (!r) {
-			err = -EAGAIN;
-			goto err_out_exit;
-		}
-
-		err = dnet_send_request(st, r);
-		if (err)
-			goto err_out_exit;
-	}
+	if (st->nio && st->nio->ring)
+		return dnet_uring_send(st);
 
-err_out_exit:
-	return err;
+	return dnet_send_batch(st);
 }
 
 static int dnet_schedule_network_io(struct dnet_net_state *st, int send)
@@ -448,6 +1376,9 @@ static int dnet_schedule_network_io(struct dnet_net_state *st, int send)
 	struct epoll_event ev;
 	int err, fd;
 
+	if (st->nio && st->nio->ring)
+		return dnet_uring_schedule(st, send);
+
 	if (send) {
 		ev.events = EPOLLOUT;
 		fd = st->write_s;
@@ -504,25 +1435,125 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Wakes network thread up, so that it recalculates its timeout after earlier timer was armed
+ */
+void dnet_io_net_wake(struct dnet_net_io *nio)
+{
+	uint64_t one = 1;
+	int err;
+
+	if (nio->ring) {
+		dnet_uring_wake(nio->ring);
+		return;
+	}
+
+	err = write(nio->wake_fd, &one, sizeof(one));
+	(void) err;
+}
+
+static void dnet_io_net_wake_clear(struct dnet_net_io *nio)
+{
+	uint64_t val;
+	int err;
+
+	err = read(nio->wake_fd, &val, sizeof(val));
+	(void) err;
+}
+
+/*
+ * Completes transactions whose timers have expired in the wheel of network thread.
+ * Reply may complete or rearm transaction concurrently, so it is looked up by id under
+ * state lock and is timed out only if it is still in the tree and its timer was not rearmed.
+ */
+static void dnet_io_expire_transactions(struct dnet_net_io *nio)
+{
+	struct dnet_timer_wheel *w = &nio->wheel;
+	struct dnet_net_state *st = NULL;
+	struct dnet_timer *timer;
+	struct dnet_trans *t;
+	uint64_t tid = 0;
+
+	dnet_timer_wheel_advance(w);
+
+	while (1) {
+		dnet_lock_lock(&w->lock);
+		timer = dnet_timer_wheel_pop_nolock(w);
+		if (timer) {
+			t = container_of(timer, struct dnet_trans, timer);
+			st = dnet_state_get(t->st);
+			tid = t->trans;
+		}
+		dnet_lock_unlock(&w->lock);
+
+		if (!timer)
+			break;
+
+		pthread_mutex_lock(&st->trans_lock);
+		t = dnet_trans_search(&st->trans_table, tid);
+		if (t) {
+			if (list_empty(&t->timer.entry)) {
+				dnet_trans_remove_nolock(&st->trans_table, t);
+			} else {
+				dnet_trans_put(t);
+				t = NULL;
+			}
+		}
+		pthread_mutex_unlock(&st->trans_lock);
+
+		if (t) {
+			__sync_add_and_fetch(&st->trans_timeouts, 1);
+
+			t->cmd.flags = 0;
+			t->cmd.size = 0;
+			t->cmd.status = -ETIMEDOUT;
+
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: destructing trans: %llu on TIMEOUT\n",
+					dnet_state_dump_addr(st), (unsigned long long)t->trans);
+
+			if (t->complete)
+				t->complete(st, &t->cmd, t->priv);
+
+			dnet_trans_put(t);
+			dnet_trans_put(t);
+		}
+
+		dnet_state_put(st);
+	}
+}
+
 static void *dnet_io_process_network(void *data_)
 {
 	struct dnet_net_io *nio = data_;
 	struct dnet_node *n = nio->n;
 	struct dnet_net_state *st;
-	struct epoll_event ev;
-	int err = 0, check;
-	struct dnet_trans *t, *tmp;
-	struct timeval tv;
-	struct list_head head;
+	struct epoll_event ev[DNET_NET_EVENTS];
+	int err = 0, budget, num, timeout, i, j, last_cpu = -1;
 
 	dnet_set_name("net_pool");
+	dnet_thread_pin(n, DNET_THREAD_NET);
+
+	/* slab is created after pinning, so that it lands on the local NUMA node */
+	nio->slab = dnet_io_slab_create();
+	if (!nio->slab)
+		dnet_log(n, DNET_LOG_ERROR, "Failed to create receive buffer slab, receive buffers will not be cached\n");
 
 	while (!n->need_exit) {
-		err = epoll_wait(nio->epoll_fd, &ev, 1, 1000);
-		if (err == 0)
+		dnet_io_expire_transactions(nio);
+		timeout = dnet_timer_wheel_timeout(&nio->wheel, 1000);
+
+		if (nio->ring)
+			num = dnet_uring_wait(nio, ev, DNET_NET_EVENTS, timeout);
+		else
+			num = epoll_wait(nio->epoll_fd, ev, DNET_NET_EVENTS, timeout);
+		dnet_thread_cpu_check(n, &last_cpu);
+
+		if (num == 0)
 			continue;
 
-		if (err < 0) {
+		if (num < 0) {
+			if (nio->ring)
+				errno = -num;
 			err = -errno;
 
 			if (err == -EAGAIN || err == -EINTR)
@@ -533,56 +1564,64 @@ static void *dnet_io_process_network(void *data_)
 			break;
 		}
 
-		st = ev.data.ptr;
-		st->epoll_fd = nio->epoll_fd;
-		check = st->stall;
-
-		while (1) {
-			err = st->process(st, &ev);
-			if (err == 0)
+		/*
+		 * Receiving and sending sockets of the same state are reported as separate events,
+		 * merge them, so that every state is processed (and possibly reset) once per round.
+		 * States are pinned, since processing of one state may drop the last reference to another.
+		 * io_uring events already hold a reference of completed request, the duplicate one is dropped.
+		 * Wakeup eventfd is reported with NULL pointer.
+		 */
+		for (i = 0; i < num; ++i) {
+			if (!ev[i].data.ptr) {
+				dnet_io_net_wake_clear(nio);
 				continue;
-
-			if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
-				break;
-
-			if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
-				dnet_state_reset(st);
-				check = 0;
-				break;
 			}
-		}
-
-		if (!check)
-			continue;
 
-		gettimeofday(&tv, NULL);
+			for (j = 0; j < i; ++j) {
+				if (ev[j].data.ptr == ev[i].data.ptr) {
+					ev[j].events |= ev[i].events;
+					if (nio->ring)
+						dnet_state_put(ev[i].data.ptr);
+					ev[i].data.ptr = NULL;
+					break;
+				}
+			}
 
-		INIT_LIST_HEAD(&head);
+			if (ev[i].data.ptr && !nio->ring)
+				dnet_state_get(ev[i].data.ptr);
+		}
 
-		pthread_mutex_lock(&st->trans_lock);
-		list_for_each_entry_safe(t, tmp, &st->trans_list, trans_list_entry) {
-			if (t->time.tv_sec >= tv.tv_sec)
-				break;
+		for (i = 0; i < num; ++i) {
+			st = ev[i].data.ptr;
+			if (!st)
+				continue;
 
-			dnet_trans_remove_nolock(&st->trans_root, t);
-			list_move(&t->trans_list_entry, &head);
-		}
-		pthread_mutex_unlock(&st->trans_lock);
+			st->epoll_fd = nio->epoll_fd;
+			st->nio = nio;
 
-		list_for_each_entry_safe(t, tmp, &head, trans_list_entry) {
-			list_del_init(&t->trans_list_entry);
+			/*
+			 * Every state gets limited budget per round, so that a single busy connection
+			 * does not starve others. Epoll is level-triggered, so state which still has
+			 * pending data will be reported again by the next epoll_wait().
+			 */
+			for (budget = DNET_NET_BUDGET_PACKETS; budget > 0; --budget) {
+				err = st->process(st, &ev[i]);
+				if (err == 0)
+					continue;
 
-			t->cmd.flags = 0;
-			t->cmd.size = 0;
-			t->cmd.status = -ETIMEDOUT;
+				if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
+					break;
 
-			dnet_log(st->n, DNET_LOG_ERROR, "%s: destructing trans: %llu on TIMEOUT\n",
-					dnet_state_dump_addr(st), (unsigned long long)t->trans);
+				if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
+					dnet_state_reset(st);
+					break;
+				}
+			}
 
-			if (t->complete)
-				t->complete(st, &t->cmd, t->priv);
+			if (nio->ring)
+				dnet_uring_rearm(st);
 
-			dnet_trans_put(t);
+			dnet_state_put(st);
 		}
 	}
 
@@ -603,54 +1642,94 @@ struct dnet_io_process_data {
 	int thread_number;
 };
 
+/* deadline of the request being processed by current IO thread */
+static __thread uint64_t dnet_io_deadline;
+
+__thread int dnet_io_route_epoch;
+
+long long dnet_request_time_left(void)
+{
+	uint64_t now;
+
+	if (!dnet_io_deadline)
+		return -1;
+
+	now = dnet_io_now_usecs();
+	return dnet_io_deadline > now ? (long long)(dnet_io_deadline - now) : 0;
+}
+
 static void *dnet_io_process(void *data_)
 {
 	struct dnet_work_io *wio = data_;
 	struct dnet_work_pool *pool = wio->pool;
 	struct dnet_node *n = pool->n;
 	struct dnet_net_state *st;
-	struct timespec ts;
-	struct timeval tv;
 	struct dnet_io_req *r;
-	int err;
+	uint64_t idle_since = 0;
+	int last_cpu = -1;
 
 	dnet_set_name("io_pool");
+	dnet_thread_pin(n, pool->mode == DNET_WORK_IO_MODE_NONBLOCKING ? DNET_THREAD_NONBLOCKING_IO : DNET_THREAD_IO);
 
-	while (!n->need_exit) {
-		r = NULL;
-		err = 0;
+	if (wio->local_size) {
+		wio->start_err = dnet_io_queue_init(&wio->local, wio->local_size);
 
-		gettimeofday(&tv, NULL);
-		ts.tv_sec = tv.tv_sec + 1;
-		ts.tv_nsec = tv.tv_usec * 1000;
+		__sync_synchronize();
+		wio->started = 1;
+		dnet_futex_wake(&wio->started, 1);
 
-		pthread_mutex_lock(&pool->lock);
+		if (wio->start_err)
+			return NULL;
+	}
 
-		if (!list_empty(&pool->list)) {
-			r = list_first_entry(&pool->list, struct dnet_io_req, req_entry);
-		} else {
-			err = pthread_cond_timedwait(&pool->wait, &pool->lock, &ts);
-			if (!list_empty(&pool->list)) {
-				r = list_first_entry(&pool->list, struct dnet_io_req, req_entry);
-				err = 0;
-			}
+	while (!n->need_exit) {
+		r = dnet_work_pool_pop(wio);
+		if (!r) {
+			if (wio->elastic && dnet_work_pool_retire(wio, &idle_since))
+				return NULL;
+			continue;
 		}
 
-		if (r) {
-			list_del_init(&r->req_entry);
-			atomic_dec(&pool->avail);
-		}
-		pthread_mutex_unlock(&pool->lock);
+		idle_since = 0;
 
-		if (!r || err)
-			continue;
+		dnet_thread_cpu_check(n, &last_cpu);
+
+		atomic_dec(&pool->avail);
 
 		st = r->st;
 
 		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: got IO event: %p: hsize: %zu, dsize: %zu, mode: %s\n",
 			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, r->hsize, r->dsize, dnet_work_io_mode_str(pool->mode));
 
-		err = dnet_process_recv(st, r);
+		if (r->deadline && dnet_coarse_usecs() > r->deadline) {
+			__sync_add_and_fetch(&pool->expired, 1);
+			dnet_log(n, DNET_LOG_NOTICE, "%s: %s: dropping expired request: trans: %llu, queued for: %llu usecs\n",
+				dnet_state_dump_addr(st), dnet_dump_id(r->header),
+				(unsigned long long)((struct dnet_cmd *)r->header)->trans,
+				(unsigned long long)(dnet_io_now_usecs() - r->queue_time));
+		} else {
+			struct dnet_trace_span *span = NULL;
+
+			if (r->trace) {
+				dnet_trace_span_add(r->trace, DNET_TRACE_QUEUE, r->queue_time, dnet_io_now_usecs());
+				dnet_trace_current = r->trace;
+				span = dnet_trace_begin(DNET_TRACE_PROCESS);
+			}
+
+			dnet_io_deadline = r->deadline;
+			dnet_io_route_epoch = r->route_epoch;
+			dnet_process_recv(st, r);
+			dnet_io_deadline = 0;
+			dnet_io_route_epoch = 0;
+
+			if (r->trace) {
+				dnet_trace_span_end(span);
+				dnet_trace_current = NULL;
+			}
+		}
+
+		if (pool->classes.limit[r->io_class])
+			atomic_dec(&pool->class_active[r->io_class]);
 
 		dnet_io_req_free(r);
 		dnet_state_put(st);
@@ -661,10 +1740,139 @@ static void *dnet_io_process(void *data_)
 	return NULL;
 }
 
+static int dnet_io_parse_int_list(const char *list, int *values, int num)
+{
+	const char *p = list;
+	char *end;
+	int i;
+
+	for (i = 0; i < num && *p; ++i) {
+		values[i] = strtol(p, &end, 0);
+		if (end == p || values[i] < 0)
+			return -EINVAL;
+
+		p = end;
+		while (*p == ' ' || *p == ',')
+			p++;
+	}
+
+	if (*p)
+		return -E2BIG;
+
+	return 0;
+}
+
+static int dnet_io_classes_init(struct dnet_node *n, struct dnet_config *cfg, struct dnet_io_classes *classes)
+{
+	static const int default_weights[DNET_IO_CLASS_MAX] = {
+		[DNET_IO_CLASS_READ] = 8,
+		[DNET_IO_CLASS_WRITE] = 4,
+		[DNET_IO_CLASS_RANGE] = 1,
+		[DNET_IO_CLASS_EXEC] = 2,
+		[DNET_IO_CLASS_ADMIN] = 2,
+	};
+	int err, i;
+
+	memset(classes, 0, sizeof(struct dnet_io_classes));
+	classes->num = 1;
+	classes->weight[0] = 1;
+
+	if (!cfg->io_class_weights && !cfg->io_class_limits)
+		return 0;
+
+	classes->num = DNET_IO_CLASS_MAX;
+	memcpy(classes->weight, default_weights, sizeof(default_weights));
+
+	if (cfg->io_class_weights) {
+		err = dnet_io_parse_int_list(cfg->io_class_weights, classes->weight, DNET_IO_CLASS_MAX);
+		if (err) {
+			dnet_log(n, DNET_LOG_ERROR, "Invalid IO class weights '%s': %d\n", cfg->io_class_weights, err);
+			return err;
+		}
+	}
+
+	if (cfg->io_class_limits) {
+		err = dnet_io_parse_int_list(cfg->io_class_limits, classes->limit, DNET_IO_CLASS_MAX);
+		if (err) {
+			dnet_log(n, DNET_LOG_ERROR, "Invalid IO class thread limits '%s': %d\n", cfg->io_class_limits, err);
+			return err;
+		}
+	}
+
+	for (i = 0; i < DNET_IO_CLASS_MAX; ++i) {
+		if (classes->weight[i] < 1)
+			classes->weight[i] = 1;
+		if (classes->weight[i] > DNET_IO_CLASS_WEIGHT_MAX)
+			classes->weight[i] = DNET_IO_CLASS_WEIGHT_MAX;
+
+		dnet_log(n, DNET_LOG_INFO, "IO class %d: weight: %d, thread limit: %d\n",
+				i, classes->weight[i], classes->limit[i]);
+	}
+
+	return 0;
+}
+
+void dnet_io_pool_stat(struct dnet_node *n, struct dnet_stat_count *count)
+{
+	struct dnet_io *io = n->io;
+	struct dnet_work_pool *pools[2];
+	struct dnet_work_pool *pool;
+	struct dnet_io_queue *q;
+	unsigned long wait, dequeued;
+	int i, j, k;
+
+	if (!io)
+		return;
+
+	pools[0] = io->recv_pool;
+	pools[1] = io->recv_pool_nb;
+
+	for (i = 0; i < DNET_IO_CLASS_MAX; ++i) {
+		wait = dequeued = 0;
+
+		for (j = 0; j < 2; ++j) {
+			pool = pools[j];
+			if (i >= pool->classes.num)
+				continue;
+
+			q = &pool->queues[i];
+			count[DNET_CNTR_IO_QUEUE_READ + i].count += q->enqueue_pos - q->dequeue_pos;
+
+			if (i == DNET_IO_CLASS_READ) {
+				for (k = 0; k < pool->wio_num; ++k) {
+					q = &pool->wio_array[k]->local;
+					count[DNET_CNTR_IO_QUEUE_READ + i].count += q->enqueue_pos - q->dequeue_pos;
+				}
+			}
+
+			wait += __sync_lock_test_and_set(&pool->class_stat[i].wait_usecs, 0);
+			dequeued += __sync_lock_test_and_set(&pool->class_stat[i].dequeued, 0);
+		}
+
+		if (dequeued)
+			count[DNET_CNTR_IO_QUEUE_READ + i].err = wait / dequeued;
+	}
+
+	for (j = 0; j < 2; ++j) {
+		count[DNET_CNTR_IO_REJECTED].count += pools[j]->rejected;
+		count[DNET_CNTR_IO_REJECTED].err += pools[j]->queued_bytes;
+		count[DNET_CNTR_IO_EXPIRED].count += pools[j]->expired;
+
+		count[DNET_CNTR_IO_THREADS_GROW].count += pools[j]->grown_wait;
+		count[DNET_CNTR_IO_THREADS_GROW].err += pools[j]->grown_blocked;
+		count[DNET_CNTR_IO_THREADS_RETIRE].count += pools[j]->retired;
+	}
+
+	count[DNET_CNTR_IO_THREADS].count = pools[0]->num;
+	count[DNET_CNTR_IO_THREADS].err = pools[1]->num;
+}
+
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 {
 	int err, i;
 	struct dnet_io *io;
+	struct dnet_io_classes classes;
+	struct epoll_event ev;
 	int io_size = sizeof(struct dnet_io) + sizeof(struct dnet_net_io) * cfg->net_thread_num;
 
 	io = malloc(io_size);
@@ -679,36 +1887,92 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 	io->net_thread_pos = 0;
 	io->net = (struct dnet_net_io *)(io + 1);
 
-	io->recv_pool = dnet_work_pool_alloc(n, cfg->io_thread_num, DNET_WORK_IO_MODE_BLOCKING, dnet_io_process);
+	err = dnet_io_classes_init(n, cfg, &classes);
+	if (err)
+		goto err_out_free;
+
+	io->recv_pool = dnet_work_pool_alloc(n, cfg->io_thread_num, cfg->io_thread_max, DNET_WORK_IO_MODE_BLOCKING,
+			cfg->io_pool_mode == DNET_IO_POOL_WORK_STEALING, &classes, dnet_io_process);
 	if (!io->recv_pool) {
 		err = -ENOMEM;
 		goto err_out_free;
 	}
 
-	io->recv_pool_nb = dnet_work_pool_alloc(n, cfg->nonblocking_io_thread_num, DNET_WORK_IO_MODE_NONBLOCKING, dnet_io_process);
+	io->recv_pool->queue_max = cfg->io_queue_max;
+	io->recv_pool->queue_max_bytes = (unsigned long)cfg->io_queue_max_mb << 20;
+	if (cfg->io_thread_idle_timeout > 0)
+		io->recv_pool->idle_timeout = cfg->io_thread_idle_timeout;
+
+	io->recv_pool_nb = dnet_work_pool_alloc(n, cfg->nonblocking_io_thread_num, cfg->nonblocking_io_thread_max,
+			DNET_WORK_IO_MODE_NONBLOCKING, cfg->io_pool_mode == DNET_IO_POOL_WORK_STEALING,
+			&classes, dnet_io_process);
 	if (!io->recv_pool_nb) {
 		err = -ENOMEM;
 		goto err_out_free_recv_pool;
 	}
 
+	io->recv_pool_nb->queue_max = cfg->io_queue_max;
+	io->recv_pool_nb->queue_max_bytes = (unsigned long)cfg->io_queue_max_mb << 20;
+	if (cfg->io_thread_idle_timeout > 0)
+		io->recv_pool_nb->idle_timeout = cfg->io_thread_idle_timeout;
+
 	for (i=0; i<io->net_thread_num; ++i) {
 		struct dnet_net_io *nio = &io->net[i];
 
 		nio->n = n;
 
+		err = dnet_timer_wheel_init(&nio->wheel);
+		if (err)
+			goto err_out_net_destroy;
+
 		nio->epoll_fd = epoll_create(10000);
 		if (nio->epoll_fd < 0) {
 			err = -errno;
 			dnet_log_err(n, "Failed to create epoll fd");
+			dnet_timer_wheel_destroy(&nio->wheel);
 			goto err_out_net_destroy;
 		}
 
 		fcntl(nio->epoll_fd, F_SETFD, FD_CLOEXEC);
 		fcntl(nio->epoll_fd, F_SETFL, O_NONBLOCK);
 
+		nio->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (nio->wake_fd < 0) {
+			err = -errno;
+			dnet_log_err(n, "Failed to create network thread wakeup eventfd");
+			close(nio->epoll_fd);
+			dnet_timer_wheel_destroy(&nio->wheel);
+			goto err_out_net_destroy;
+		}
+
+		memset(&ev, 0, sizeof(struct epoll_event));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+
+		err = epoll_ctl(nio->epoll_fd, EPOLL_CTL_ADD, nio->wake_fd, &ev);
+		if (err) {
+			err = -errno;
+			dnet_log_err(n, "Failed to add network thread wakeup eventfd into epoll set");
+			close(nio->wake_fd);
+			close(nio->epoll_fd);
+			dnet_timer_wheel_destroy(&nio->wheel);
+			goto err_out_net_destroy;
+		}
+
+		if (cfg->net_engine == DNET_NET_ENGINE_IO_URING) {
+			nio->ring = dnet_uring_create(n);
+			if (!nio->ring)
+				dnet_log(n, DNET_LOG_ERROR, "Failed to create io_uring for network thread %d, falling back to epoll\n", i);
+			else
+				dnet_log(n, DNET_LOG_INFO, "Network thread %d uses io_uring engine\n", i);
+		}
+
 		err = pthread_create(&nio->tid, NULL, dnet_io_process_network, nio);
 		if (err) {
+			dnet_uring_destroy(nio->ring);
+			close(nio->wake_fd);
 			close(nio->epoll_fd);
+			dnet_timer_wheel_destroy(&nio->wheel);
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create network processing thread: %d\n", err);
 			goto err_out_net_destroy;
@@ -721,7 +1985,11 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 err_out_net_destroy:
 	while (--i >= 0) {
 		pthread_join(io->net[i].tid, NULL);
+		close(io->net[i].wake_fd);
 		close(io->net[i].epoll_fd);
+		dnet_uring_destroy(io->net[i].ring);
+		dnet_io_slab_destroy(io->net[i].slab);
+		dnet_timer_wheel_destroy(&io->net[i].wheel);
 	}
 
 	dnet_work_pool_cleanup(io->recv_pool_nb);
@@ -743,6 +2011,7 @@ void dnet_io_exit(struct dnet_node *n)
 
 	for (i=0; i<io->net_thread_num; ++i) {
 		pthread_join(io->net[i].tid, NULL);
+		close(io->net[i].wake_fd);
 		close(io->net[i].epoll_fd);
 	}
 
@@ -751,5 +2020,11 @@ void dnet_io_exit(struct dnet_node *n)
 
 	dnet_io_cleanup_states(n);
 
+	for (i=0; i<io->net_thread_num; ++i) {
+		dnet_uring_destroy(io->net[i].ring);
+		dnet_io_slab_destroy(io->net[i].slab);
+		dnet_timer_wheel_destroy(&io->net[i].wheel);
+	}
+
 	free(io);
 }
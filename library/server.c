@@ -198,7 +198,8 @@ struct dnet_node *dnet_server_node_create(struct dnet_config *cfg)
 		goto err_out_notify_exit;
 
 	if (cfg->flags & DNET_CFG_JOIN_NETWORK) {
-		int s;
+		int s, i, reuseport_num = 0;
+		int reuseport_s[n->io->net_thread_num];
 
 		err = dnet_locks_init(n, cfg->oplock_num);
 		if (err)
@@ -214,17 +215,31 @@ struct dnet_node *dnet_server_node_create(struct dnet_config *cfg)
 			goto err_out_ids_cleanup;
 
 		s = err;
+
+		if (cfg->flags & DNET_CFG_REUSEPORT) {
+			err = dnet_io_listen_reuseport_open(n, cfg, &s, reuseport_s);
+			if (err < 0)
+				goto err_out_ids_cleanup;
+
+			reuseport_num = err;
+		}
+
 		dnet_setup_id(&n->id, cfg->group_id, ids[0].id);
 
 		n->st = dnet_state_create(n, cfg->group_id, ids, id_num, &n->addr, s, &err, DNET_JOIN, dnet_state_accept_process);
 		if (!n->st) {
 			close(s);
+			for (i = 0; i < reuseport_num; ++i)
+				close(reuseport_s[i]);
 			goto err_out_state_destroy;
 		}
 
 		free(ids);
 		ids = NULL;
 
+		if (reuseport_num)
+			dnet_io_listen_reuseport(n, reuseport_s, reuseport_num);
+
 		err = dnet_srw_init(n, cfg);
 		if (err) {
 			dnet_log(n, DNET_LOG_ERROR, "srw: initialization failure: %s %d\n", strerror(-err), err);
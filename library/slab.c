@@ -0,0 +1,322 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+/*
+ * Receive buffer cache.
+ *
+ * Every network thread owns a slab, which caches dnet_io_req buffers (request structure, command header
+ * and attached data) in power-of-two size classes. Only owning network thread allocates from the slab,
+ * while buffers are usually freed by IO threads after command was processed. Such remote frees are pushed
+ * into per-class list protected by a spinlock, owner grabs the whole list when its private list is empty.
+ *
+ * Buffers which do not fit into the largest class are allocated and freed via plain malloc/free.
+ * Idle buffers are released when slab is destroyed, in-flight ones are freed when they are returned.
+ */
+
+/*
+ * Hit/miss counters are updated by the owning thread only, but stat command reads them
+ * from other threads, so both sides use atomic operations and never see torn 64-bit values.
+ */
+static inline void dnet_io_slab_count(uint64_t *cnt)
+{
+	(void)__sync_add_and_fetch(cnt, 1);
+}
+
+static inline uint64_t dnet_io_slab_count_read(uint64_t *cnt)
+{
+	return __sync_add_and_fetch(cnt, 0);
+}
+
+static inline size_t dnet_io_slab_class_size(int class)
+{
+	return 1UL << (class + DNET_IO_SLAB_MIN_SHIFT);
+}
+
+static int dnet_io_slab_class(uint64_t size)
+{
+	int class;
+
+	for (class = 0; class < DNET_IO_SLAB_CLASSES; ++class) {
+		if (size <= dnet_io_slab_class_size(class))
+			return class;
+	}
+
+	return -1;
+}
+
+struct dnet_io_slab *dnet_io_slab_create(void)
+{
+	struct dnet_io_slab *slab;
+	int i, err;
+
+	slab = malloc(sizeof(struct dnet_io_slab));
+	if (!slab)
+		goto err_out_exit;
+
+	memset(slab, 0, sizeof(struct dnet_io_slab));
+
+	for (i = 0; i < DNET_IO_SLAB_CLASSES; ++i) {
+		err = dnet_lock_init(&slab->classes[i].lock);
+		if (err)
+			goto err_out_destroy;
+
+		atomic_init(&slab->classes[i].cached, 0);
+	}
+
+	atomic_init(&slab->resident, 0);
+	atomic_init(&slab->outstanding, 1);
+
+	return slab;
+
+err_out_destroy:
+	while (--i >= 0)
+		dnet_lock_destroy(&slab->classes[i].lock);
+	free(slab);
+err_out_exit:
+	return NULL;
+}
+
+static void dnet_io_slab_free_list(struct dnet_io_slab *slab, int class, struct dnet_io_req *r)
+{
+	struct dnet_io_req *next;
+	size_t size = dnet_io_slab_class_size(class);
+
+	while (r) {
+		next = r->header;
+
+		atomic_sub(&slab->classes[class].cached, size);
+		atomic_sub(&slab->resident, size);
+		if (slab->total_cached)
+			atomic_sub(slab->total_cached, size);
+
+		free(r);
+		r = next;
+	}
+}
+
+/*
+ * Frees idle buffers of every class, remote ones may be freed concurrently by other threads
+ */
+static void dnet_io_slab_shrink(struct dnet_io_slab *slab)
+{
+	struct dnet_io_slab_class *c;
+	struct dnet_io_req *remote;
+	int i;
+
+	for (i = 0; i < DNET_IO_SLAB_CLASSES; ++i) {
+		c = &slab->classes[i];
+
+		dnet_io_slab_free_list(slab, i, c->local);
+		c->local = NULL;
+
+		dnet_lock_lock(&c->lock);
+		remote = c->remote;
+		c->remote = NULL;
+		dnet_lock_unlock(&c->lock);
+
+		dnet_io_slab_free_list(slab, i, remote);
+	}
+}
+
+static void dnet_io_slab_put(struct dnet_io_slab *slab)
+{
+	int i;
+
+	if (!atomic_dec_and_test(&slab->outstanding))
+		return;
+
+	dnet_io_slab_shrink(slab);
+
+	for (i = 0; i < DNET_IO_SLAB_CLASSES; ++i)
+		dnet_lock_destroy(&slab->classes[i].lock);
+
+	free(slab);
+}
+
+/*
+ * Slab is freed when the last outstanding buffer is returned,
+ * since IO requests may outlive network threads. Idle buffers are freed right away,
+ * so that exited (e.g. retired IO) threads do not keep memory cached.
+ */
+void dnet_io_slab_destroy(struct dnet_io_slab *slab)
+{
+	if (!slab)
+		return;
+
+	slab->dead = 1;
+	dnet_io_slab_shrink(slab);
+	dnet_io_slab_put(slab);
+}
+
+struct dnet_io_req *dnet_io_slab_alloc(struct dnet_io_slab *slab, uint64_t size)
+{
+	struct dnet_io_slab_class *c;
+	struct dnet_io_req *r;
+	int class = -1;
+
+	if (slab)
+		class = dnet_io_slab_class(size);
+
+	if (class < 0) {
+		r = malloc(size);
+		if (!r)
+			return NULL;
+
+		memset(r, 0, sizeof(struct dnet_io_req));
+		if (slab)
+			dnet_io_slab_count(&slab->oversize);
+		return r;
+	}
+
+	c = &slab->classes[class];
+
+	if (!c->local && c->remote) {
+		dnet_lock_lock(&c->lock);
+		c->local = c->remote;
+		c->remote = NULL;
+		dnet_lock_unlock(&c->lock);
+	}
+
+	r = c->local;
+	if (r) {
+		c->local = r->header;
+		atomic_sub(&c->cached, dnet_io_slab_class_size(class));
+		if (slab->total_cached)
+			atomic_sub(slab->total_cached, dnet_io_slab_class_size(class));
+		dnet_io_slab_count(&slab->hit);
+	} else {
+		r = malloc(dnet_io_slab_class_size(class));
+		if (!r)
+			return NULL;
+
+		atomic_add(&slab->resident, dnet_io_slab_class_size(class));
+		dnet_io_slab_count(&slab->miss);
+	}
+
+	memset(r, 0, sizeof(struct dnet_io_req));
+	r->slab = slab;
+	r->slab_class = class;
+
+	atomic_inc(&slab->outstanding);
+	return r;
+}
+
+void dnet_io_slab_free(struct dnet_io_req *r)
+{
+	struct dnet_io_slab *slab = r->slab;
+	struct dnet_io_slab_class *c;
+	int class = r->slab_class;
+	size_t size;
+
+	if (!slab) {
+		free(r);
+		return;
+	}
+
+	c = &slab->classes[class];
+	size = dnet_io_slab_class_size(class);
+
+	if (slab->dead || atomic_read(&c->cached) >= DNET_IO_SLAB_CLASS_CACHE ||
+			(slab->total_cached && atomic_read(slab->total_cached) >= slab->total_cache_max)) {
+		atomic_sub(&slab->resident, size);
+		free(r);
+	} else {
+		atomic_add(&c->cached, size);
+		if (slab->total_cached)
+			atomic_add(slab->total_cached, size);
+
+		dnet_lock_lock(&c->lock);
+		r->header = c->remote;
+		c->remote = r;
+		dnet_lock_unlock(&c->lock);
+	}
+
+	dnet_io_slab_put(slab);
+}
+
+/*
+ * Per-thread slabs are created on the first allocation and destroyed when thread exits,
+ * buffers which are still in flight keep slab alive until they are freed.
+ */
+static pthread_key_t dnet_io_slab_thread_key;
+static pthread_once_t dnet_io_slab_thread_once = PTHREAD_ONCE_INIT;
+static __thread struct dnet_io_slab *dnet_io_slab_thread_current;
+static atomic_t dnet_io_slab_thread_cached;
+
+static void dnet_io_slab_thread_release(void *slab)
+{
+	dnet_io_slab_destroy(slab);
+}
+
+static void dnet_io_slab_thread_key_init(void)
+{
+	atomic_init(&dnet_io_slab_thread_cached, 0);
+	pthread_key_create(&dnet_io_slab_thread_key, dnet_io_slab_thread_release);
+}
+
+struct dnet_io_req *dnet_io_slab_thread_alloc(uint64_t size)
+{
+	struct dnet_io_slab *slab = dnet_io_slab_thread_current;
+
+	if (size > DNET_THREAD_SLAB_MAX)
+		return dnet_io_slab_alloc(NULL, size);
+
+	if (!slab) {
+		pthread_once(&dnet_io_slab_thread_once, dnet_io_slab_thread_key_init);
+
+		slab = dnet_io_slab_create();
+		if (slab) {
+			slab->total_cached = &dnet_io_slab_thread_cached;
+			slab->total_cache_max = DNET_THREAD_SLAB_CACHE;
+
+			dnet_io_slab_thread_current = slab;
+			pthread_setspecific(dnet_io_slab_thread_key, slab);
+		}
+	}
+
+	return dnet_io_slab_alloc(slab, size);
+}
+
+void dnet_io_slab_stat(struct dnet_node *n, struct dnet_stat_count *count)
+{
+	struct dnet_io *io = n->io;
+	struct dnet_io_slab *slab;
+	int i, j;
+
+	if (!io)
+		return;
+
+	for (i = 0; i < io->net_thread_num; ++i) {
+		slab = io->net[i].slab;
+		if (!slab)
+			continue;
+
+		count[DNET_CNTR_RECV_SLAB_HIT].count += dnet_io_slab_count_read(&slab->hit);
+		count[DNET_CNTR_RECV_SLAB_MISS].count += dnet_io_slab_count_read(&slab->miss);
+		count[DNET_CNTR_RECV_SLAB_MISS].err += dnet_io_slab_count_read(&slab->oversize);
+		count[DNET_CNTR_RECV_SLAB_RESIDENT].count += atomic_read(&slab->resident);
+
+		for (j = 0; j < DNET_IO_SLAB_CLASSES; ++j)
+			count[DNET_CNTR_RECV_SLAB_RESIDENT].err += atomic_read(&slab->classes[j].cached);
+	}
+}
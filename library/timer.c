@@ -0,0 +1,243 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+/*
+ * Hierarchical timing wheel.
+ *
+ * Every network thread owns a wheel with DNET_WHEEL_LEVELS levels of DNET_WHEEL_SLOTS slots each,
+ * level 0 slot covers one millisecond, every next level slot covers the whole previous level.
+ * Timer is placed into the lowest level which can hold its expiration time, and is moved
+ * one level down (cascaded) when lower level wraps around, so insert and cancel are O(1)
+ * and every timer is touched at most DNET_WHEEL_LEVELS times.
+ *
+ * Timers are added and cancelled by any thread under wheel lock, expired timers are moved
+ * into @expired list by the owning network thread, which then pops them one by one.
+ * Owning thread records when it is going to wake up, timer armed by another thread
+ * which expires earlier tells caller to wake the owner.
+ */
+
+static inline uint64_t dnet_wheel_now(void)
+{
+	return dnet_io_now_usecs() / 1000;
+}
+
+static inline int dnet_wheel_slot(uint64_t expires, int level)
+{
+	return (expires >> (level * DNET_WHEEL_BITS)) & (DNET_WHEEL_SLOTS - 1);
+}
+
+int dnet_timer_wheel_init(struct dnet_timer_wheel *w)
+{
+	int i, j, err;
+
+	err = dnet_lock_init(&w->lock);
+	if (err)
+		return err;
+
+	for (i = 0; i < DNET_WHEEL_LEVELS; ++i) {
+		for (j = 0; j < DNET_WHEEL_SLOTS; ++j)
+			INIT_LIST_HEAD(&w->slots[i][j]);
+	}
+
+	INIT_LIST_HEAD(&w->expired);
+	w->now = dnet_wheel_now();
+	w->count = 0;
+	w->sleep_until = 0;
+
+	return 0;
+}
+
+void dnet_timer_wheel_destroy(struct dnet_timer_wheel *w)
+{
+	dnet_lock_destroy(&w->lock);
+}
+
+static void dnet_timer_wheel_insert_nolock(struct dnet_timer_wheel *w, struct dnet_timer *timer)
+{
+	uint64_t expires = timer->expires;
+	uint64_t delta;
+	int level;
+
+	if (expires <= w->now) {
+		timer->fired = 1;
+		list_add_tail(&timer->entry, &w->expired);
+		return;
+	}
+
+	delta = expires - w->now;
+	for (level = 0; level < DNET_WHEEL_LEVELS - 1; ++level) {
+		if (delta < (1ULL << ((level + 1) * DNET_WHEEL_BITS)))
+			break;
+	}
+
+	/* timers beyond the wheel range are kept in the farthest slot and cascaded again */
+	if (delta >= (1ULL << (DNET_WHEEL_LEVELS * DNET_WHEEL_BITS)))
+		expires = w->now + (1ULL << (DNET_WHEEL_LEVELS * DNET_WHEEL_BITS)) - 1;
+
+	timer->fired = 0;
+	w->count++;
+	list_add_tail(&timer->entry, &w->slots[level][dnet_wheel_slot(expires, level)]);
+}
+
+static void dnet_timer_del_nolock(struct dnet_timer_wheel *w, struct dnet_timer *timer)
+{
+	list_del_init(&timer->entry);
+	if (!timer->fired)
+		w->count--;
+}
+
+/*
+ * (Re)arms @timer to expire at @expires monotonic milliseconds.
+ * Returns 1 if owning thread sleeps past @expires and has to be woken up.
+ */
+int dnet_timer_add(struct dnet_timer_wheel *w, struct dnet_timer *timer, uint64_t expires)
+{
+	int wake = 0;
+
+	dnet_lock_lock(&w->lock);
+	if (!list_empty(&timer->entry))
+		dnet_timer_del_nolock(w, timer);
+
+	timer->expires = expires;
+	dnet_timer_wheel_insert_nolock(w, timer);
+
+	/* only the first earlier timer wakes the owner, it recalculates its timeout anyway */
+	if (w->sleep_until && expires < w->sleep_until) {
+		w->sleep_until = 0;
+		wake = 1;
+	}
+	dnet_lock_unlock(&w->lock);
+
+	return wake;
+}
+
+void dnet_timer_cancel(struct dnet_timer_wheel *w, struct dnet_timer *timer)
+{
+	dnet_lock_lock(&w->lock);
+	if (!list_empty(&timer->entry))
+		dnet_timer_del_nolock(w, timer);
+	dnet_lock_unlock(&w->lock);
+}
+
+static void dnet_timer_wheel_cascade_nolock(struct dnet_timer_wheel *w, int level)
+{
+	struct dnet_timer *timer, *tmp;
+	struct list_head head;
+
+	INIT_LIST_HEAD(&head);
+	list_splice_init(&w->slots[level][dnet_wheel_slot(w->now, level)], &head);
+
+	list_for_each_entry_safe(timer, tmp, &head, entry) {
+		list_del(&timer->entry);
+		w->count--;
+		dnet_timer_wheel_insert_nolock(w, timer);
+	}
+}
+
+/*
+ * Moves timers which have expired by now into @expired list.
+ * Empty wheel just jumps to the current time.
+ */
+void dnet_timer_wheel_advance(struct dnet_timer_wheel *w)
+{
+	uint64_t now = dnet_wheel_now();
+	struct dnet_timer *timer, *tmp;
+	struct list_head *slot;
+	int level;
+
+	dnet_lock_lock(&w->lock);
+	w->sleep_until = 0;
+
+	while (w->now < now) {
+		if (!w->count) {
+			w->now = now;
+			break;
+		}
+
+		w->now++;
+
+		for (level = 1; level < DNET_WHEEL_LEVELS; ++level) {
+			if (dnet_wheel_slot(w->now, level - 1))
+				break;
+			dnet_timer_wheel_cascade_nolock(w, level);
+		}
+
+		slot = &w->slots[0][dnet_wheel_slot(w->now, 0)];
+		list_for_each_entry_safe(timer, tmp, slot, entry) {
+			timer->fired = 1;
+			w->count--;
+			list_move_tail(&timer->entry, &w->expired);
+		}
+	}
+	dnet_lock_unlock(&w->lock);
+}
+
+/*
+ * Must be called under wheel lock, so that caller could grab whatever it needs
+ * from the object timer is embedded into, before it can be freed by other threads.
+ */
+struct dnet_timer *dnet_timer_wheel_pop_nolock(struct dnet_timer_wheel *w)
+{
+	struct dnet_timer *timer;
+
+	if (list_empty(&w->expired))
+		return NULL;
+
+	timer = list_first_entry(&w->expired, struct dnet_timer, entry);
+	list_del_init(&timer->entry);
+	return timer;
+}
+
+/*
+ * Returns number of milliseconds network thread may sleep before the next timer can expire,
+ * but no more than @max. Owning thread is considered sleeping until it advances the wheel.
+ */
+int dnet_timer_wheel_timeout(struct dnet_timer_wheel *w, int max)
+{
+	int i, slot, timeout = max;
+
+	dnet_lock_lock(&w->lock);
+	if (!list_empty(&w->expired)) {
+		timeout = 0;
+	} else if (w->count) {
+		slot = dnet_wheel_slot(w->now, 0);
+
+		/* higher levels are cascaded when level 0 wraps */
+		timeout = DNET_WHEEL_SLOTS - slot;
+
+		for (i = 1; i < DNET_WHEEL_SLOTS - slot; ++i) {
+			if (!list_empty(&w->slots[0][slot + i])) {
+				timeout = i;
+				break;
+			}
+		}
+
+		if (timeout > max)
+			timeout = max;
+	}
+
+	if (timeout)
+		w->sleep_until = w->now + timeout;
+	dnet_lock_unlock(&w->lock);
+
+	return timeout;
+}
@@ -0,0 +1,301 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+/*
+ * Sampled request tracing.
+ *
+ * Network thread decides whether to trace request when its header is received,
+ * trace is attached to the IO request and is made current for the IO thread while
+ * command is processed, so processing stages just open spans of the current trace.
+ * Every request queued for sending from traced context (replies, forwarded commands)
+ * holds a trace reference and closes its send span when it is freed after being sent.
+ *
+ * Completed traces are kept in per-node ring and dumped in Chrome trace-event format,
+ * which can be loaded into chrome://tracing or Perfetto UI.
+ */
+
+__thread struct dnet_trace *dnet_trace_current;
+
+static __thread unsigned int dnet_trace_counter;
+static __thread int dnet_trace_tid;
+
+static const char *dnet_trace_stage_names[] = {
+	[DNET_TRACE_RECV] = "recv",
+	[DNET_TRACE_QUEUE] = "queue",
+	[DNET_TRACE_PROCESS] = "process",
+	[DNET_TRACE_OPLOCK] = "oplock",
+	[DNET_TRACE_CACHE] = "cache",
+	[DNET_TRACE_BACKEND] = "backend",
+	[DNET_TRACE_SEND] = "send",
+};
+
+int dnet_trace_init(struct dnet_node *n, struct dnet_config *cfg)
+{
+	struct dnet_trace_log *log;
+	int err;
+
+	if (cfg->trace_sample <= 0)
+		return 0;
+
+	log = malloc(sizeof(struct dnet_trace_log));
+	if (!log) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(log, 0, sizeof(struct dnet_trace_log));
+
+	log->sample = cfg->trace_sample;
+	if (cfg->trace_file) {
+		log->file = strdup(cfg->trace_file);
+		if (!log->file) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+	}
+
+	err = pthread_mutex_init(&log->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_free_file;
+	}
+
+	n->trace = log;
+
+	dnet_log(n, DNET_LOG_INFO, "Tracing every %d request, trace file: %s\n",
+			log->sample, log->file ? log->file : "none");
+	return 0;
+
+err_out_free_file:
+	free(log->file);
+err_out_free:
+	free(log);
+err_out_exit:
+	dnet_log(n, DNET_LOG_ERROR, "Failed to initialize request tracing: %s [%d]\n", strerror(-err), err);
+	return err;
+}
+
+/*
+ * Must be called when all IO requests are freed
+ */
+void dnet_trace_exit(struct dnet_node *n)
+{
+	struct dnet_trace_log *log = n->trace;
+	int i;
+
+	if (!log)
+		return;
+
+	n->trace = NULL;
+
+	for (i = 0; i < DNET_TRACE_RING; ++i)
+		free(log->ring[i]);
+
+	pthread_mutex_destroy(&log->lock);
+	free(log->file);
+	free(log);
+}
+
+/*
+ * Called by network thread when command header was received
+ */
+struct dnet_trace *dnet_trace_sample(struct dnet_node *n, struct dnet_net_state *st, struct dnet_cmd *cmd)
+{
+	struct dnet_trace_log *log = n->trace;
+	struct dnet_trace *t;
+
+	if (!log || (cmd->trans & DNET_TRANS_REPLY))
+		return NULL;
+
+	if (++dnet_trace_counter < (unsigned int)log->sample)
+		return NULL;
+	dnet_trace_counter = 0;
+
+	t = malloc(sizeof(struct dnet_trace));
+	if (!t)
+		return NULL;
+
+	memset(t, 0, sizeof(struct dnet_trace));
+
+	atomic_init(&t->refcnt, 1);
+	t->log = log;
+	t->cmd = *cmd;
+	t->addr = st->addr;
+	t->start = st->rcv_start;
+
+	return t;
+}
+
+struct dnet_trace *dnet_trace_get(struct dnet_trace *t)
+{
+	atomic_inc(&t->refcnt);
+	return t;
+}
+
+struct dnet_trace_span *dnet_trace_span_start(struct dnet_trace *t, int stage, uint64_t start)
+{
+	struct dnet_trace_span *span;
+	int pos;
+
+	pos = __sync_fetch_and_add(&t->num, 1);
+	if (pos >= DNET_TRACE_SPANS)
+		return NULL;
+
+	if (!dnet_trace_tid)
+		dnet_trace_tid = dnet_get_id();
+
+	span = &t->spans[pos];
+	span->stage = stage;
+	span->tid = dnet_trace_tid;
+	span->start = start;
+
+	return span;
+}
+
+void dnet_trace_span_add(struct dnet_trace *t, int stage, uint64_t start, uint64_t end)
+{
+	struct dnet_trace_span *span;
+
+	span = dnet_trace_span_start(t, stage, start);
+	if (span)
+		span->end = end;
+}
+
+static void dnet_trace_complete(struct dnet_trace *t)
+{
+	struct dnet_trace_log *log = t->log;
+	struct dnet_trace *old;
+
+	pthread_mutex_lock(&log->lock);
+	t->seq = ++log->seq;
+
+	old = log->ring[log->pos];
+	log->ring[log->pos] = t;
+	log->pos = (log->pos + 1) % DNET_TRACE_RING;
+	pthread_mutex_unlock(&log->lock);
+
+	free(old);
+}
+
+/*
+ * Drops trace reference, @span (if not NULL) is ended first
+ */
+void dnet_trace_put(struct dnet_trace *t, struct dnet_trace_span *span)
+{
+	dnet_trace_span_end(span);
+
+	if (atomic_dec_and_test(&t->refcnt))
+		dnet_trace_complete(t);
+}
+
+static void dnet_trace_dump_one(FILE *f, struct dnet_trace *t, int pid, int *first)
+{
+	struct dnet_trace_span *span;
+	char id[2 * DNET_ID_SIZE + 1];
+	char addr[128];
+	int i, num = t->num;
+
+	if (num > DNET_TRACE_SPANS)
+		num = DNET_TRACE_SPANS;
+
+	dnet_dump_id_len_raw(t->cmd.id.id, DNET_DUMP_NUM, id);
+	dnet_server_convert_dnet_addr_raw(&t->addr, addr, sizeof(addr));
+
+	/* every request gets its own row named after command */
+	fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%llu,"
+			"\"args\":{\"name\":\"%s %s trans %llu\"}}",
+			*first ? "" : ",", pid, (unsigned long long)t->seq,
+			dnet_cmd_string(t->cmd.cmd), id, (unsigned long long)t->cmd.trans);
+	*first = 0;
+
+	for (i = 0; i < num; ++i) {
+		span = &t->spans[i];
+		if (!span->end || span->end < span->start)
+			continue;
+
+		fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,"
+				"\"ts\":%llu,\"dur\":%llu,\"args\":{\"thread\":%d,\"id\":\"%s\",\"trans\":%llu,"
+				"\"size\":%llu,\"cflags\":\"0x%llx\",\"addr\":\"%s\"}}",
+				dnet_trace_stage_names[span->stage], dnet_cmd_string(t->cmd.cmd),
+				pid, (unsigned long long)t->seq,
+				(unsigned long long)span->start, (unsigned long long)(span->end - span->start),
+				span->tid, id, (unsigned long long)t->cmd.trans,
+				(unsigned long long)t->cmd.size, (unsigned long long)t->cmd.flags, addr);
+	}
+}
+
+/*
+ * Writes completed traces into @file (or file from config when NULL) in Chrome trace-event JSON format
+ */
+int dnet_trace_dump(struct dnet_node *n, const char *file)
+{
+	struct dnet_trace_log *log = n->trace;
+	struct dnet_trace *t;
+	int i, num = 0, first = 1, pid = getpid();
+	FILE *f;
+	int err;
+
+	if (!log)
+		return -ENOTSUP;
+
+	if (!file)
+		file = log->file;
+	if (!file)
+		return -EINVAL;
+
+	f = fopen(file, "w");
+	if (!f) {
+		err = -errno;
+		dnet_log_err(n, "Failed to open trace file '%s'", file);
+		goto err_out_exit;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	pthread_mutex_lock(&log->lock);
+	for (i = 0; i < DNET_TRACE_RING; ++i) {
+		t = log->ring[(log->pos + i) % DNET_TRACE_RING];
+		if (!t)
+			continue;
+
+		dnet_trace_dump_one(f, t, pid, &first);
+		num++;
+	}
+	pthread_mutex_unlock(&log->lock);
+
+	fprintf(f, "\n]}\n");
+
+	err = 0;
+	if (fclose(f)) {
+		err = -errno;
+		dnet_log_err(n, "Failed to write trace file '%s'", file);
+		goto err_out_exit;
+	}
+
+	dnet_log(n, DNET_LOG_INFO, "Dumped %d request traces into '%s'\n", num, file);
+
+err_out_exit:
+	return err;
+}
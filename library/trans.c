@@ -26,54 +26,127 @@
 #include "elliptics/packet.h"
 #include "elliptics/interface.h"
 
-static inline int dnet_trans_cmp(uint64_t old, uint64_t new)
+/*
+ * Transaction table.
+ *
+ * In-flight transactions of the state are kept in open-addressing table indexed by low bits
+ * of transaction id. Ids are allocated sequentially, so transactions in flight occupy a sliding
+ * window of ids and map into distinct slots, collisions are resolved by robin hood linear probing:
+ * entries of a probe sequence are ordered by their distance from home slot.
+ * Table is grown when it is half full and shrunk when it becomes nearly empty,
+ * removal shifts following entries back, so there are no tombstones.
+ *
+ * Distance ordering lets search and removal stop at the first entry which sits closer
+ * to its home slot. Without it removal of the oldest transaction has to scan the whole
+ * window of sequential ids, since they form a single cluster.
+ */
+#define DNET_TRANS_TABLE_MIN		64
+
+static inline unsigned long dnet_trans_table_home(struct dnet_trans_table *tt, uint64_t trans)
 {
-	if (old > new)
-		return 1;
-	if (old < new)
-		return -1;
-	return 0;
+	return trans & tt->mask;
+}
+
+static inline unsigned long dnet_trans_table_dist(struct dnet_trans_table *tt, unsigned long pos)
+{
+	return (pos - dnet_trans_table_home(tt, tt->slots[pos]->trans)) & tt->mask;
 }
 
-struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans)
+/* caller must ensure there is a free slot */
+static void dnet_trans_table_place(struct dnet_trans_table *tt, struct dnet_trans *t)
 {
-	struct rb_node *n = root->rb_node;
-	struct dnet_trans *t = NULL;
-	int cmp = 1;
-
-	while (n) {
-		t = rb_entry(n, struct dnet_trans, trans_entry);
-
-		cmp = dnet_trans_cmp(t->trans, trans);
-		if (cmp < 0)
-			n = n->rb_left;
-		else if (cmp > 0)
-			n = n->rb_right;
-		else
-			return dnet_trans_get(t);
+	struct dnet_trans *tmp;
+	unsigned long pos, dist = 0, d;
+
+	pos = dnet_trans_table_home(tt, t->trans);
+	while (tt->slots[pos]) {
+		d = dnet_trans_table_dist(tt, pos);
+		if (d < dist) {
+			tmp = tt->slots[pos];
+			tt->slots[pos] = t;
+			t = tmp;
+			dist = d;
+		}
+
+		pos = (pos + 1) & tt->mask;
+		dist++;
 	}
 
-	return NULL;
+	tt->slots[pos] = t;
 }
 
-int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
+static int dnet_trans_table_resize(struct dnet_trans_table *tt, unsigned long size)
 {
-	struct rb_node **n = &root->rb_node, *parent = NULL;
+	struct dnet_trans **slots, **old = tt->slots;
+	unsigned long i, old_size = old ? tt->mask + 1 : 0;
+
+	slots = calloc(size, sizeof(struct dnet_trans *));
+	if (!slots)
+		return -ENOMEM;
+
+	tt->slots = slots;
+	tt->mask = size - 1;
+
+	for (i = 0; i < old_size; ++i) {
+		if (old[i])
+			dnet_trans_table_place(tt, old[i]);
+	}
+
+	free(old);
+	return 0;
+}
+
+void dnet_trans_table_destroy(struct dnet_trans_table *tt)
+{
+	free(tt->slots);
+	tt->slots = NULL;
+	tt->mask = 0;
+	tt->num = 0;
+}
+
+static long dnet_trans_table_find(struct dnet_trans_table *tt, uint64_t trans)
+{
+	unsigned long pos, dist = 0;
 	struct dnet_trans *t;
-	int cmp;
 
-	while (*n) {
-		parent = *n;
+	if (!tt->slots)
+		return -1;
 
-		t = rb_entry(parent, struct dnet_trans, trans_entry);
+	pos = dnet_trans_table_home(tt, trans);
+	while ((t = tt->slots[pos]) != NULL) {
+		if (t->trans == trans)
+			return pos;
+		if (dnet_trans_table_dist(tt, pos) < dist)
+			break;
 
-		cmp = dnet_trans_cmp(t->trans, a->trans);
-		if (cmp < 0)
-			n = &parent->rb_left;
-		else if (cmp > 0)
-			n = &parent->rb_right;
-		else
-			return -EEXIST;
+		pos = (pos + 1) & tt->mask;
+		dist++;
+	}
+
+	return -1;
+}
+
+struct dnet_trans *dnet_trans_search(struct dnet_trans_table *tt, uint64_t trans)
+{
+	long pos = dnet_trans_table_find(tt, trans);
+
+	if (pos < 0)
+		return NULL;
+
+	return dnet_trans_get(tt->slots[pos]);
+}
+
+int dnet_trans_insert_nolock(struct dnet_trans_table *tt, struct dnet_trans *a)
+{
+	int err;
+
+	if (dnet_trans_table_find(tt, a->trans) >= 0)
+		return -EEXIST;
+
+	if (!tt->slots || (tt->num + 1) * 2 > tt->mask + 1) {
+		err = dnet_trans_table_resize(tt, tt->slots ? (tt->mask + 1) * 2 : DNET_TRANS_TABLE_MIN);
+		if (err)
+			return err;
 	}
 
 	if (a->st && a->st->n)
@@ -81,24 +154,46 @@ int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
 			dnet_dump_id(&a->cmd.id), (unsigned long long)a->trans,
 			dnet_server_convert_dnet_addr(&a->st->addr));
 
-	rb_link_node(&a->trans_entry, parent, n);
-	rb_insert_color(&a->trans_entry, root);
+	dnet_trans_table_place(tt, a);
+	tt->num++;
+	a->hashed = 1;
 	return 0;
 }
 
-void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t)
+void dnet_trans_remove_nolock(struct dnet_trans_table *tt, struct dnet_trans *t)
 {
-	if (!t->trans_entry.rb_parent_color) {
+	unsigned long i, j;
+	long pos;
+
+	if (!t->hashed) {
 		if (t->st && t->st->n)
 			dnet_log(t->st->n, DNET_LOG_ERROR, "%s: trying to remove standalone transaction %llu.\n",
 				dnet_dump_id(&t->cmd.id), (unsigned long long)t->trans);
 		return;
 	}
 
-	if (t) {
-		rb_erase(&t->trans_entry, root);
-		t->trans_entry.rb_parent_color = 0;
+	pos = dnet_trans_table_find(tt, t->trans);
+	if (pos < 0 || tt->slots[pos] != t)
+		return;
+
+	/* shift back following entries of the probe sequence, it ends at empty slot or entry at its home */
+	i = pos;
+	while (1) {
+		j = (i + 1) & tt->mask;
+		if (!tt->slots[j] || !dnet_trans_table_dist(tt, j))
+			break;
+
+		tt->slots[i] = tt->slots[j];
+		i = j;
 	}
+
+	tt->slots[i] = NULL;
+	tt->num--;
+	t->hashed = 0;
+
+	/* resize failure is harmless here, table just stays larger */
+	if (tt->mask + 1 > DNET_TRANS_TABLE_MIN && tt->num * 8 < tt->mask + 1)
+		dnet_trans_table_resize(tt, (tt->mask + 1) / 2);
 }
 
 void dnet_trans_remove(struct dnet_trans *t)
@@ -106,25 +201,31 @@ void dnet_trans_remove(struct dnet_trans *t)
 	struct dnet_net_state *st = t->st;
 
 	pthread_mutex_lock(&st->trans_lock);
-	dnet_trans_remove_nolock(&st->trans_root, t);
-	list_del_init(&t->trans_list_entry);
+	dnet_trans_remove_nolock(&st->trans_table, t);
+	dnet_trans_timer_cancel(t);
 	pthread_mutex_unlock(&st->trans_lock);
 }
 
+/*
+ * Transactions are allocated from per-thread slab, buffer starts with
+ * struct dnet_io_req which keeps slab bookkeeping.
+ */
 struct dnet_trans *dnet_trans_alloc(struct dnet_node *n __unused, uint64_t size)
 {
+	struct dnet_io_req *r;
 	struct dnet_trans *t;
 
-	t = malloc(sizeof(struct dnet_trans) + size);
-	if (!t)
+	r = dnet_io_slab_thread_alloc(sizeof(struct dnet_io_req) + sizeof(struct dnet_trans) + size);
+	if (!r)
 		goto err_out_exit;
 
+	t = (struct dnet_trans *)(r + 1);
 	memset(t, 0, sizeof(struct dnet_trans) + size);
 
 	atomic_init(&t->refcnt, 1);
-	INIT_LIST_HEAD(&t->trans_list_entry);
+	dnet_timer_init(&t->timer);
 
-	gettimeofday(&t->start, NULL);
+	t->start = dnet_io_now_usecs();
 
 	return t;
 
@@ -135,25 +236,23 @@ err_out_exit:
 void dnet_trans_destroy(struct dnet_trans *t)
 {
 	struct dnet_net_state *st = NULL;
-	struct timeval tv;
 	long diff;
 
 	if (!t)
 		return;
 
-	gettimeofday(&tv, NULL);
-	diff = 1000000 * (tv.tv_sec - t->start.tv_sec) + (tv.tv_usec - t->start.tv_usec);
+	diff = dnet_io_now_usecs() - t->start;
 
 	if (t->st && t->st->n) {
 		st = t->st;
 
 		pthread_mutex_lock(&st->trans_lock);
-		list_del_init(&t->trans_list_entry);
+		dnet_trans_timer_cancel(t);
 		pthread_mutex_unlock(&st->trans_lock);
 
-		if (t->trans_entry.rb_parent_color)
+		if (t->hashed)
 			dnet_trans_remove(t);
-	} else if (!list_empty(&t->trans_list_entry)) {
+	} else if (!list_empty(&t->timer.entry)) {
 		assert(0);
 	}
 
@@ -173,11 +272,19 @@ void dnet_trans_destroy(struct dnet_trans *t)
 		st->median_read_time = (st->median_read_time + diff) / 2;
 	}
 
-	if (st && st->n && t->command != 0) {
+	if (st && st->n && t->command != 0 && dnet_log_enabled(st->n, DNET_LOG_INFO)) {
 		char str[64];
 		struct tm tm;
+		struct timeval tv;
+		uint64_t started;
+		time_t sec;
 
-		localtime_r((time_t *)&t->start.tv_sec, &tm);
+		/* wall clock start time is only needed for the log */
+		gettimeofday(&tv, NULL);
+		started = tv.tv_sec * 1000000ULL + tv.tv_usec - diff;
+		sec = started / 1000000;
+
+		localtime_r(&sec, &tm);
 		strftime(str, sizeof(str), "%F %R:%S", &tm);
 
 		dnet_log(st->n, DNET_LOG_INFO, "%s: destruction %s trans: %llu, reply: %d, st: %s, weight: %f, mrt: %ld, time: %ld, started: %s.%06lu, cached status: %d.\n",
@@ -187,7 +294,7 @@ void dnet_trans_destroy(struct dnet_trans *t)
 			!!(t->trans & ~DNET_TRANS_REPLY),
 			dnet_state_dump_addr(t->st),
 			st->weight, st->median_read_time, diff,
-			str, t->start.tv_usec,
+			str, (unsigned long)(started % 1000000),
 			t->cmd.status);
 	}
 
@@ -195,7 +302,7 @@ void dnet_trans_destroy(struct dnet_trans *t)
 	dnet_state_put(t->st);
 	dnet_state_put(t->orig);
 
-	free(t);
+	dnet_io_slab_free((struct dnet_io_req *)t - 1);
 }
 
 int dnet_trans_alloc_send_state(struct dnet_net_state *st, struct dnet_trans_control *ctl)
@@ -280,23 +387,15 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Transactions are timed out by network threads,
+ * here we only count how many of them have expired since the previous check.
+ */
 static void dnet_trans_check_stall(struct dnet_net_state *st)
 {
-	struct dnet_trans *t;
-	struct timeval tv;
-	int trans_timeout = 0;
+	int trans_timeout;
 
-	gettimeofday(&tv, NULL);
-
-	pthread_mutex_lock(&st->trans_lock);
-	list_for_each_entry(t, &st->trans_list, trans_list_entry) {
-		if (t->time.tv_sec >= tv.tv_sec)
-			break;
-
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: trans: %llu TIMEOUT\n", dnet_state_dump_addr(st), (unsigned long long)t->trans);
-		trans_timeout++;
-	}
-	pthread_mutex_unlock(&st->trans_lock);
+	trans_timeout = __sync_lock_test_and_set(&st->trans_timeouts, 0);
 
 	if (trans_timeout) {
 		st->stall++;
@@ -312,7 +411,9 @@ static void dnet_trans_check_stall(struct dnet_net_state *st)
 
 			dnet_state_remove_nolock(st);
 		} else {
-			dnet_schedule_recv(st);
+			/* kick state in case network thread has missed its events, parked state resumes by itself */
+			if (!st->rcv_parked)
+				dnet_schedule_recv(st);
 			dnet_schedule_send(st);
 		}
 	} else {
@@ -366,7 +467,19 @@ static int dnet_check_route_table(struct dnet_node *n)
 
 		st = dnet_state_get_first(n, &id);
 		if (st) {
-			dnet_recv_route_list(st);
+			/*
+			 * Remote epoch received since the last check equals to the one route table
+			 * was downloaded at - nothing has joined remote node, do not even ask.
+			 * Idle states are asked anyway, since their epoch is only updated by replies.
+			 */
+			if ((n->flags & DNET_CFG_ROUTE_EPOCH) && st->route_epoch_fresh && st->route_epoch_synced &&
+					st->route_epoch_synced == st->route_epoch_remote) {
+				st->route_epoch_fresh = 0;
+				n->route_sync_skipped++;
+			} else {
+				st->route_epoch_fresh = 0;
+				dnet_recv_route_list(st);
+			}
 			dnet_state_put(st);
 		}
 	}
@@ -382,6 +495,7 @@ static void *dnet_check_process(void *data)
 	int checks = 0, route_table_checks = 3;
 
 	dnet_set_name("check");
+	dnet_thread_pin(n, DNET_THREAD_CHECK);
 
 	if (!n->check_timeout)
 		n->check_timeout = 10;
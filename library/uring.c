@@ -0,0 +1,1491 @@
+/*
+ * 2013+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+/*
+ * io_uring network engine.
+ *
+ * Every network thread owns a ring. Completions are converted into epoll events,
+ * so network loop and state processing are the same for both engines.
+ *
+ * Receiving side uses multishot recv requests with buffers provided to the kernel through registered
+ * buffer ring, so a single request keeps receiving data until it is cancelled or buffers run out.
+ * Received chunks are queued in the state and dnet_uring_recv() copies them into receive buffer instead
+ * of recv() syscall. If buffers run out or kernel does not support multishot recv, one-shot POLL_ADD
+ * request is armed instead and data is read with plain recv().
+ *
+ * Sending side submits gathered batch as a linked chain: SENDMSG of headers and memory data, SPLICE
+ * of file body slice into per-state pipe, POLL_ADD(POLLOUT) and SPLICE from the pipe into socket.
+ * Only one chain per state is in flight, its completion is reported as EPOLLOUT event, processing
+ * applies results and submits the next one. Readiness of the socket for the first chain is requested
+ * with POLL_ADD(POLLOUT). Without kernel support of data path requests batch is sent synchronously.
+ *
+ * Requests queued by network thread itself are not submitted immediately, but in the same io_uring_enter()
+ * call which waits for completions. Requests queued by other threads (IO thread scheduling send)
+ * are submitted immediately, since network thread may sleep in the kernel.
+ *
+ * Every request carrying state pointer holds a state reference, its final completion transfers it
+ * to the network loop or drops it.
+ */
+
+#ifdef HAVE_IO_URING_SUPPORT
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+
+#define DNET_URING_ENTRIES		4096
+
+/* completions reaped per call, references dropped by them are collected on stack */
+#define DNET_URING_REAP_BATCH		256
+
+/* provided receive buffers, number must be a power of two */
+#define DNET_URING_BUF_NUM		256
+#define DNET_URING_BUF_SIZE		(16 * 1024)
+#define DNET_URING_BUF_GROUP		0
+
+/* multishot recv is armed only if at least this number of buffers is free */
+#define DNET_URING_BUF_LOW		16
+
+#define DNET_URING_PAGE_SIZE		4096
+
+/* requests which do not carry state pointer */
+#define DNET_URING_UD_CANCEL		0ULL
+#define DNET_URING_UD_TIMEOUT		3ULL
+
+/* request types or-ed into state pointer */
+#define DNET_URING_OP_POLL_SEND		1ULL
+#define DNET_URING_OP_RECV		2ULL
+#define DNET_URING_OP_SENDMSG		4ULL
+#define DNET_URING_OP_SPLICE_IN		5ULL
+#define DNET_URING_OP_POLL_OUT		6ULL
+#define DNET_URING_OP_SPLICE_OUT	7ULL
+#define DNET_URING_OP_MASK		7ULL
+
+/* bit of send chain request in @chain mask and its index in @res array of the state */
+#define DNET_URING_CHAIN_IDX(op)	((int)((op) - DNET_URING_OP_SENDMSG))
+#define DNET_URING_CHAIN_BIT(op)	(1 << DNET_URING_CHAIN_IDX(op))
+#define DNET_URING_CHAIN_NUM		4
+
+/* state flags */
+#define DNET_URING_WANT_RECV		(1<<0)
+#define DNET_URING_WANT_SEND		(1<<1)
+#define DNET_URING_ARMED_RECV		(1<<2)
+#define DNET_URING_ARMED_SEND		(1<<3)
+/* armed recv request is multishot one, not a poll */
+#define DNET_URING_MULTISHOT		(1<<4)
+/* send chain is in flight */
+#define DNET_URING_SENDING		(1<<5)
+/* EPOLLIN event was reported and state was not processed yet */
+#define DNET_URING_RX_EVENT		(1<<6)
+/* state is queued into ready list */
+#define DNET_URING_READY		(1<<7)
+/* multishot recv got EOF or error, it is reported after queued chunks */
+#define DNET_URING_RX_DONE		(1<<8)
+/* pipe can not be created, batches are sent synchronously */
+#define DNET_URING_SYNC_SEND		(1<<9)
+
+struct dnet_uring_buf {
+	unsigned		len;
+	int			next;
+};
+
+struct dnet_uring {
+	int			fd;
+	pthread_mutex_t		lock;
+	struct dnet_node	*n;
+
+	void			*ring_ptr;
+	size_t			ring_size;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_size;
+
+	unsigned		*sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned		sq_entries;
+	unsigned		sq_local_tail;
+
+	unsigned		*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	/*
+	 * Number of timeout requests in flight and expiration time (monotonic msecs)
+	 * of the last armed one, shorter timeout is armed in addition to the longer one
+	 */
+	int			timeout_armed;
+	uint64_t		timeout_expires;
+	struct __kernel_timespec	timeout;
+
+	/* kernel supports multishot recv and provided buffer ring was registered */
+	int			recv_multishot;
+	/* kernel supports linked sendmsg and splice requests */
+	int			data_ops;
+
+	/*
+	 * Provided buffer ring and buffers, @bufs hold length of received data
+	 * and link to the next chunk in the queue of the state
+	 */
+	struct io_uring_buf_ring	*br;
+	unsigned short		br_tail;
+	void			*buf_base;
+	struct dnet_uring_buf	bufs[DNET_URING_BUF_NUM];
+	int			buf_free;
+
+	/* number of in-flight requests, every one holds a state reference */
+	long			ops;
+
+	/* states which have used this ring and states with received data left unprocessed */
+	struct list_head	states;
+	struct list_head	ready;
+};
+
+struct dnet_uring_state {
+	struct dnet_uring	*ring;
+	struct dnet_net_state	*st;
+	struct list_head	entry;
+	struct list_head	ready_entry;
+
+	/* DNET_URING_* flags, protected by ring lock */
+	int			flags;
+
+	/*
+	 * Queue of received chunks (provided buffer ids), @rx_offset is the number
+	 * of bytes already read from the head one. Only network thread accesses it.
+	 */
+	int			rx_head, rx_tail;
+	unsigned		rx_offset;
+	int			rx_err;
+
+	/* send chain: gathered batch, submitted requests, number of not completed ones and their results */
+	struct dnet_send_batch	batch;
+	struct msghdr		msg;
+	int			chain;
+	int			pending;
+	int			res[DNET_URING_CHAIN_NUM];
+
+	/* file body is spliced through this pipe, @pipe_bytes were spliced in, but not out yet */
+	int			pipe[2];
+	size_t			pipe_size;
+	size_t			pipe_bytes;
+	struct dnet_io_req	*splice_req;
+};
+
+static int dnet_uring_enter(struct dnet_uring *ring, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	int err;
+
+	err = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, NULL, _NSIG / 8);
+	if (err < 0)
+		return -errno;
+
+	return err;
+}
+
+static inline unsigned dnet_uring_sq_pending_nolock(struct dnet_uring *ring)
+{
+	return ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static void dnet_uring_submit_nolock(struct dnet_uring *ring)
+{
+	unsigned pending = dnet_uring_sq_pending_nolock(ring);
+
+	if (pending)
+		dnet_uring_enter(ring, pending, 0, 0);
+}
+
+/*
+ * Makes sure there are @num free submission entries, so that linked chain is not split between submissions.
+ */
+static int dnet_uring_reserve_nolock(struct dnet_uring *ring, unsigned num)
+{
+	if (dnet_uring_sq_pending_nolock(ring) + num > ring->sq_entries) {
+		dnet_uring_submit_nolock(ring);
+
+		if (dnet_uring_sq_pending_nolock(ring) + num > ring->sq_entries)
+			return -EBUSY;
+	}
+
+	return 0;
+}
+
+static struct io_uring_sqe *dnet_uring_get_sqe_nolock(struct dnet_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if (dnet_uring_reserve_nolock(ring, 1))
+		return NULL;
+
+	idx = ring->sq_local_tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	ring->sq_array[idx] = idx;
+	return sqe;
+}
+
+static void dnet_uring_commit_nolock(struct dnet_uring *ring)
+{
+	ring->sq_local_tail++;
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static inline unsigned long long dnet_uring_ud(struct dnet_net_state *st, unsigned long long op)
+{
+	return (unsigned long)st | op;
+}
+
+/*
+ * Returns buffer to the kernel. Ring tail overlays reserved field of the first entry,
+ * so only address, length and id are written.
+ */
+static void dnet_uring_buf_put_nolock(struct dnet_uring *ring, int bid)
+{
+	struct io_uring_buf *buf = &ring->br->bufs[ring->br_tail & (DNET_URING_BUF_NUM - 1)];
+
+	buf->addr = (unsigned long)ring->buf_base + (unsigned long)bid * DNET_URING_BUF_SIZE;
+	buf->len = DNET_URING_BUF_SIZE;
+	buf->bid = bid;
+
+	ring->br_tail++;
+	__atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+
+	ring->buf_free++;
+}
+
+static void dnet_uring_rx_drop_nolock(struct dnet_uring *ring, struct dnet_uring_state *us)
+{
+	int bid;
+
+	while (us->rx_head >= 0) {
+		bid = us->rx_head;
+		us->rx_head = ring->bufs[bid].next;
+
+		dnet_uring_buf_put_nolock(ring, bid);
+	}
+
+	us->rx_tail = -1;
+	us->rx_offset = 0;
+}
+
+static void dnet_uring_cancel_nolock(struct dnet_uring *ring, struct dnet_net_state *st, unsigned long long op, int poll)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = dnet_uring_get_sqe_nolock(ring);
+	if (!sqe)
+		return;
+
+	if (poll) {
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+	} else {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+	}
+	sqe->fd = -1;
+	sqe->addr = dnet_uring_ud(st, op);
+	sqe->user_data = DNET_URING_UD_CANCEL;
+
+	dnet_uring_commit_nolock(ring);
+}
+
+static void dnet_uring_cancel_state_nolock(struct dnet_uring *ring, struct dnet_uring_state *us, int send)
+{
+	unsigned long long op;
+
+	if (!send) {
+		if (us->flags & DNET_URING_ARMED_RECV)
+			dnet_uring_cancel_nolock(ring, us->st, DNET_URING_OP_RECV, !(us->flags & DNET_URING_MULTISHOT));
+		return;
+	}
+
+	if (us->flags & DNET_URING_ARMED_SEND)
+		dnet_uring_cancel_nolock(ring, us->st, DNET_URING_OP_POLL_SEND, 1);
+
+	if (us->flags & DNET_URING_SENDING) {
+		for (op = DNET_URING_OP_SENDMSG; op <= DNET_URING_OP_SPLICE_OUT; ++op) {
+			if (us->chain & DNET_URING_CHAIN_BIT(op))
+				dnet_uring_cancel_nolock(ring, us->st, op, 0);
+		}
+	}
+}
+
+static int dnet_uring_arm_recv_nolock(struct dnet_uring *ring, struct dnet_uring_state *us)
+{
+	struct dnet_net_state *st = us->st;
+	struct io_uring_sqe *sqe;
+
+	sqe = dnet_uring_get_sqe_nolock(ring);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->fd = st->read_s;
+	sqe->user_data = dnet_uring_ud(st, DNET_URING_OP_RECV);
+
+	/* listening states accept connections and are only polled */
+	if (ring->recv_multishot && st->process == dnet_state_net_process && ring->buf_free >= DNET_URING_BUF_LOW) {
+		sqe->opcode = IORING_OP_RECV;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = DNET_URING_BUF_GROUP;
+
+		us->flags |= DNET_URING_MULTISHOT;
+	} else {
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll_events = POLLIN;
+	}
+
+	dnet_uring_commit_nolock(ring);
+
+	us->flags |= DNET_URING_ARMED_RECV;
+	return 0;
+}
+
+static int dnet_uring_arm_send_nolock(struct dnet_uring *ring, struct dnet_uring_state *us)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = dnet_uring_get_sqe_nolock(ring);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = us->st->write_s;
+	sqe->poll_events = POLLOUT;
+	sqe->user_data = dnet_uring_ud(us->st, DNET_URING_OP_POLL_SEND);
+
+	dnet_uring_commit_nolock(ring);
+
+	us->flags |= DNET_URING_ARMED_SEND;
+	return 0;
+}
+
+static int dnet_uring_arm_nolock(struct dnet_uring *ring, struct dnet_uring_state *us, int send)
+{
+	int err;
+
+	if (send)
+		err = dnet_uring_arm_send_nolock(ring, us);
+	else
+		err = dnet_uring_arm_recv_nolock(ring, us);
+
+	if (!err) {
+		dnet_state_get(us->st);
+		ring->ops++;
+	}
+
+	return err;
+}
+
+static inline int dnet_uring_is_net_thread(struct dnet_net_state *st)
+{
+	return pthread_equal(pthread_self(), st->nio->tid);
+}
+
+static int dnet_uring_op_supported(struct io_uring_probe *p, int op)
+{
+	return op <= p->last_op && (p->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+/*
+ * Multishot recv, cancellation of all matching requests and MSG_WAITALL sendmsg are there since 6.0 kernel,
+ * zero-copy send opcode of the same release is used to detect it.
+ */
+static void dnet_uring_probe(struct dnet_uring *ring)
+{
+	struct io_uring_probe *p;
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	int err;
+
+	p = malloc(size);
+	if (!p)
+		return;
+	memset(p, 0, size);
+
+	err = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, p, 256);
+	if (!err && dnet_uring_op_supported(p, IORING_OP_SEND_ZC) &&
+			dnet_uring_op_supported(p, IORING_OP_SENDMSG) &&
+			dnet_uring_op_supported(p, IORING_OP_SPLICE) &&
+			dnet_uring_op_supported(p, IORING_OP_ASYNC_CANCEL))
+		ring->data_ops = 1;
+
+	free(p);
+}
+
+static int dnet_uring_buf_ring_init(struct dnet_uring *ring)
+{
+	struct io_uring_buf_reg reg;
+	size_t br_size = DNET_URING_BUF_NUM * sizeof(struct io_uring_buf);
+	int err, i;
+
+	ring->br = mmap(NULL, br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->br == MAP_FAILED) {
+		err = -errno;
+		goto err_out_exit;
+	}
+
+	err = posix_memalign(&ring->buf_base, DNET_URING_PAGE_SIZE, DNET_URING_BUF_NUM * DNET_URING_BUF_SIZE);
+	if (err) {
+		err = -err;
+		goto err_out_unmap;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)ring->br;
+	reg.ring_entries = DNET_URING_BUF_NUM;
+	reg.bgid = DNET_URING_BUF_GROUP;
+
+	err = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+	if (err < 0) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < DNET_URING_BUF_NUM; ++i)
+		dnet_uring_buf_put_nolock(ring, i);
+
+	return 0;
+
+err_out_free:
+	free(ring->buf_base);
+	ring->buf_base = NULL;
+err_out_unmap:
+	munmap(ring->br, br_size);
+err_out_exit:
+	ring->br = NULL;
+	return err;
+}
+
+struct dnet_uring *dnet_uring_create(struct dnet_node *n)
+{
+	struct dnet_uring *ring;
+	struct io_uring_params p;
+	int err;
+
+	ring = malloc(sizeof(struct dnet_uring));
+	if (!ring) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+	memset(ring, 0, sizeof(struct dnet_uring));
+
+	ring->n = n;
+	INIT_LIST_HEAD(&ring->states);
+	INIT_LIST_HEAD(&ring->ready);
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, DNET_URING_ENTRIES, &p);
+	if (ring->fd < 0) {
+		err = -errno;
+		dnet_log_err(n, "Failed to setup io_uring");
+		goto err_out_free;
+	}
+
+	if ((p.features & (IORING_FEAT_NODROP | IORING_FEAT_SINGLE_MMAP)) != (IORING_FEAT_NODROP | IORING_FEAT_SINGLE_MMAP)) {
+		err = -ENOTSUP;
+		dnet_log(n, DNET_LOG_ERROR, "io_uring features %x do not include required nodrop and single mmap ones\n",
+				p.features);
+		goto err_out_close;
+	}
+
+	ring->ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	if (ring->ring_size < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe))
+		ring->ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQ_RING);
+	if (ring->ring_ptr == MAP_FAILED) {
+		err = -errno;
+		dnet_log_err(n, "Failed to map io_uring rings");
+		goto err_out_close;
+	}
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		err = -errno;
+		dnet_log_err(n, "Failed to map io_uring submission entries");
+		goto err_out_unmap;
+	}
+
+	ring->sq_head = ring->ring_ptr + p.sq_off.head;
+	ring->sq_tail = ring->ring_ptr + p.sq_off.tail;
+	ring->sq_mask = ring->ring_ptr + p.sq_off.ring_mask;
+	ring->sq_array = ring->ring_ptr + p.sq_off.array;
+	ring->sq_entries = p.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+
+	ring->cq_head = ring->ring_ptr + p.cq_off.head;
+	ring->cq_tail = ring->ring_ptr + p.cq_off.tail;
+	ring->cq_mask = ring->ring_ptr + p.cq_off.ring_mask;
+	ring->cqes = ring->ring_ptr + p.cq_off.cqes;
+
+	err = pthread_mutex_init(&ring->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_unmap_sqes;
+	}
+
+	dnet_uring_probe(ring);
+	if (ring->data_ops) {
+		err = dnet_uring_buf_ring_init(ring);
+		if (err)
+			dnet_log(n, DNET_LOG_NOTICE, "Failed to register io_uring receive buffers: %d, using poll requests\n", err);
+		else
+			ring->recv_multishot = 1;
+	}
+
+	dnet_log(n, DNET_LOG_INFO, "io_uring engine: multishot recv: %d, linked send requests: %d\n",
+			ring->recv_multishot, ring->data_ops);
+
+	fcntl(ring->fd, F_SETFD, FD_CLOEXEC);
+	return ring;
+
+err_out_unmap_sqes:
+	munmap(ring->sqes, ring->sqes_size);
+err_out_unmap:
+	munmap(ring->ring_ptr, ring->ring_size);
+err_out_close:
+	close(ring->fd);
+err_out_free:
+	free(ring);
+err_out_exit:
+	errno = -err;
+	return NULL;
+}
+
+static struct dnet_uring_state *dnet_uring_state_alloc_nolock(struct dnet_uring *ring, struct dnet_net_state *st)
+{
+	struct dnet_uring_state *us;
+
+	us = malloc(sizeof(struct dnet_uring_state));
+	if (!us)
+		return NULL;
+	memset(us, 0, sizeof(struct dnet_uring_state));
+
+	us->ring = ring;
+	us->st = st;
+	us->rx_head = us->rx_tail = -1;
+	us->pipe[0] = us->pipe[1] = -1;
+	INIT_LIST_HEAD(&us->ready_entry);
+
+	list_add_tail(&us->entry, &ring->states);
+
+	st->uring = us;
+	return us;
+}
+
+/*
+ * Called when the last state reference is dropped, so there are no requests in flight.
+ */
+void dnet_uring_state_destroy(struct dnet_net_state *st)
+{
+	struct dnet_uring_state *us = st->uring;
+	struct dnet_uring *ring;
+
+	if (!us)
+		return;
+
+	ring = us->ring;
+	if (ring) {
+		pthread_mutex_lock(&ring->lock);
+		dnet_uring_rx_drop_nolock(ring, us);
+		list_del(&us->entry);
+		pthread_mutex_unlock(&ring->lock);
+	}
+
+	if (us->pipe[0] >= 0) {
+		close(us->pipe[0]);
+		close(us->pipe[1]);
+	}
+
+	free(us);
+	st->uring = NULL;
+}
+
+/*
+ * Schedules recv or send request for given direction, it is a noop if request is already in flight.
+ */
+/*
+ * Network thread blocked in wait is woken up by a no-op request
+ */
+static void dnet_uring_wake_nolock(struct dnet_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = dnet_uring_get_sqe_nolock(ring);
+	if (sqe) {
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data = DNET_URING_UD_CANCEL;
+		dnet_uring_commit_nolock(ring);
+	}
+
+	dnet_uring_submit_nolock(ring);
+}
+
+void dnet_uring_wake(struct dnet_uring *ring)
+{
+	pthread_mutex_lock(&ring->lock);
+	dnet_uring_wake_nolock(ring);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/*
+ * Queues state which still has received chunks (or end of stream) into ready list, so that it is
+ * reported by the next wait.
+ */
+static void dnet_uring_ready_nolock(struct dnet_uring *ring, struct dnet_uring_state *us, int wake)
+{
+	if (us->flags & DNET_URING_READY)
+		return;
+	if (us->rx_head < 0 && !(us->flags & DNET_URING_RX_DONE))
+		return;
+
+	list_add_tail(&us->ready_entry, &ring->ready);
+	us->flags |= DNET_URING_READY | DNET_URING_RX_EVENT;
+	dnet_state_get(us->st);
+
+	if (wake)
+		dnet_uring_wake_nolock(ring);
+}
+
+int dnet_uring_schedule(struct dnet_net_state *st, int send)
+{
+	struct dnet_uring *ring = st->nio->ring;
+	struct dnet_uring_state *us;
+	int err = 0;
+
+	pthread_mutex_lock(&ring->lock);
+	us = st->uring;
+	if (!us) {
+		us = dnet_uring_state_alloc_nolock(ring, st);
+		if (!us) {
+			err = -ENOMEM;
+			goto err_out_unlock;
+		}
+	}
+
+	us->flags |= send ? DNET_URING_WANT_SEND : DNET_URING_WANT_RECV;
+
+	/* chunks received before recv was unscheduled are not reported by the kernel again */
+	if (!send)
+		dnet_uring_ready_nolock(ring, us, !dnet_uring_is_net_thread(st));
+
+	/* completion of in-flight send chain reports EPOLLOUT itself */
+	if (send && (us->flags & (DNET_URING_ARMED_SEND | DNET_URING_SENDING)))
+		goto err_out_unlock;
+	if (!send && (us->flags & (DNET_URING_ARMED_RECV | DNET_URING_RX_DONE)))
+		goto err_out_unlock;
+
+	err = dnet_uring_arm_nolock(ring, us, send);
+	if (!err && !dnet_uring_is_net_thread(st))
+		dnet_uring_submit_nolock(ring);
+
+err_out_unlock:
+	pthread_mutex_unlock(&ring->lock);
+
+	if (err)
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to add %s request: %d\n",
+				dnet_state_dump_addr(st), send ? "SEND" : "RECV", err);
+	return err;
+}
+
+/*
+ * Cancels in-flight requests, their state references are dropped when cancellation completes.
+ */
+void dnet_uring_unschedule(struct dnet_net_state *st, int send)
+{
+	struct dnet_uring *ring = st->nio->ring;
+	struct dnet_uring_state *us;
+
+	pthread_mutex_lock(&ring->lock);
+	us = st->uring;
+	if (us) {
+		us->flags &= ~(send ? DNET_URING_WANT_SEND : DNET_URING_WANT_RECV);
+		dnet_uring_cancel_state_nolock(ring, us, send);
+
+		if (!dnet_uring_is_net_thread(st))
+			dnet_uring_submit_nolock(ring);
+	}
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/*
+ * Network thread rearms requests of processed state, so that pending data is reported again.
+ * Reference of the completed request was transferred to the network loop, rearmed request takes a new one.
+ * State which still has received chunks is queued into ready list and is reported by the next wait.
+ */
+void dnet_uring_rearm(struct dnet_net_state *st)
+{
+	struct dnet_uring *ring = st->nio->ring;
+	struct dnet_uring_state *us;
+
+	pthread_mutex_lock(&ring->lock);
+	us = st->uring;
+	if (!us)
+		goto err_out_unlock;
+
+	us->flags &= ~DNET_URING_RX_EVENT;
+
+	if (us->flags & DNET_URING_WANT_RECV) {
+		dnet_uring_ready_nolock(ring, us, 0);
+
+		if (!(us->flags & (DNET_URING_ARMED_RECV | DNET_URING_RX_DONE)))
+			dnet_uring_arm_nolock(ring, us, 0);
+	}
+
+	if ((us->flags & DNET_URING_WANT_SEND) && !(us->flags & (DNET_URING_ARMED_SEND | DNET_URING_SENDING)))
+		dnet_uring_arm_nolock(ring, us, 1);
+
+err_out_unlock:
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/*
+ * Handles completion of recv request, returns events to be reported.
+ * @final is cleared if request is still in flight or its reference was transferred to the rearmed one.
+ */
+static int dnet_uring_complete_recv_nolock(struct dnet_uring *ring, struct dnet_uring_state *us,
+		struct io_uring_cqe *cqe, int *final)
+{
+	int bid, res = cqe->res;
+
+	if (!(us->flags & DNET_URING_MULTISHOT)) {
+		us->flags &= ~DNET_URING_ARMED_RECV;
+
+		if (!(us->flags & DNET_URING_WANT_RECV))
+			return 0;
+
+		/*
+		 * Request was cancelled, but state was scheduled again before cancellation completed,
+		 * reference is transferred to the new request.
+		 */
+		if (res == -ECANCELED) {
+			if (!dnet_uring_arm_recv_nolock(ring, us)) {
+				*final = 0;
+				return 0;
+			}
+
+			return EPOLLIN;
+		}
+
+		if (res < 0)
+			return EPOLLERR;
+
+		return res;
+	}
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		ring->buf_free--;
+
+		/* recv may be unscheduled only temporarily (like when request is parked), data is kept */
+		if (res > 0 && !us->st->need_exit) {
+			ring->bufs[bid].len = res;
+			ring->bufs[bid].next = -1;
+
+			if (us->rx_tail >= 0)
+				ring->bufs[us->rx_tail].next = bid;
+			else
+				us->rx_head = bid;
+			us->rx_tail = bid;
+		} else {
+			dnet_uring_buf_put_nolock(ring, bid);
+		}
+	}
+
+	if (cqe->flags & IORING_CQE_F_MORE) {
+		*final = 0;
+
+		if (res <= 0 || !(us->flags & DNET_URING_WANT_RECV) || (us->flags & DNET_URING_RX_EVENT))
+			return 0;
+
+		us->flags |= DNET_URING_RX_EVENT;
+		return EPOLLIN;
+	}
+
+	us->flags &= ~(DNET_URING_ARMED_RECV | DNET_URING_MULTISHOT);
+
+	if (!(us->flags & DNET_URING_WANT_RECV))
+		return 0;
+
+	if (res == -ECANCELED) {
+		if (!dnet_uring_arm_recv_nolock(ring, us)) {
+			*final = 0;
+			return 0;
+		}
+	} else if (res == -EINVAL || res == -EOPNOTSUPP) {
+		ring->recv_multishot = 0;
+		dnet_log(ring->n, DNET_LOG_ERROR, "%s: multishot recv is not supported: %d, using poll requests\n",
+				dnet_state_dump_addr(us->st), res);
+	} else if (res == 0) {
+		us->flags |= DNET_URING_RX_DONE;
+		us->rx_err = 0;
+	} else if (res < 0 && res != -ENOBUFS) {
+		us->flags |= DNET_URING_RX_DONE;
+		us->rx_err = res;
+	}
+
+	/*
+	 * Buffers have run out or request was terminated: processing consumes
+	 * queued chunks and rearms either multishot recv or poll request.
+	 */
+	if (us->flags & DNET_URING_RX_EVENT)
+		return 0;
+
+	us->flags |= DNET_URING_RX_EVENT;
+	return EPOLLIN;
+}
+
+/*
+ * Converts completions into epoll events, every returned event holds a state reference.
+ * References which must be dropped are collected in @put, since dropping the last one
+ * destroys state, which takes ring lock. If @ev is NULL, no events are reported.
+ */
+static int dnet_uring_reap_nolock(struct dnet_uring *ring, struct epoll_event *ev, int num,
+		struct dnet_net_state **put, int *put_num)
+{
+	struct dnet_net_state *st;
+	struct dnet_uring_state *us;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	unsigned long long ud, op;
+	int events, final, ready = 0, reaped = 0;
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail && (!ev || ready < num) && reaped < DNET_URING_REAP_BATCH; ++head, ++reaped) {
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		ud = cqe->user_data;
+
+		if (ud == DNET_URING_UD_CANCEL)
+			continue;
+
+		if (ud == DNET_URING_UD_TIMEOUT) {
+			ring->timeout_armed--;
+			ring->timeout_expires = ~0ULL;
+			continue;
+		}
+
+		op = ud & DNET_URING_OP_MASK;
+		st = (struct dnet_net_state *)(unsigned long)(ud & ~DNET_URING_OP_MASK);
+		us = st->uring;
+
+		events = 0;
+		final = 1;
+
+		switch (op) {
+		case DNET_URING_OP_RECV:
+			events = dnet_uring_complete_recv_nolock(ring, us, cqe, &final);
+			break;
+		case DNET_URING_OP_POLL_SEND:
+			us->flags &= ~DNET_URING_ARMED_SEND;
+
+			if (!(us->flags & DNET_URING_WANT_SEND))
+				break;
+
+			if (cqe->res == -ECANCELED) {
+				if (!dnet_uring_arm_send_nolock(ring, us)) {
+					final = 0;
+					break;
+				}
+
+				events = EPOLLOUT;
+			} else if (cqe->res < 0) {
+				events = EPOLLERR;
+			} else {
+				events = cqe->res;
+			}
+			break;
+		default:
+			us->res[DNET_URING_CHAIN_IDX(op)] = cqe->res;
+
+			if (--us->pending == 0) {
+				us->flags &= ~DNET_URING_SENDING;
+
+				if (us->flags & DNET_URING_WANT_SEND)
+					events = EPOLLOUT;
+			}
+			break;
+		}
+
+		if (!ev)
+			events = 0;
+
+		if (final)
+			ring->ops--;
+
+		if (events) {
+			if (!final)
+				dnet_state_get(st);
+
+			ev[ready].events = events;
+			ev[ready].data.ptr = st;
+			ready++;
+		} else if (final) {
+			put[(*put_num)++] = st;
+		}
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return ready;
+}
+
+static void dnet_uring_arm_timeout_nolock(struct dnet_uring *ring, int timeout)
+{
+	struct io_uring_sqe *sqe;
+	uint64_t expires = dnet_io_now_usecs() / 1000 + timeout;
+
+	if (ring->timeout_armed && expires >= ring->timeout_expires)
+		return;
+
+	sqe = dnet_uring_get_sqe_nolock(ring);
+	if (!sqe)
+		return;
+
+	ring->timeout.tv_sec = timeout / 1000;
+	ring->timeout.tv_nsec = (timeout % 1000) * 1000000;
+
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = (unsigned long)&ring->timeout;
+	sqe->len = 1;
+	sqe->user_data = DNET_URING_UD_TIMEOUT;
+	dnet_uring_commit_nolock(ring);
+
+	ring->timeout_armed++;
+	ring->timeout_expires = expires;
+}
+
+/*
+ * Submits pending requests, waits for completions up to @timeout milliseconds
+ * and converts them into epoll events. Every returned event holds a state reference.
+ * States from the ready list are reported first and waiting does not block then.
+ */
+int dnet_uring_wait(struct dnet_net_io *nio, struct epoll_event *ev, int num, int timeout)
+{
+	struct dnet_uring *ring = nio->ring;
+	struct dnet_uring_state *us;
+	struct dnet_net_state *put[DNET_URING_REAP_BATCH + DNET_NET_EVENTS];
+	int err, i, put_num = 0, ready = 0;
+
+	pthread_mutex_lock(&ring->lock);
+	while (ready < num && put_num < DNET_NET_EVENTS && !list_empty(&ring->ready)) {
+		us = list_first_entry(&ring->ready, struct dnet_uring_state, ready_entry);
+		list_del_init(&us->ready_entry);
+		us->flags &= ~DNET_URING_READY;
+
+		if (!(us->flags & DNET_URING_WANT_RECV)) {
+			put[put_num++] = us->st;
+			continue;
+		}
+
+		ev[ready].events = EPOLLIN;
+		ev[ready].data.ptr = us->st;
+		ready++;
+	}
+
+	if (ready)
+		timeout = 0;
+
+	if (timeout)
+		dnet_uring_arm_timeout_nolock(ring, timeout);
+
+	/*
+	 * Submit separately: io_uring_enter() does not wait for completions
+	 * when it has submitted fewer entries than requested.
+	 */
+	dnet_uring_submit_nolock(ring);
+	pthread_mutex_unlock(&ring->lock);
+
+	if (timeout && *ring->cq_head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		err = dnet_uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+		if (err < 0 && err != -EINTR && err != -EAGAIN && err != -EBUSY) {
+			ready = err;
+			goto err_out_put;
+		}
+	}
+
+	pthread_mutex_lock(&ring->lock);
+	ready += dnet_uring_reap_nolock(ring, ev + ready, num - ready, put, &put_num);
+	pthread_mutex_unlock(&ring->lock);
+
+err_out_put:
+	for (i = 0; i < put_num; ++i)
+		dnet_state_put(put[i]);
+
+	return ready;
+}
+
+/*
+ * Reads received chunks queued by multishot recv, falls back to recv() if multishot request is not armed.
+ * Mimics recv(): returns number of bytes read, 0 on EOF or -1 and sets errno.
+ */
+ssize_t dnet_uring_recv(struct dnet_net_state *st, void *data, size_t size)
+{
+	struct dnet_uring_state *us = st->uring;
+	struct dnet_uring *ring = us ? us->ring : NULL;
+	struct dnet_uring_buf *buf;
+	size_t copied = 0, len;
+	int bid, locked = 0;
+
+	if (!ring)
+		return recv(st->read_s, data, size, 0);
+
+	while (copied < size && us->rx_head >= 0) {
+		bid = us->rx_head;
+		buf = &ring->bufs[bid];
+
+		len = buf->len - us->rx_offset;
+		if (len > size - copied)
+			len = size - copied;
+
+		memcpy(data + copied, ring->buf_base + (unsigned long)bid * DNET_URING_BUF_SIZE + us->rx_offset, len);
+		copied += len;
+		us->rx_offset += len;
+
+		if (us->rx_offset == buf->len) {
+			us->rx_head = buf->next;
+			if (us->rx_head < 0)
+				us->rx_tail = -1;
+			us->rx_offset = 0;
+
+			if (!locked) {
+				pthread_mutex_lock(&ring->lock);
+				locked = 1;
+			}
+			dnet_uring_buf_put_nolock(ring, bid);
+		}
+	}
+
+	if (locked)
+		pthread_mutex_unlock(&ring->lock);
+
+	if (copied)
+		return copied;
+
+	if (us->flags & DNET_URING_RX_DONE) {
+		if (!us->rx_err)
+			return 0;
+
+		errno = -us->rx_err;
+		return -1;
+	}
+
+	if (us->flags & DNET_URING_MULTISHOT) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return recv(st->read_s, data, size, 0);
+}
+
+static int dnet_uring_pipe_init(struct dnet_uring_state *us)
+{
+	int size;
+
+	if (pipe2(us->pipe, O_NONBLOCK | O_CLOEXEC))
+		return -errno;
+
+	fcntl(us->pipe[1], F_SETPIPE_SZ, DNET_SEND_FILE_SLICE);
+
+	size = fcntl(us->pipe[1], F_GETPIPE_SZ);
+	if (size <= 0) {
+		close(us->pipe[0]);
+		close(us->pipe[1]);
+		us->pipe[0] = us->pipe[1] = -1;
+		return -EINVAL;
+	}
+
+	us->pipe_size = size;
+	return 0;
+}
+
+/*
+ * Applies results of completed send chain: completes sent requests and accounts spliced file body.
+ */
+static int dnet_uring_send_finish(struct dnet_net_state *st, struct dnet_uring_state *us)
+{
+	struct dnet_send_batch *b = &us->batch;
+	struct dnet_io_req *r = us->splice_req;
+	int chain = us->chain, res, err = 0;
+
+	us->chain = 0;
+
+	if (chain & DNET_URING_CHAIN_BIT(DNET_URING_OP_SENDMSG)) {
+		res = us->res[DNET_URING_CHAIN_IDX(DNET_URING_OP_SENDMSG)];
+		if (res < 0) {
+			err = res;
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to send %d requests: size: %zu, socket: %d, err: %d\n",
+					dnet_state_dump_addr(st), b->req_num, b->total, st->write_s, err);
+			goto err_out_exit;
+		}
+
+		if (res == 0) {
+			dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.\n",
+					dnet_state_dump_addr(st), st->write_s);
+			err = -ECONNRESET;
+			goto err_out_exit;
+		}
+
+		/* partially sent batch has broken the chain, the rest is sent by the next one */
+		dnet_send_batch_advance(st, b, res);
+	}
+
+	if (chain & DNET_URING_CHAIN_BIT(DNET_URING_OP_SPLICE_IN)) {
+		res = us->res[DNET_URING_CHAIN_IDX(DNET_URING_OP_SPLICE_IN)];
+		if (res > 0) {
+			us->pipe_bytes += res;
+		} else if (res == 0) {
+			err = -ENODATA;
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: file body is shorter than expected: fd: %d, size: %llu\n",
+					dnet_state_dump_addr(st), r->fd, (unsigned long long)r->fsize);
+			goto err_out_exit;
+		} else if (res != -ECANCELED) {
+			err = res;
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to splice file body: fd: %d, err: %d\n",
+					dnet_state_dump_addr(st), r->fd, err);
+			goto err_out_exit;
+		}
+	}
+
+	if (chain & DNET_URING_CHAIN_BIT(DNET_URING_OP_SPLICE_OUT)) {
+		res = us->res[DNET_URING_CHAIN_IDX(DNET_URING_OP_SPLICE_OUT)];
+		if (res > 0) {
+			us->pipe_bytes -= res;
+			st->send_offset += res;
+		} else if (res == 0) {
+			err = -ECONNRESET;
+			goto err_out_exit;
+		} else if (res != -EAGAIN && res != -ECANCELED) {
+			err = res;
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to splice file body into socket %d, err: %d\n",
+					dnet_state_dump_addr(st), st->write_s, err);
+			goto err_out_exit;
+		}
+	}
+
+	if (r && r == st->send_cur && !us->pipe_bytes && st->send_offset == r->hsize + r->dsize + r->fsize) {
+		us->splice_req = NULL;
+		dnet_send_request_complete(st, r);
+	}
+
+err_out_exit:
+	return err;
+}
+
+/*
+ * Submits linked chain which sends gathered batch, returns -EAGAIN if chain is in flight
+ * or send queue is empty. Falls back to synchronous send if kernel does not support data path requests.
+ */
+int dnet_uring_send(struct dnet_net_state *st)
+{
+	struct dnet_uring_state *us = st->uring;
+	struct dnet_uring *ring = us ? us->ring : NULL;
+	struct dnet_send_batch *b;
+	struct dnet_io_req *r;
+	struct io_uring_sqe *sqe;
+	uint64_t offset = 0, size = 0;
+	unsigned long long ops[DNET_URING_CHAIN_NUM];
+	int err, i, num = 0, more = 0;
+
+	if (!ring || !ring->data_ops || (us->flags & DNET_URING_SYNC_SEND))
+		return dnet_send_batch(st);
+
+	pthread_mutex_lock(&ring->lock);
+	err = (us->flags & DNET_URING_SENDING) ? -EAGAIN : 0;
+	pthread_mutex_unlock(&ring->lock);
+	if (err)
+		return err;
+
+	b = &us->batch;
+
+	if (us->chain) {
+		err = dnet_uring_send_finish(st, us);
+		if (err)
+			goto err_out_exit;
+	}
+
+	if (us->pipe_bytes) {
+		/* file body left in the pipe is sent before anything else */
+		r = us->splice_req;
+		size = us->pipe_bytes;
+		more = st->send_offset + size < r->hsize + r->dsize + r->fsize;
+
+		ops[num++] = DNET_URING_OP_POLL_OUT;
+		ops[num++] = DNET_URING_OP_SPLICE_OUT;
+	} else {
+		err = dnet_send_batch_gather(st, b);
+		if (err)
+			return err;
+
+		r = b->fd_req;
+		if (r && us->pipe[0] < 0 && dnet_uring_pipe_init(us)) {
+			dnet_log(st->n, DNET_LOG_NOTICE, "%s: failed to create splice pipe, sending synchronously\n",
+					dnet_state_dump_addr(st));
+			us->flags |= DNET_URING_SYNC_SEND;
+			return dnet_send_batch(st);
+		}
+
+		if (b->iov_num) {
+			memset(&us->msg, 0, sizeof(struct msghdr));
+			us->msg.msg_iov = b->iov;
+			us->msg.msg_iovlen = b->iov_num;
+
+			ops[num++] = DNET_URING_OP_SENDMSG;
+		}
+
+		if (r) {
+			if (r == st->send_cur && st->send_offset > r->hsize + r->dsize)
+				offset = st->send_offset - r->hsize - r->dsize;
+
+			/* unaligned file offset takes one more pipe page */
+			size = us->pipe_size - ((r->local_offset + offset) & (DNET_URING_PAGE_SIZE - 1));
+			if (size > r->fsize - offset)
+				size = r->fsize - offset;
+			more = offset + size < r->fsize;
+
+			us->splice_req = r;
+
+			ops[num++] = DNET_URING_OP_SPLICE_IN;
+			ops[num++] = DNET_URING_OP_POLL_OUT;
+			ops[num++] = DNET_URING_OP_SPLICE_OUT;
+		}
+	}
+
+	pthread_mutex_lock(&ring->lock);
+	err = dnet_uring_reserve_nolock(ring, num);
+	if (err) {
+		pthread_mutex_unlock(&ring->lock);
+
+		if (us->pipe_bytes)
+			return -EAGAIN;
+		return dnet_send_batch(st);
+	}
+
+	for (i = 0; i < num; ++i) {
+		sqe = dnet_uring_get_sqe_nolock(ring);
+
+		switch (ops[i]) {
+		case DNET_URING_OP_SENDMSG:
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = st->write_s;
+			sqe->addr = (unsigned long)&us->msg;
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (r ? MSG_MORE : 0);
+			break;
+		case DNET_URING_OP_SPLICE_IN:
+			sqe->opcode = IORING_OP_SPLICE;
+			sqe->splice_fd_in = r->fd;
+			sqe->splice_off_in = r->local_offset + offset;
+			sqe->fd = us->pipe[1];
+			sqe->off = -1;
+			sqe->len = size;
+			break;
+		case DNET_URING_OP_POLL_OUT:
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = st->write_s;
+			sqe->poll_events = POLLOUT;
+			break;
+		case DNET_URING_OP_SPLICE_OUT:
+			sqe->opcode = IORING_OP_SPLICE;
+			sqe->splice_fd_in = us->pipe[0];
+			sqe->splice_off_in = -1;
+			sqe->fd = st->write_s;
+			sqe->off = -1;
+			sqe->len = size;
+			sqe->splice_flags = more ? SPLICE_F_MORE : 0;
+			break;
+		}
+
+		if (i != num - 1)
+			sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = dnet_uring_ud(st, ops[i]);
+		dnet_uring_commit_nolock(ring);
+
+		us->chain |= DNET_URING_CHAIN_BIT(ops[i]);
+		dnet_state_get(st);
+		ring->ops++;
+	}
+
+	us->pending = num;
+	us->flags |= DNET_URING_SENDING;
+	pthread_mutex_unlock(&ring->lock);
+
+	return -EAGAIN;
+
+err_out_exit:
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: setting send need_exit to %d\n", dnet_state_dump_addr(st), err);
+	st->need_exit = err;
+	return err;
+}
+
+/*
+ * Must be called after network thread was stopped and states were reset.
+ * Every in-flight request is cancelled and ring is drained until all of them complete,
+ * so that their state references are dropped before ring is closed.
+ */
+void dnet_uring_destroy(struct dnet_uring *ring)
+{
+	struct dnet_uring_state *us, *tmp;
+	struct dnet_net_state *put[DNET_URING_REAP_BATCH];
+	uint64_t deadline = dnet_io_now_usecs() + 1000000;
+	int i, put_num;
+
+	if (!ring)
+		return;
+
+	do {
+		put_num = 0;
+
+		pthread_mutex_lock(&ring->lock);
+		while (put_num < DNET_URING_REAP_BATCH && !list_empty(&ring->ready)) {
+			us = list_first_entry(&ring->ready, struct dnet_uring_state, ready_entry);
+			list_del_init(&us->ready_entry);
+			us->flags &= ~DNET_URING_READY;
+
+			put[put_num++] = us->st;
+		}
+		pthread_mutex_unlock(&ring->lock);
+
+		for (i = 0; i < put_num; ++i)
+			dnet_state_put(put[i]);
+	} while (put_num);
+
+	pthread_mutex_lock(&ring->lock);
+	list_for_each_entry(us, &ring->states, entry) {
+		us->flags &= ~(DNET_URING_WANT_RECV | DNET_URING_WANT_SEND);
+
+		dnet_uring_cancel_state_nolock(ring, us, 0);
+		dnet_uring_cancel_state_nolock(ring, us, 1);
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	while (1) {
+		put_num = 0;
+
+		pthread_mutex_lock(&ring->lock);
+		dnet_uring_reap_nolock(ring, NULL, 0, put, &put_num);
+
+		if (ring->ops && dnet_io_now_usecs() < deadline)
+			dnet_uring_arm_timeout_nolock(ring, 100);
+		dnet_uring_submit_nolock(ring);
+		pthread_mutex_unlock(&ring->lock);
+
+		for (i = 0; i < put_num; ++i)
+			dnet_state_put(put[i]);
+
+		if (!ring->ops || dnet_io_now_usecs() >= deadline)
+			break;
+
+		if (*ring->cq_head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+			dnet_uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+	}
+
+	if (ring->ops)
+		dnet_log(ring->n, DNET_LOG_ERROR, "io_uring: %ld requests have not completed after cancellation, "
+				"their state references are leaked\n", ring->ops);
+
+	/* states may outlive the ring, their chunks point to buffers freed below */
+	pthread_mutex_lock(&ring->lock);
+	list_for_each_entry_safe(us, tmp, &ring->states, entry) {
+		us->rx_head = us->rx_tail = -1;
+		us->ring = NULL;
+		list_del_init(&us->entry);
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->ring_ptr, ring->ring_size);
+	close(ring->fd);
+
+	if (ring->br) {
+		munmap(ring->br, DNET_URING_BUF_NUM * sizeof(struct io_uring_buf));
+		free(ring->buf_base);
+	}
+
+	pthread_mutex_destroy(&ring->lock);
+	free(ring);
+}
+
+#else
+
+struct dnet_uring *dnet_uring_create(struct dnet_node *n)
+{
+	dnet_log(n, DNET_LOG_ERROR, "Elliptics was built without io_uring support\n");
+	errno = ENOTSUP;
+	return NULL;
+}
+
+void dnet_uring_destroy(struct dnet_uring *ring __unused)
+{
+}
+
+void dnet_uring_state_destroy(struct dnet_net_state *st __unused)
+{
+}
+
+int dnet_uring_schedule(struct dnet_net_state *st __unused, int send __unused)
+{
+	return -ENOTSUP;
+}
+
+void dnet_uring_unschedule(struct dnet_net_state *st __unused, int send __unused)
+{
+}
+
+void dnet_uring_rearm(struct dnet_net_state *st __unused)
+{
+}
+
+int dnet_uring_wait(struct dnet_net_io *nio __unused, struct epoll_event *ev __unused, int num __unused,
+		int timeout __unused)
+{
+	return -ENOTSUP;
+}
+
+void dnet_uring_wake(struct dnet_uring *ring __unused)
+{
+}
+
+ssize_t dnet_uring_recv(struct dnet_net_state *st, void *data, size_t size)
+{
+	return recv(st->read_s, data, size, 0);
+}
+
+int dnet_uring_send(struct dnet_net_state *st)
+{
+	return dnet_send_batch(st);
+}
+
+#endif